@@ -0,0 +1,282 @@
+//
+//  AnalysisMask.h
+//  Motus
+//
+//  Which parts of the frame are worth analyzing. The stage is a fixed floor area, so walls, the audience and
+//  depth holes are masked out once instead of being blurred & differenced every frame.
+//  Two sources, compiled into one bit per tile:
+//    - region of interest polygons, in coordinates normalized to the frame (so they survive a window resize)
+//    - a near/far depth band, from the point stream -- a tile is live if enough of its points are inside the band
+//  Read from assets/mask.json:
+//  {
+//    "enabled": true,
+//    "depth": { "near": 0.5, "far": 6.0 },                              <-- meters
+//    "regions": [ [ [0.1, 0.2], [0.9, 0.2], [0.95, 1.0], [0.05, 1.0] ] ]   <-- any number of polygons, x y in [0,1]
+//  }
+//  No regions means the whole frame, no depth means any depth.
+//
+
+#ifndef AnalysisMask_h
+#define AnalysisMask_h
+
+#include "cinder/Json.h"
+#include "cinder/Log.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#define MASK_TILE_SIZE 16 //pixels -- tiles are skipped whole
+#define MASK_DEPTH_MIN_FRACTION 0.05f //a tile needs this fraction of its points in the depth band to be live
+
+class AnalysisMask
+{
+protected:
+    bool enabled;
+    std::vector< std::vector<ci::vec2> > regions; //normalized polygons
+    float nearDepth, farDepth; //meters, 0 == no band
+
+    int width, height; //frame the tiles cover
+    int tilesX, tilesY;
+    int wordsPerRow;
+    std::vector<uint64_t> roiBits; //tiles inside a region, only recompiled when the regions or size change
+    std::vector<uint64_t> bits; //live tiles this frame -- roi & depth
+    int liveCount;
+
+    //depth band hits, per tile of the depth image. counted in the astra callback, read by the analysis -- so locked
+    std::mutex depthMutex;
+    int depthTilesX, depthTilesY;
+    std::vector<uint16_t> depthHits, depthTotal;
+    bool hasDepth;
+
+    static bool inside(const std::vector<ci::vec2> &poly, ci::vec2 p)
+    {
+        bool in = false;
+        for(int i=0, j=poly.size()-1; i<poly.size(); j=i++)
+        {
+            if( ( poly[i].y > p.y ) != ( poly[j].y > p.y ) &&
+                p.x < ( poly[j].x - poly[i].x ) * ( p.y - poly[i].y ) / ( poly[j].y - poly[i].y ) + poly[i].x )
+                in = !in;
+        }
+        return in;
+    };
+
+    inline ci::vec2 tileCenter(int tx, int ty)
+    {
+        return ci::vec2( ( std::min( (tx + 0.5f) * MASK_TILE_SIZE, (float) width ) ) / width,
+                         ( std::min( (ty + 0.5f) * MASK_TILE_SIZE, (float) height ) ) / height );
+    };
+
+    inline void setBit(std::vector<uint64_t> &b, int tx, int ty)
+    {
+        b[ ty * wordsPerRow + (tx >> 6) ] |= uint64_t(1) << (tx & 63);
+    };
+
+    void compileRegions()
+    {
+        roiBits.assign(tilesY * wordsPerRow, 0);
+        for(int ty=0; ty<tilesY; ty++)
+        {
+            for(int tx=0; tx<tilesX; tx++)
+            {
+                bool live = regions.empty();
+                ci::vec2 c = tileCenter(tx, ty);
+                for(int r=0; r<regions.size() && !live; r++) live = inside(regions[r], c);
+                if( live ) setBit(roiBits, tx, ty);
+            }
+        }
+    };
+
+    bool depthLive(ci::vec2 c)
+    {
+        if( !hasDepth || farDepth <= 0 ) return true;
+        int dx = std::min( (int) ( c.x * depthTilesX ), depthTilesX - 1 );
+        int dy = std::min( (int) ( c.y * depthTilesY ), depthTilesY - 1 );
+        int i = dy * depthTilesX + dx;
+        return depthTotal[i] > 0 && depthHits[i] >= MASK_DEPTH_MIN_FRACTION * depthTotal[i];
+    };
+
+public:
+    AnalysisMask()
+    {
+        enabled = true;
+        nearDepth = farDepth = 0;
+        width = height = 0;
+        tilesX = tilesY = wordsPerRow = 0;
+        liveCount = 0;
+        depthTilesX = depthTilesY = 0;
+        hasDepth = false;
+    };
+
+    bool load(const ci::fs::path &path)
+    {
+        if( !ci::fs::exists(path) )
+        {
+            CI_LOG_W( "No mask file at " << path << ", analyzing the whole frame" );
+            return false;
+        }
+
+        try
+        {
+            ci::JsonTree json( ci::loadFile(path) );
+            std::vector< std::vector<ci::vec2> > newRegions;
+            if( json.hasChild("regions") )
+            {
+                for( const ci::JsonTree &r : json.getChild("regions").getChildren() )
+                {
+                    std::vector<ci::vec2> poly;
+                    for( const ci::JsonTree &p : r.getChildren() )
+                        poly.push_back( ci::vec2( p[0].getValue<float>(), p[1].getValue<float>() ) );
+                    if( poly.size() >= 3 ) newRegions.push_back(poly);
+                }
+            }
+
+            regions = newRegions;
+            if( json.hasChild("depth") )
+            {
+                nearDepth = json.getChild("depth").getValueForKey<float>("near");
+                farDepth = json.getChild("depth").getValueForKey<float>("far");
+            }
+            if( json.hasChild("enabled") )
+            {
+                std::string v = json.getValueForKey("enabled"); //json bools come back as "0" & "1", same as in the graph config
+                enabled = v == "true" || v == "1";
+            }
+
+            width = height = 0; //recompile the regions on the next frame
+            CI_LOG_I( "Loaded analysis mask from " << path );
+            return true;
+        }
+        catch( ci::Exception &e )
+        {
+            CI_LOG_E( "Error loading mask file " << path << ": " << e.what() );
+            return false;
+        }
+    };
+
+    //counts the in band points per depth tile. xyz is width*height points in mm, eg. an astra::PointFrame's data()
+    void updateDepth(const float *xyz, int w, int h)
+    {
+        if( farDepth <= 0 ) return;
+        std::lock_guard<std::mutex> lock(depthMutex);
+        int dtx = ( w + MASK_TILE_SIZE - 1 ) / MASK_TILE_SIZE, dty = ( h + MASK_TILE_SIZE - 1 ) / MASK_TILE_SIZE;
+        if( dtx != depthTilesX || dty != depthTilesY )
+        {
+            depthTilesX = dtx; depthTilesY = dty;
+            depthHits.resize(dtx * dty);
+            depthTotal.resize(dtx * dty);
+        }
+        std::fill(depthHits.begin(), depthHits.end(), 0);
+        std::fill(depthTotal.begin(), depthTotal.end(), 0);
+
+        float nearMM = nearDepth * 1000, farMM = farDepth * 1000;
+        for(int y=0; y<h; y+=2) //every other pixel is plenty for a fraction
+        {
+            const float *p = xyz + 3 * y * w;
+            uint16_t *hits = &depthHits[ (y / MASK_TILE_SIZE) * dtx ];
+            uint16_t *total = &depthTotal[ (y / MASK_TILE_SIZE) * dtx ];
+            for(int x=0; x<w; x+=2, p+=6)
+            {
+                int t = x / MASK_TILE_SIZE;
+                total[t]++;
+                hits[t] += p[2] >= nearMM && p[2] <= farMM; //a hole is z == 0, so it's never in the band
+            }
+        }
+        hasDepth = true;
+    };
+
+    //rebuilds the live tiles for a frame of this size. call once a frame, before the analysis
+    void compile(int w, int h)
+    {
+        if( w != width || h != height )
+        {
+            width = w; height = h;
+            tilesX = ( w + MASK_TILE_SIZE - 1 ) / MASK_TILE_SIZE;
+            tilesY = ( h + MASK_TILE_SIZE - 1 ) / MASK_TILE_SIZE;
+            wordsPerRow = ( tilesX + 63 ) / 64;
+            compileRegions();
+        }
+
+        std::lock_guard<std::mutex> lock(depthMutex);
+        bits = roiBits;
+        liveCount = 0;
+        for(int ty=0; ty<tilesY; ty++)
+        {
+            for(int tx=0; tx<tilesX; tx++)
+            {
+                uint64_t &word = bits[ ty * wordsPerRow + (tx >> 6) ];
+                uint64_t bit = uint64_t(1) << (tx & 63);
+                if( !( word & bit ) ) continue;
+                if( !depthLive( tileCenter(tx, ty) ) ) word &= ~bit;
+                else liveCount++;
+            }
+        }
+    };
+
+    inline bool isEnabled(){ return enabled; };
+    inline void setEnabled(bool e){ enabled = e; };
+    inline int getTilesX(){ return tilesX; };
+    inline int getTilesY(){ return tilesY; };
+
+    inline bool isLive(int tx, int ty)
+    {
+        if( !enabled ) return true;
+        return ( bits[ ty * wordsPerRow + (tx >> 6) ] >> (tx & 63) ) & 1;
+    };
+
+    //is any tile touching this pixel rect live?
+    bool anyLive(const cv::Rect &r)
+    {
+        if( !enabled ) return true;
+        int tx0 = std::max(0, r.x / MASK_TILE_SIZE), tx1 = std::min(tilesX - 1, (r.x + r.width - 1) / MASK_TILE_SIZE);
+        int ty0 = std::max(0, r.y / MASK_TILE_SIZE), ty1 = std::min(tilesY - 1, (r.y + r.height - 1) / MASK_TILE_SIZE);
+        for(int ty=ty0; ty<=ty1; ty++)
+            for(int tx=tx0; tx<=tx1; tx++)
+                if( isLive(tx, ty) ) return true;
+        return false;
+    };
+
+    //the live tiles as rects, w/ runs of live tiles in a row merged -- so a stage can run an opencv call per rect
+    void getLiveRects(std::vector<cv::Rect> &rects)
+    {
+        rects.clear();
+        for(int ty=0; ty<tilesY; ty++)
+        {
+            int tx = 0;
+            while( tx < tilesX )
+            {
+                if( !isLive(tx, ty) ) { tx++; continue; }
+                int start = tx;
+                while( tx < tilesX && isLive(tx, ty) ) tx++;
+                cv::Rect r( start * MASK_TILE_SIZE, ty * MASK_TILE_SIZE, (tx - start) * MASK_TILE_SIZE, MASK_TILE_SIZE );
+                rects.push_back( r & cv::Rect(0, 0, width, height) );
+            }
+        }
+    };
+
+    //zeroes the masked tiles of img, for stages that can't skip them
+    void apply(cv::Mat &img)
+    {
+        if( !enabled || img.cols != width || img.rows != height ) return;
+        for(int ty=0; ty<tilesY; ty++)
+        {
+            for(int tx=0; tx<tilesX; tx++)
+            {
+                if( isLive(tx, ty) ) continue;
+                cv::Rect r = cv::Rect( tx * MASK_TILE_SIZE, ty * MASK_TILE_SIZE, MASK_TILE_SIZE, MASK_TILE_SIZE ) & cv::Rect(0, 0, width, height);
+                img(r).setTo(0);
+            }
+        }
+    };
+
+    //fraction of the frame that's skipped
+    float getMaskedFraction()
+    {
+        if( !enabled || tilesX * tilesY == 0 ) return 0;
+        return 1.0f - (float) liveCount / ( tilesX * tilesY );
+    };
+};
+
+#endif /* AnalysisMask_h */
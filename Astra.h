@@ -30,6 +30,10 @@
 
 #include "astra/astra.hpp"
 #include "LitDepthVisualizer.hpp"
+#include "PointCloud.h"
+#include "AnalysisMask.h"
+#include "Stats.h"
+#include "FrameSource.h"
 
 //this was modified from from Astra API  samples by Courtney Brown
 class SampleFrameListener : public astra::FrameListener
@@ -43,6 +47,7 @@ private:
     //making it work with cinder - CDB
     ci::SurfaceRef mSurface;
     bool new_frame_ready;
+    double frameTime_ = 0; //when the newest frame arrived, on the stats clock
     
     int depthWidth_{0};
     int depthHeight_{0};
@@ -58,6 +63,9 @@ private:
     
     LitDepthVisualizer visualizer_;
     
+    PointCloudAnalysis pointCloud_; //3D analysis of each point frame
+    AnalysisMask *mask_ = NULL; //gets the depth band hits of each frame, if set
+    
 public:
     //CDB -  init some values
         SampleFrameListener() : astra::FrameListener()
@@ -74,11 +82,17 @@ public:
 //        const astra::DepthFrame depthFrame = frame.get<astra::DepthFrame>();  //not used
         
         const astra::PointFrame pointFrame = frame.get<astra::PointFrame>();
+        frameTime_ = CRCPMotionAnalysis::StatsRegistry::now();
+        check_fps();
 
             const int width = pointFrame.width();
             const int height = pointFrame.height();
 //
             visualizer_.update(pointFrame);
+        
+            //world space xyz for the 3D analysis -- Vector3f is 3 packed floats
+            pointCloud_.process( reinterpret_cast<const float *>( pointFrame.data() ), width, height );
+            if( mask_ ) mask_->updateDepth( reinterpret_cast<const float *>( pointFrame.data() ), width, height );
             
             if(mSurface == NULL)
                 mSurface = ci::Surface::create(width, height, true);
@@ -174,22 +188,51 @@ public:
         return mSurface;
     }
     
+    //when the frame getNewFrame() returns arrived
+    double getFrameTime()
+    {
+        return frameTime_;
+    }
+    
+    //voxels, occupancy changes & performer volumes of the frames so far
+    PointCloudAnalysis &getPointCloud()
+    {
+        return pointCloud_;
+    }
+    
+    //the mask whose depth band follows the point stream
+    void setMask(AnalysisMask *mask)
+    {
+        mask_ = mask;
+    }
+    
     //did we get a new frame from the astra?
     bool newFrame()
     {
         return new_frame_ready;
     }
     
-    //can be added back into on_frame_ready to check/see the frame rate.
+    //print the frame rate every frame, as well as timing it
+    void setPrintFps(bool print)
+    {
+        printFps_ = print;
+    }
+    
+    //called from on_frame_ready -- the time between depth frames goes into the astra/frame_interval timer
     void check_fps()
     {
         const double frameWeight = 0.2;
         
         auto newTimepoint = clock_type::now();
         auto frameDuration = std::chrono::duration_cast<duration_type>(newTimepoint - lastTimepoint_);
+        bool first = lastTimepoint_ == std::chrono::time_point<clock_type>();
+        lastTimepoint_ = newTimepoint;
+        if( first ) return; //no interval yet
         
         frameDuration_ = frameDuration * frameWeight + frameDuration_ * (1 - frameWeight);
-        lastTimepoint_ = newTimepoint;
+        if( !intervalTimer_ ) intervalTimer_ = CRCPMotionAnalysis::StatsRegistry::get("astra/frame_interval", false);
+        CRCPMotionAnalysis::StatsRegistry::record( intervalTimer_, frameDuration.count() );
+        if( !printFps_ ) return;
         
         double fps = 1.0 / frameDuration_.count();
         
@@ -207,8 +250,63 @@ private:
     using duration_type = std::chrono::duration < double > ;
     duration_type frameDuration_{ 0.0 };
     
-    using clock_type = std::chrono::system_clock;
+    using clock_type = std::chrono::steady_clock;
     std::chrono::time_point<clock_type> lastTimepoint_;
+    CRCPMotionAnalysis::LatencyHistogram *intervalTimer_ = NULL;
+    bool printFps_ = false;
     
 };
+
+//one astra as a frame source -- its own stream set & listener. astra only calls back from astra_temp_update(),
+//so the frames are pushed from poll() on the main thread, w/ the time the callback got them
+class AstraSource : public FrameSource
+{
+protected:
+    std::string uri;
+    astra::StreamSet streamSet;
+    astra::StreamReader reader;
+    SampleFrameListener listener;
+    bool started = false;
+
+public:
+    AstraSource(const std::string &_name, const ci::Rectf &_stage, const std::string &_uri = "device/default") :
+        FrameSource(_name, _stage), uri(_uri), streamSet( _uri.c_str() ) {};
+    ~AstraSource(){ stop(); };
+
+    bool start()
+    {
+        reader = streamSet.create_reader();
+        reader.stream<astra::PointStream>().start();
+        reader.stream<astra::DepthStream>().start();
+        reader.add_listener(listener);
+        started = true;
+
+        std::cout << name << " (" << uri << ") depthStream -- hFov: "
+        << reader.stream<astra::DepthStream>().hFov()
+        << " vFov: "
+        << reader.stream<astra::DepthStream>().vFov()
+        << std::endl;
+
+        //makes sure this is a valid stream
+        std::cout << "valid:" << streamSet.is_valid() <<std:: endl;
+        return streamSet.is_valid();
+    };
+
+    void stop()
+    {
+        if( !started ) return;
+        reader.remove_listener(listener);
+        started = false;
+    };
+
+    void poll()
+    {
+        if( !listener.newFrame() ) return;
+        double time = listener.getFrameTime();
+        push( *listener.getNewFrame(), time );
+    };
+
+    inline SampleFrameListener &getListener(){ return listener; };
+};
+
 #endif /* AstraClass_h */
@@ -0,0 +1,221 @@
+//
+//  BackgroundModel.h
+//  Motus
+//
+//  Background subtraction stage for the depth image. Alternatives to differencing against the previous frame:
+//  a static reference frame, a running average, and opencv's MOG2/KNN subtractors.
+//  The frame is cut into horizontal row bands that are processed in parallel, each band with its own model,
+//  and the models only learn every Nth frame so the per-frame cost stays bounded.
+//  The analysis size changes under load (QualityController) & w/ the window, & the models survive it: the reference
+//  & the running average are rescaled, & MOG2/KNN keep running at the size they were made at, w/ the frame scaled to
+//  them & their foreground scaled back. Only a mode change starts the learning over.
+//
+
+#ifndef BackgroundModel_h
+#define BackgroundModel_h
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video.hpp>
+
+#include <vector>
+
+#define BG_BAND_COUNT 8 //one band per core on the show machine
+#define BG_UPDATE_EVERY 4 //models learn every 4th frame
+#define BG_LEARNING_RATE 0.005 //slow enough that someone standing still stays in the foreground for a long while
+#define BG_THRESHOLD 50 //same threshold as the frame differencing
+
+class BackgroundModel
+{
+public:
+    enum Mode { PREV_FRAME=0, STATIC_REFERENCE=1, RUNNING_AVERAGE=2, MOG2=3, KNN=4, MODE_COUNT=5 };
+
+protected:
+    Mode mode;
+    int bandCount;
+    int updateEvery;
+    int frameCount;
+    double learningRate;
+    int threshold;
+
+    cv::Size modelSize; //the size the models were made at -- empty after a mode change, until the next frame
+    cv::Size frameSize; //the size of the frames coming in
+    cv::Mat referenceCapture; //static reference frame as it was captured, 8 bit...
+    cv::Mat reference; //...& at the frame size
+    cv::Mat scaledIn, scaledOut; //MOG2/KNN's input & foreground at the model size, when the frames aren't
+    cv::Mat average; //running average, 32 bit float
+    cv::Mat averageU8; //running average converted back for differencing
+    std::vector< cv::Ptr<cv::BackgroundSubtractor> > subtractors; //one per band
+
+    //rows [start, end) of the given band
+    cv::Range bandRows(int band, int rows)
+    {
+        return cv::Range( rows * band / bandCount, rows * (band+1) / bandCount );
+    };
+
+    //throw away the learned models -- on a mode change
+    void reset(const cv::Mat &frame)
+    {
+        modelSize = frameSize = frame.size();
+        frameCount = 0;
+        average.release();
+        subtractors.clear();
+
+        if( mode == RUNNING_AVERAGE )
+        {
+            frame.convertTo(average, CV_32F);
+            averageU8.create(frame.size(), CV_8UC1);
+        }
+        else if( mode == MOG2 || mode == KNN )
+        {
+            for(int i=0; i<bandCount; i++)
+            {
+                if( mode == MOG2 )
+                    subtractors.push_back( cv::createBackgroundSubtractorMOG2(500, 16, false) ); //no shadows in depth
+                else
+                    subtractors.push_back( cv::createBackgroundSubtractorKNN(500, 400, false) );
+            }
+        }
+
+        rescaleReference();
+    };
+
+    //the captured reference at the frame size
+    void rescaleReference()
+    {
+        if( referenceCapture.empty() ) reference.release();
+        else if( referenceCapture.size() == frameSize ) referenceCapture.copyTo(reference);
+        else cv::resize( referenceCapture, reference, frameSize, 0, 0, cv::INTER_AREA );
+    };
+
+    //the frames changed size -- keep what's been learned, at the new size
+    void resize(cv::Size size)
+    {
+        frameSize = size;
+        rescaleReference();
+        if( !average.empty() )
+        {
+            cv::Mat scaled;
+            cv::resize( average, scaled, size, 0, 0, cv::INTER_LINEAR );
+            average = scaled;
+            averageU8.create(size, CV_8UC1);
+        }
+        //MOG2/KNN stay at modelSize
+    };
+
+    //does the per band work. learn is whether the model updates this frame
+    void processBand(int band, const cv::Mat &frame, cv::Mat &foreground, bool learn)
+    {
+        cv::Range rows = bandRows(band, frame.rows);
+        cv::Mat in = frame.rowRange(rows);
+        cv::Mat out = foreground.rowRange(rows);
+
+        switch( mode )
+        {
+            case STATIC_REFERENCE:
+                cv::absdiff(in, reference.rowRange(rows), out);
+                cv::threshold(out, out, threshold, 255, cv::THRESH_BINARY);
+                break;
+
+            case RUNNING_AVERAGE:
+            {
+                cv::Mat avg = average.rowRange(rows);
+                cv::Mat avgU8 = averageU8.rowRange(rows);
+                if( learn ) cv::accumulateWeighted(in, avg, learningRate);
+                avg.convertTo(avgU8, CV_8U);
+                cv::absdiff(in, avgU8, out);
+                cv::threshold(out, out, threshold, 255, cv::THRESH_BINARY);
+                break;
+            }
+
+            case MOG2:
+            case KNN:
+                //out is a roi of the right size & type so the subtractor writes straight into the foreground mask
+                subtractors[band]->apply(in, out, learn ? learningRate : 0);
+                break;
+
+            default:
+                break;
+        }
+    };
+
+public:
+    BackgroundModel(Mode m=PREV_FRAME, int bands=BG_BAND_COUNT, int _updateEvery=BG_UPDATE_EVERY)
+    {
+        mode = m;
+        bandCount = std::max(1, bands);
+        updateEvery = std::max(1, _updateEvery);
+        frameCount = 0;
+        learningRate = BG_LEARNING_RATE;
+        threshold = BG_THRESHOLD;
+    };
+
+    inline Mode getMode(){ return mode; };
+    inline void setLearningRate(double rate){ learningRate = rate; };
+    inline void setUpdateInterval(int frames){ updateEvery = std::max(1, frames); };
+    inline void setThreshold(int t){ threshold = t; };
+
+    void setMode(Mode m)
+    {
+        mode = m;
+        modelSize = cv::Size(); //forces a reset on the next frame
+    };
+
+    //step through the modes, eg. from a key press
+    Mode nextMode()
+    {
+        setMode( Mode( (mode + 1) % MODE_COUNT ) );
+        return mode;
+    };
+
+    const char *getModeName()
+    {
+        static const char *names[MODE_COUNT] = { "previous frame", "static reference", "running average", "MOG2", "KNN" };
+        return names[mode];
+    };
+
+    //takes the given frame as the static background -- ie. the empty stage
+    void captureReference(const cv::Mat &frame)
+    {
+        frame.copyTo(referenceCapture);
+        frame.copyTo(reference);
+    };
+
+    //writes a binary foreground mask (0 or 255) of the frame.
+    //returns false if this mode doesn't apply (previous frame differencing is done by the app)
+    bool apply(const cv::Mat &frame, cv::Mat &foreground)
+    {
+        if( mode == PREV_FRAME || frame.empty() ) return false;
+
+        if( modelSize.area() == 0 ) reset(frame);
+        else if( frame.size() != frameSize ) resize( frame.size() );
+        if( mode == STATIC_REFERENCE && reference.empty() ) captureReference(frame); //no reference yet, so use the first frame
+
+        foreground.create(frame.size(), CV_8UC1);
+        bool learn = ( frameCount % updateEvery ) == 0;
+        frameCount++;
+
+        //the subtractors can't be resized, so they see the frame at the size they learned at
+        const cv::Mat *in = &frame;
+        cv::Mat *out = &foreground;
+        bool scaled = ( mode == MOG2 || mode == KNN ) && frame.size() != modelSize;
+        if( scaled )
+        {
+            cv::resize( frame, scaledIn, modelSize, 0, 0, cv::INTER_AREA );
+            scaledOut.create(modelSize, CV_8UC1);
+            in = &scaledIn;
+            out = &scaledOut;
+        }
+
+        //one band per task -- the subtractors' own parallel loops run serially when nested in here
+        cv::parallel_for_( cv::Range(0, bandCount), [&](const cv::Range &range) {
+            for(int b=range.start; b<range.end; b++)
+                processBand(b, *in, *out, learn);
+        } );
+
+        if( scaled ) cv::resize( scaledOut, foreground, frame.size(), 0, 0, cv::INTER_NEAREST ); //stays binary
+        return true;
+    };
+};
+
+#endif /* BackgroundModel_h */
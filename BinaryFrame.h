@@ -0,0 +1,170 @@
+//
+//  BinaryFrame.h
+//  Motus
+//
+//  A compact binary alternative to the osc, for consumers that want everything every frame -- eg. a visuals
+//  engine reading the whole motion grid. One datagram a frame, fixed layout, no addresses or type tags:
+//  every entity's state & the grid, w/ a sequence number so a reader can tell what it missed.
+//  Little endian, 4 byte aligned:
+//
+//  header -- BINARY_HEADER_SIZE bytes
+//     0  char[4]  "MOTS"
+//     4  u16      version, BINARY_VERSION
+//     6  u16      header size
+//     8  u32      sequence -- +1 every frame
+//    12  u32      frame size in bytes, header included
+//    16  f64      time, seconds on the engine's clock
+//    24  u16      entity count
+//    26  u16      entity size, BINARY_ENTITY_SIZE
+//    28  u16      grid width
+//    30  u16      grid height
+//    32  u16      peak cell, row major -- 0xFFFF if nothing moved
+//    34  u16      peak motion, a fraction of the cell * 65535
+//    36  u32      analyzed frame the grid is from -- it only changes when a new one was analyzed
+//  entities -- entity count * BINARY_ENTITY_SIZE bytes
+//     0  u16      id
+//     2  u16      which of the fields below are valid, BinaryEntityFields
+//     4  f32      time stamp of the newest sample
+//     8  f32[3]   raw -- resampled accel
+//    20  f32[3]   smoothed
+//    32  f32[3]   first derivative
+//    44  f32[3]   second derivative
+//    56  f32[4]   orientation, w x y z
+//  grid -- width * height u16s, row major, each cell's motion as a fraction * 65535
+//
+//  20 x 20 w/ 6 entities is 1272 bytes, so it fits one unfragmented datagram. Larger grids or more entities are
+//  fine on the local machine, where datagrams aren't fragmented.
+//
+
+#ifndef BinaryFrame_h
+#define BinaryFrame_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 40
+#define BINARY_ENTITY_SIZE 72
+#define BINARY_MAX_ENTITIES 16
+#define BINARY_MAX_GRID 32 //cells per side
+#define BINARY_FRAME_MAX ( BINARY_HEADER_SIZE + BINARY_MAX_ENTITIES * BINARY_ENTITY_SIZE + BINARY_MAX_GRID * BINARY_MAX_GRID * 2 )
+#define BINARY_NO_PEAK 0xFFFF
+
+namespace CRCPMotionAnalysis {
+
+enum BinaryEntityFields { BINARY_RAW=1, BINARY_SMOOTH=2, BINARY_DER1=4, BINARY_DER2=8, BINARY_ORIENTATION=16 };
+
+//one entity's state, as it goes in the frame
+struct BinaryEntity
+{
+    uint16_t id = 0;
+    uint16_t valid = 0;
+    float time = 0;
+    float raw[3] = {0, 0, 0};
+    float smooth[3] = {0, 0, 0};
+    float der1[3] = {0, 0, 0};
+    float der2[3] = {0, 0, 0};
+    float orientation[4] = {1, 0, 0, 0};
+};
+
+//builds frames in a fixed buffer -- begin(), the entities, the grid, finish()
+class BinaryFrameWriter
+{
+protected:
+    uint8_t buffer[BINARY_FRAME_MAX];
+    size_t size;
+    uint32_t sequence;
+    int entityCount;
+    int gridWidth, gridHeight;
+
+    inline void put16(size_t at, uint16_t v)
+    {
+        buffer[at] = v & 0xFF;
+        buffer[at+1] = (v >> 8) & 0xFF;
+    };
+
+    inline void put32(size_t at, uint32_t v)
+    {
+        for(int i=0; i<4; i++) buffer[at+i] = (v >> (8*i)) & 0xFF;
+    };
+
+    inline void putFloat(size_t at, float f)
+    {
+        uint32_t v;
+        std::memcpy(&v, &f, 4);
+        put32(at, v);
+    };
+
+    inline void putFloats(size_t at, const float *f, int count)
+    {
+        for(int i=0; i<count; i++) putFloat(at + 4*i, f[i]);
+    };
+
+public:
+    BinaryFrameWriter() : size(0), sequence(0), entityCount(0), gridWidth(0), gridHeight(0) {};
+
+    void begin(double time)
+    {
+        std::memset(buffer, 0, BINARY_HEADER_SIZE);
+        std::memcpy(buffer, "MOTS", 4);
+        put16(4, BINARY_VERSION);
+        put16(6, BINARY_HEADER_SIZE);
+        uint64_t t;
+        std::memcpy(&t, &time, 8);
+        put32(16, (uint32_t) t);
+        put32(20, (uint32_t) (t >> 32));
+        put16(26, BINARY_ENTITY_SIZE);
+        put16(32, BINARY_NO_PEAK);
+        size = BINARY_HEADER_SIZE;
+        entityCount = gridWidth = gridHeight = 0;
+    };
+
+    //before the grid. false if there's no room for it
+    bool addEntity(const BinaryEntity &e)
+    {
+        if( entityCount >= BINARY_MAX_ENTITIES || gridWidth > 0 ) return false;
+        put16(size, e.id);
+        put16(size + 2, e.valid);
+        putFloat(size + 4, e.time);
+        putFloats(size + 8, e.raw, 3);
+        putFloats(size + 20, e.smooth, 3);
+        putFloats(size + 32, e.der1, 3);
+        putFloats(size + 44, e.der2, 3);
+        putFloats(size + 56, e.orientation, 4);
+        size += BINARY_ENTITY_SIZE;
+        entityCount++;
+        return true;
+    };
+
+    //the grid's motion, row major, fractions * 65535. after the entities
+    void setGrid(int width, int height, const uint16_t *motion)
+    {
+        gridWidth = std::min(width, BINARY_MAX_GRID);
+        gridHeight = std::min(height, BINARY_MAX_GRID);
+        for(int y=0; y<gridHeight; y++)
+            for(int x=0; x<gridWidth; x++) put16( size + 2 * ( y * gridWidth + x ), motion[y * width + x] );
+        size += 2 * gridWidth * gridHeight;
+    };
+
+    //fills in the counts & the sequence number. the frame is data() & getSize() until the next begin()
+    void finish(uint16_t peakCell, uint16_t peakMotion, uint32_t gridFrame)
+    {
+        put32(8, sequence++);
+        put32(12, size);
+        put16(24, entityCount);
+        put16(28, gridWidth);
+        put16(30, gridHeight);
+        put16(32, peakCell);
+        put16(34, peakMotion);
+        put32(36, gridFrame);
+    };
+
+    inline const uint8_t *data(){ return buffer; };
+    inline size_t getSize(){ return size; };
+    inline uint32_t getSequence(){ return sequence; };
+};
+
+};
+
+#endif /* BinaryFrame_h */
@@ -0,0 +1,245 @@
+//
+//  FilterBank.h
+//  Motus
+//
+//  Low latency smoothing for the mocap chain: biquad (low/high/band pass, gravity removal) and one-euro filters.
+//  The state of every channel is a handful of floats, stored structure-of-arrays so one loop runs all channels
+//  side by side & the compiler can put them in simd lanes. O(1) per sample no matter how much smoothing.
+//  Assumes a fixed sample rate -- put a Resampler in front of it.
+//
+
+#ifndef FilterBank_h
+#define FilterBank_h
+
+#include <cmath>
+
+#define FILTER_LANES 8 //channels per bank, padded to a full avx register of floats
+#define GRAVITY_CUTOFF 0.3 //Hz -- anything slower than this is gravity / posture, not gesture
+
+namespace CRCPMotionAnalysis {
+
+//FILTER_LANES biquads run in lock step. transposed direct form II
+class BiquadBank
+{
+public:
+    enum Type { LOWPASS=0, HIGHPASS=1, BANDPASS=2 };
+
+protected:
+    alignas(32) float b0[FILTER_LANES], b1[FILTER_LANES], b2[FILTER_LANES], a1[FILTER_LANES], a2[FILTER_LANES];
+    alignas(32) float z1[FILTER_LANES], z2[FILTER_LANES];
+    bool primed;
+
+public:
+    BiquadBank()
+    {
+        for(int i=0; i<FILTER_LANES; i++)
+        {
+            b0[i] = 1; b1[i] = b2[i] = a1[i] = a2[i] = 0;
+            z1[i] = z2[i] = 0;
+        }
+        primed = false;
+    };
+
+    //RBJ audio eq cookbook coefficients, same for every lane
+    void design(Type type, double cutoff, double q, double rate)
+    {
+        double w0 = 2 * M_PI * std::min(cutoff, rate * 0.49) / rate;
+        double alpha = std::sin(w0) / (2 * q);
+        double c = std::cos(w0);
+        double nb0, nb1, nb2;
+
+        switch( type )
+        {
+            case HIGHPASS:
+                nb0 = (1 + c) / 2; nb1 = -(1 + c); nb2 = (1 + c) / 2;
+                break;
+            case BANDPASS:
+                nb0 = alpha; nb1 = 0; nb2 = -alpha;
+                break;
+            case LOWPASS:
+            default:
+                nb0 = (1 - c) / 2; nb1 = 1 - c; nb2 = (1 - c) / 2;
+                break;
+        }
+
+        double a0 = 1 + alpha;
+        for(int i=0; i<FILTER_LANES; i++)
+        {
+            b0[i] = nb0 / a0; b1[i] = nb1 / a0; b2[i] = nb2 / a0;
+            a1[i] = (-2 * c) / a0; a2[i] = (1 - alpha) / a0;
+        }
+        primed = false;
+    };
+
+    //set the state as if x had been the input forever, so there's no start up transient
+    void prime(const float *x)
+    {
+        for(int i=0; i<FILTER_LANES; i++)
+        {
+            float dcGain = ( b0[i] + b1[i] + b2[i] ) / ( 1 + a1[i] + a2[i] );
+            float y = x[i] * dcGain;
+            z1[i] = y - b0[i] * x[i];
+            z2[i] = b2[i] * x[i] - a2[i] * y;
+        }
+        primed = true;
+    };
+
+    //one sample for every lane
+    inline void process(const float *x, float *y)
+    {
+        if( !primed ) prime(x);
+        for(int i=0; i<FILTER_LANES; i++)
+        {
+            float out = b0[i] * x[i] + z1[i];
+            z1[i] = b1[i] * x[i] - a1[i] * out + z2[i];
+            z2[i] = b2[i] * x[i] - a2[i] * out;
+            y[i] = out;
+        }
+    };
+};
+
+//FILTER_LANES one-euro filters (Casiez et al.) -- the cutoff goes up w/ speed, so it smooths jitter when still & lags little when moving
+class OneEuroBank
+{
+protected:
+    alignas(32) float prevX[FILTER_LANES], dx[FILTER_LANES], y[FILTER_LANES];
+    float minCutoff, beta, dCutoff, rate;
+    bool primed;
+
+    inline float alpha(float cutoff)
+    {
+        float tau = 1.0f / ( 2.0f * float(M_PI) * cutoff );
+        return 1.0f / ( 1.0f + tau * rate );
+    };
+
+public:
+    OneEuroBank(float _minCutoff=1.0f, float _beta=0.007f, float _dCutoff=1.0f, float _rate=SR)
+    {
+        minCutoff = _minCutoff;
+        beta = _beta;
+        dCutoff = _dCutoff;
+        rate = _rate;
+        primed = false;
+    };
+
+    inline void process(const float *x, float *out)
+    {
+        if( !primed )
+        {
+            for(int i=0; i<FILTER_LANES; i++) { prevX[i] = y[i] = x[i]; dx[i] = 0; }
+            primed = true;
+        }
+
+        float aD = alpha(dCutoff);
+        float tauScale = rate / ( 2.0f * float(M_PI) );
+        for(int i=0; i<FILTER_LANES; i++)
+        {
+            float d = ( x[i] - prevX[i] ) * rate;
+            dx[i] += aD * ( d - dx[i] );
+            float cutoff = minCutoff + beta * std::fabs(dx[i]);
+            float a = cutoff / ( cutoff + tauScale ); //== alpha(cutoff), written so the loop has no calls
+            y[i] += a * ( x[i] - y[i] );
+            prevX[i] = x[i];
+            out[i] = y[i];
+        }
+    };
+};
+
+//the ugen -- filters accel xyz & gyro xyz of one stream as the lanes of one bank.
+//drop-in for AveragingFilter, w/ the same /mocap/points output by default
+class FilterBank : public StreamingSignalAnalysis
+{
+public:
+    enum Mode { LOWPASS=0, HIGHPASS=1, BANDPASS=2, GRAVITY_REMOVAL=3, ONE_EURO=4 };
+
+protected:
+    static const int CHANNEL_COUNT = 6;
+
+    Mode mode;
+    BiquadBank biquad;
+    OneEuroBank oneEuro;
+    OscAddress oscAddr;
+    double lastSentTime; //newest sample already sent over osc
+
+    alignas(32) float in[FILTER_LANES];
+    alignas(32) float out[FILTER_LANES];
+
+    int channelIndex(int c)
+    {
+        static const int indices[CHANNEL_COUNT] = { MocapDeviceData::DataIndices::ACCELX, MocapDeviceData::DataIndices::ACCELY, MocapDeviceData::DataIndices::ACCELZ,
+            MocapDeviceData::DataIndices::GYROX, MocapDeviceData::DataIndices::GYROY, MocapDeviceData::DataIndices::GYROZ };
+        return indices[c];
+    };
+
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        bool has[CHANNEL_COUNT];
+        for(int c=0; c<CHANNEL_COUNT; c++)
+        {
+            double v = sample->getData( channelIndex(c) );
+            has[c] = v != NO_DATA;
+            in[c] = has[c] ? v : 0; //missing channels run on zeros & aren't output
+        }
+
+        if( mode == ONE_EURO ) oneEuro.process(in, out);
+        else biquad.process(in, out);
+
+        MocapDeviceData *mdd = new MocapDeviceData();
+        mdd->setData(MocapDeviceData::DataIndices::INDEX, sample->getData(MocapDeviceData::DataIndices::INDEX));
+        mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, sample->getData(MocapDeviceData::DataIndices::TIME_STAMP));
+        for(int c=0; c<CHANNEL_COUNT; c++)
+        {
+            if( has[c] ) mdd->setData( channelIndex(c), out[c] );
+        }
+        emitSample(mdd);
+    };
+
+public:
+    //cutoff in Hz (the min cutoff for one-euro). rate has to match the Resampler's
+    FilterBank(SignalAnalysis *s1, Mode m=LOWPASS, double cutoff=5.0, double q=0.7071, double rate=SR, int bufsize=48, const char *address="/mocap/points")
+        : StreamingSignalAnalysis(s1, bufsize), oneEuro(cutoff, 0.007f, 1.0f, rate), oscAddr(address, "ff")
+    {
+        mode = m;
+        lastSentTime = -1;
+        for(int i=0; i<FILTER_LANES; i++) in[i] = out[i] = 0;
+
+        switch( mode )
+        {
+            case HIGHPASS: biquad.design(BiquadBank::HIGHPASS, cutoff, q, rate); break;
+            case BANDPASS: biquad.design(BiquadBank::BANDPASS, cutoff, q, rate); break;
+            case GRAVITY_REMOVAL: biquad.design(BiquadBank::HIGHPASS, GRAVITY_CUTOFF, 0.7071, rate); break;
+            case LOWPASS:
+            default: biquad.design(BiquadBank::LOWPASS, cutoff, q, rate); break;
+        }
+    };
+
+    //one-euro speed coefficient & derivative cutoff
+    void setOneEuroParams(float minCutoff, float beta, float dCutoff, float rate)
+    {
+        oneEuro = OneEuroBank(minCutoff, beta, dCutoff, rate);
+    };
+
+    static Mode modeFromName(const std::string &name)
+    {
+        if( name == "highpass" ) return HIGHPASS;
+        if( name == "bandpass" ) return BANDPASS;
+        if( name == "gravity" ) return GRAVITY_REMOVAL;
+        if( name == "oneeuro" ) return ONE_EURO;
+        return LOWPASS;
+    };
+
+    //only the samples that are new this frame -- a stateful filter's window would resend old ones
+    virtual void appendOSC(OscPacketWriter &packet)
+    {
+        for(int i=0; i<outdata1.size(); i++)
+        {
+            if( outdata1[i]->getData(MocapDeviceData::DataIndices::TIME_STAMP) <= lastSentTime ) continue;
+            packet.append( oscAddr, (float)outdata1[i]->getData(2), (float)outdata1[i]->getData(3) );
+        }
+        if( !outdata1.empty() ) lastSentTime = outdata1.back()->getData(MocapDeviceData::DataIndices::TIME_STAMP);
+    };
+};
+
+};
+
+#endif /* FilterBank_h */
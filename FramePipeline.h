@@ -0,0 +1,278 @@
+//
+//  FramePipeline.h
+//  Motus
+//
+//  Runs the vision stages of consecutive frames at the same time instead of one after another:
+//  capture (main thread) -> prepare (worker) -> analyze (worker) -> send osc & render (main thread).
+//  While frame N is analyzed, N+1 is being prepared and N-1 is on screen, so the frame rate is set by the slowest
+//  stage instead of the sum of them.
+//  Frames come from a fixed pool & move between the stages through bounded queues, so a slow stage backs up
+//  at most PIPELINE_FRAMES frames. What happens when it does is the policy:
+//    LOWEST_LATENCY -- a stage always takes the newest frame waiting for it & drops the older ones
+//    THROUGHPUT -- nothing is dropped once captured; capture skips frames while the pool is used up
+//  Every frame records when it finished each stage, for the end to end latency.
+//
+
+#ifndef FramePipeline_h
+#define FramePipeline_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cinder/Rect.h"
+
+#include "FramePool.h"
+#include "SquareGenerator.hpp" //MotionPeak
+
+#define PIPELINE_FRAMES 6 //one per stage & queue, w/ the latest policy's queues holding at most one each
+#define PIPELINE_LATENCY_SMOOTHING 0.1 //ewma weight of the newest frame in the latency averages
+
+//one sensor's part of a frame -- its copy of the capture & where it lands on the stage
+struct PipelineView
+{
+    ci::SurfaceRef surface; //copy of the capture -- sources reuse theirs for the next frame
+    ci::Rectf stage; //normalized
+    double time; //when the sensor delivered it, on the stats clock
+    VideoFrame gray; //sensor resolution gray
+
+    PipelineView() : stage(0, 0, 1, 1), time(0) {};
+};
+
+//one frame on its way through the stages. the stage functions own the fields for the stage they're in
+struct PipelineFrame
+{
+    enum Stage { CAPTURED=0, PREPARED=1, ANALYZED=2, SENT=3, RENDERED=4, STAGE_COUNT=5 };
+
+    long index;
+    std::vector<PipelineView> views; //a synchronized set, one per sensor
+    int analysisWidth, analysisHeight; //size to analyze at, decided at capture
+    int outputWidth, outputHeight; //coordinates the results are reported in, eg. the window's
+    int gridSize; //squares per side, decided at capture
+    VideoFrame analysis; //the views resized into their parts of the stage & blurred
+    cv::Mat resized; //scratch
+    std::vector<int> squareCounts; //results -- pixel sums of the squares
+    std::vector<int32_t> squareMotion; //...as fixed point fractions, the same for any analysis size
+    MotionPeak peak; //the square w/ the most motion
+    cv::Mat diff; //the difference image, only when the shared memory ring takes it
+    float maskedFraction;
+    double times[STAGE_COUNT]; //seconds on the pipeline's clock when each stage finished
+    double prepareSeconds, analyzeSeconds; //time spent working on it, w/o the queueing
+
+    PipelineFrame() : index(-1), analysisWidth(0), analysisHeight(0), outputWidth(0), outputHeight(0), gridSize(0), maskedFraction(0), prepareSeconds(0), analyzeSeconds(0)
+    {
+        for(int i=0; i<STAGE_COUNT; i++) times[i] = 0;
+    };
+};
+
+//fixed capacity fifo of frames between two stages
+class FrameQueue
+{
+protected:
+    std::vector<PipelineFrame *> ring;
+    int head, count;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable ready;
+
+public:
+    FrameQueue(int capacity=PIPELINE_FRAMES) : ring(capacity, NULL), head(0), count(0), closed(false) {};
+
+    //false if full. never blocks
+    bool push(PipelineFrame *frame)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if( count == ring.size() ) return false;
+            ring[ (head + count) % ring.size() ] = frame;
+            count++;
+        }
+        ready.notify_one();
+        return true;
+    };
+
+    //the oldest frame, or NULL if empty (wait == false) or closed (wait == true)
+    PipelineFrame *pop(bool wait)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if( wait ) ready.wait( lock, [this]{ return count > 0 || closed; } );
+        if( count == 0 ) return NULL;
+        PipelineFrame *frame = ring[head];
+        head = (head + 1) % ring.size();
+        count--;
+        return frame;
+    };
+
+    //wakes everyone waiting in pop() -- for shutting down
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    };
+};
+
+class FramePipeline
+{
+public:
+    enum Policy { LOWEST_LATENCY=0, THROUGHPUT=1 };
+    typedef std::function<void(PipelineFrame *)> Stage;
+
+protected:
+    std::vector<PipelineFrame> frames;
+    FrameQueue freeFrames, toPrepare, toAnalyze, analyzed;
+    std::thread prepareThread, analyzeThread;
+    Stage prepare, analyze;
+    std::atomic<bool> running;
+    std::atomic<int> policy;
+    std::atomic<long> dropped; //frames captured but never rendered, plus captures skipped for lack of a frame
+    long nextIndex;
+    std::chrono::steady_clock::time_point clockStart;
+
+    //smoothed stage & end to end latencies, seconds. main thread only
+    double stageLatency[PipelineFrame::STAGE_COUNT];
+    double endToEnd, lastEndToEnd;
+
+    //hands a frame to the next stage. w/ the latest policy anything older that is still waiting there is dropped
+    void forward(FrameQueue &queue, PipelineFrame *frame)
+    {
+        if( policy == LOWEST_LATENCY )
+        {
+            PipelineFrame *stale;
+            while( ( stale = queue.pop(false) ) != NULL ) recycle(stale);
+        }
+        if( !queue.push(frame) ) recycle(frame); //can't happen w/ the pool no bigger than a queue, but don't lose it
+    };
+
+    void recycle(PipelineFrame *frame)
+    {
+        dropped++;
+        freeFrames.push(frame);
+    };
+
+    void run(FrameQueue &in, FrameQueue &out, Stage &stage, PipelineFrame::Stage done)
+    {
+        PipelineFrame *frame;
+        while( running && ( frame = in.pop(true) ) != NULL )
+        {
+            stage(frame);
+            stamp(frame, done);
+            forward(out, frame);
+        }
+    };
+
+public:
+    FramePipeline(int count=PIPELINE_FRAMES) : frames(count), freeFrames(count), toPrepare(count), toAnalyze(count), analyzed(count)
+    {
+        for(int i=0; i<frames.size(); i++) freeFrames.push(&frames[i]);
+        running = false;
+        policy = LOWEST_LATENCY;
+        dropped = 0;
+        nextIndex = 0;
+        clockStart = std::chrono::steady_clock::now();
+        for(int i=0; i<PipelineFrame::STAGE_COUNT; i++) stageLatency[i] = 0;
+        endToEnd = lastEndToEnd = 0;
+    };
+
+    ~FramePipeline()
+    {
+        stop();
+    };
+
+    //starts the worker threads. the stages run on them, so they must only touch state no other thread does
+    void start(const Stage &prepareStage, const Stage &analyzeStage)
+    {
+        if( running ) return;
+        prepare = prepareStage;
+        analyze = analyzeStage;
+        running = true;
+        prepareThread = std::thread( [this]{ run(toPrepare, toAnalyze, prepare, PipelineFrame::PREPARED); } );
+        analyzeThread = std::thread( [this]{ run(toAnalyze, analyzed, analyze, PipelineFrame::ANALYZED); } );
+    };
+
+    void stop()
+    {
+        if( !running ) return;
+        running = false;
+        toPrepare.close();
+        toAnalyze.close();
+        if( prepareThread.joinable() ) prepareThread.join();
+        if( analyzeThread.joinable() ) analyzeThread.join();
+    };
+
+    inline double now()
+    {
+        return std::chrono::duration<double>( std::chrono::steady_clock::now() - clockStart ).count();
+    };
+
+    inline void stamp(PipelineFrame *frame, PipelineFrame::Stage stage)
+    {
+        frame->times[stage] = now();
+    };
+
+    //a free frame to capture into, or NULL if every frame is in flight -- then this capture is skipped
+    PipelineFrame *acquire()
+    {
+        PipelineFrame *frame = freeFrames.pop(false);
+        if( frame == NULL ) { dropped++; return NULL; }
+        frame->index = nextIndex++;
+        stamp(frame, PipelineFrame::CAPTURED);
+        return frame;
+    };
+
+    //the capture is done, on to the workers
+    void submit(PipelineFrame *frame)
+    {
+        forward(toPrepare, frame);
+    };
+
+    //the next analyzed frame for the main thread, or NULL. w/ the latest policy that's the newest one, the rest are dropped
+    PipelineFrame *takeResult()
+    {
+        PipelineFrame *frame = analyzed.pop(false);
+        if( frame == NULL || policy != LOWEST_LATENCY ) return frame;
+
+        PipelineFrame *newer;
+        while( ( newer = analyzed.pop(false) ) != NULL )
+        {
+            recycle(frame);
+            frame = newer;
+        }
+        return frame;
+    };
+
+    //done w/ a frame -- after it was rendered, or if it's being skipped. rendered frames count towards the latency
+    void release(PipelineFrame *frame, bool rendered=true)
+    {
+        if( rendered && frame->times[PipelineFrame::RENDERED] > 0 )
+        {
+            const double w = PIPELINE_LATENCY_SMOOTHING;
+            for(int s=PipelineFrame::PREPARED; s<PipelineFrame::STAGE_COUNT; s++)
+                stageLatency[s] += w * ( ( frame->times[s] - frame->times[s-1] ) - stageLatency[s] );
+            lastEndToEnd = frame->times[PipelineFrame::RENDERED] - frame->times[PipelineFrame::CAPTURED];
+            endToEnd += w * ( lastEndToEnd - endToEnd );
+        }
+        for(int i=0; i<PipelineFrame::STAGE_COUNT; i++) frame->times[i] = 0;
+        if( rendered ) freeFrames.push(frame);
+        else recycle(frame);
+    };
+
+    inline Policy getPolicy(){ return Policy( policy.load() ); };
+    inline void setPolicy(Policy p){ policy = p; };
+    inline const char *getPolicyName(){ return policy == LOWEST_LATENCY ? "lowest latency" : "throughput"; };
+
+    //smoothed seconds from capture to on screen, & for the last frame
+    inline double getLatency(){ return endToEnd; };
+    inline double getLastLatency(){ return lastEndToEnd; };
+    //smoothed seconds spent in a stage -- from the end of the stage before it to the end of this one, so queueing included
+    inline double getStageLatency(PipelineFrame::Stage s){ return stageLatency[s]; };
+    inline long getDropped(){ return dropped; };
+};
+
+#endif /* FramePipeline_h */
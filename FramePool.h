@@ -0,0 +1,108 @@
+//
+//  FramePool.h
+//  Motus
+//
+//  Pooled grayscale frame buffers for the computer vision pipeline.
+//  A VideoFrame owns its pixels and hands out a cv::Mat and a ci::Channel8u over the same memory,
+//  so the color -> gray conversion happens once into a reused buffer and nothing is copied after that.
+//
+
+#ifndef FramePool_h
+#define FramePool_h
+
+#include <memory>
+#include <vector>
+
+#include "cinder/Surface.h"
+#include "cinder/Channel.h"
+
+#include "CinderOpenCV.h"
+
+#define FRAME_ROW_ALIGN 16 //row stride alignment in bytes -- keeps the opencv row loops vectorizable
+
+//one grayscale frame. the cv::Mat and the ci::Channel8u are both views of mPixels
+class VideoFrame
+{
+protected:
+    std::unique_ptr<uint8_t[]> mPixels;
+    int mWidth, mHeight;
+    size_t mRowBytes;
+
+    cv::Mat mMat;
+    ci::Channel8u mChannel;
+
+    //zero-copy views of the color surface this frame was converted from
+    ci::SurfaceRef mSource;
+    cv::Mat mSourceMat;
+
+public:
+    VideoFrame() : mWidth(0), mHeight(0), mRowBytes(0) {};
+
+    //(re)allocates only when the size changes -- steady state this is a no-op
+    void allocate(int width, int height)
+    {
+        if( mPixels && width == mWidth && height == mHeight ) return;
+
+        mWidth = width;
+        mHeight = height;
+        mRowBytes = ( width + FRAME_ROW_ALIGN - 1 ) & ~( FRAME_ROW_ALIGN - 1 );
+        mPixels.reset( new uint8_t[mRowBytes * height] );
+
+        mMat = cv::Mat( height, width, CV_8UC1, mPixels.get(), mRowBytes );
+        mChannel = ci::Channel8u( width, height, mRowBytes, 1, mPixels.get() );
+    };
+
+    //converts an rgb(a) surface to gray straight into our buffer. the surface itself is only wrapped, never copied.
+    void fromSurface( const ci::SurfaceRef &surface )
+    {
+        mSource = surface;
+        mSourceMat = ci::toOcvRef( *surface );
+        allocate( surface->getWidth(), surface->getHeight() );
+
+        //opencv won't reallocate mMat since the size & type already match, so this writes into mPixels
+        cv::cvtColor( mSourceMat, mMat, grayConversionCode( *surface ) );
+    };
+
+    //which cvtColor code matches the surface's channel order
+    static int grayConversionCode( const ci::Surface8u &surface )
+    {
+        bool bgr = surface.getChannelOrder().getRed() > surface.getChannelOrder().getBlue();
+        if( surface.hasAlpha() )
+            return bgr ? cv::COLOR_BGRA2GRAY : cv::COLOR_RGBA2GRAY;
+        else
+            return bgr ? cv::COLOR_BGR2GRAY : cv::COLOR_RGB2GRAY;
+    };
+
+    inline cv::Mat &getMat(){ return mMat; };
+    inline ci::Channel8u &getChannel(){ return mChannel; };
+    inline ci::SurfaceRef getSurface(){ return mSource; };
+    inline cv::Mat &getSourceMat(){ return mSourceMat; };
+
+    inline int getWidth(){ return mWidth; };
+    inline int getHeight(){ return mHeight; };
+    inline bool empty(){ return !mPixels; };
+};
+
+//a small ring of frames. acquire() hands back the oldest frame, so with a pool of 2 the previous
+//frame stays valid while the next one is written.
+class FramePool
+{
+protected:
+    std::vector<VideoFrame> frames;
+    int next;
+
+public:
+    FramePool(int count=2) : frames(count), next(0) {};
+
+    VideoFrame *acquire(int width, int height)
+    {
+        VideoFrame *frame = &frames[next];
+        next = ( next + 1 ) % frames.size();
+        frame->allocate(width, height);
+        return frame;
+    };
+
+    int size(){ return frames.size(); };
+};
+
+#endif /* FramePool_h */
@@ -0,0 +1,314 @@
+//
+//  FrameSource.h
+//  Motus
+//
+//  Where frames come from, when there's more than one sensor on the stage. Each source is one camera's view &
+//  where that view lands on the stage, normalized -- two astras side by side are [0, 0, 0.5, 1] & [0.5, 0, 1, 1].
+//  Sources fill a short history of timestamped frames from their own thread (or the astra's callback), & FrameSync
+//  picks one frame per source whose timestamps line up into a set. The set is analyzed as one stage image, so the
+//  motion grid comes out in stage coordinates however many sensors there are.
+//  Besides the astra (Astra.h) there are sources for working w/o the hardware:
+//    synthetic -- a disc sweeping across the view, so motion crosses from one source into the next
+//    recorded -- a folder of images, played back in name order & looped
+//  Read from assets/sources.json:
+//  {
+//    "sources": [ { "type": "astra", "uri": "device/sensor0", "stage": [0, 0, 0.5, 1] },
+//                 { "type": "synthetic", "fps": 30, "size": [640, 480], "stage": [0.5, 0, 1, 1] },
+//                 { "type": "recorded", "path": "/shows/take3", "fps": 30, "stage": [0, 0, 1, 1] } ],
+//    "tolerance": 0.02                                                    <-- seconds frames of a set can be apart
+//  }
+//  No file means one astra over the whole stage, as before.
+//
+
+#ifndef FrameSource_h
+#define FrameSource_h
+
+#include "cinder/Filesystem.h"
+#include "cinder/ImageIo.h"
+#include "cinder/Log.h"
+#include "cinder/Rect.h"
+#include "cinder/Surface.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CinderOpenCV.h"
+#include "Stats.h"
+
+#define SOURCE_HISTORY 4 //frames each source keeps for the sync to choose from
+#define SYNC_TOLERANCE 0.02 //seconds the frames of a set can be apart -- a bit over half a 30fps frame
+#define SYNC_WAIT 0.05 //seconds a set waits for a late source, before going w/ that source's last frame
+
+//one sensor's frames, w/ when each arrived on the stats clock
+class FrameSource
+{
+protected:
+    struct Slot
+    {
+        ci::SurfaceRef surface;
+        double time = 0;
+    };
+
+    std::string name;
+    ci::Rectf stage; //where the view lands, normalized to the stage
+    std::mutex mutex;
+    Slot history[SOURCE_HISTORY];
+    long count; //frames pushed -- frame n is in history[n % SOURCE_HISTORY]
+    double lastPush;
+    CRCPMotionAnalysis::LatencyHistogram *intervalTimer;
+
+public:
+    FrameSource(const std::string &_name, const ci::Rectf &_stage) : name(_name), stage(_stage), count(0), lastPush(-1)
+    {
+        intervalTimer = CRCPMotionAnalysis::StatsRegistry::get( "source/" + name + "/interval", false );
+    };
+    virtual ~FrameSource(){};
+
+    virtual bool start(){ return true; };
+    virtual void stop(){};
+    //main thread, after the astra update -- for sources whose frames arrive in a callback there
+    virtual void poll(){};
+
+    //a new frame, from whichever thread the sensor delivers on. copied, so the caller can reuse its surface
+    void push(const ci::Surface8u &surface, double time)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot &slot = history[count % SOURCE_HISTORY];
+        if( !slot.surface || slot.surface->getSize() != surface.getSize() )
+            slot.surface = ci::Surface::create( surface.getWidth(), surface.getHeight(), surface.hasAlpha(), surface.getChannelOrder() );
+        slot.surface->copyFrom( surface, surface.getBounds() );
+        slot.time = time;
+        count++;
+
+        if( lastPush >= 0 ) CRCPMotionAnalysis::StatsRegistry::record( intervalTimer, time - lastPush );
+        lastPush = time;
+    };
+
+    //number & time of the newest frame. false if there hasn't been one
+    bool newest(long &seq, double &time)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if( count == 0 ) return false;
+        seq = count - 1;
+        time = history[seq % SOURCE_HISTORY].time;
+        return true;
+    };
+
+    //when frame seq arrived -- or the oldest frame kept, if it's already been overwritten
+    double timeOf(long seq)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        seq = std::max( seq, std::max(0L, count - SOURCE_HISTORY) );
+        return history[seq % SOURCE_HISTORY].time;
+    };
+
+    //copies the frame in the history closest to time into dest -- reallocated only if the size changed. false if there's none
+    bool copyClosest(double time, ci::SurfaceRef &dest, long &seq, double &frameTime)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if( count == 0 ) return false;
+        long best = count - 1;
+        for(long n = std::max(0L, count - SOURCE_HISTORY); n < count; n++)
+        {
+            if( std::fabs( history[n % SOURCE_HISTORY].time - time ) < std::fabs( history[best % SOURCE_HISTORY].time - time ) ) best = n;
+        }
+        Slot &slot = history[best % SOURCE_HISTORY];
+        if( !dest || dest->getSize() != slot.surface->getSize() )
+            dest = ci::Surface::create( slot.surface->getWidth(), slot.surface->getHeight(), true );
+        dest->copyFrom( *slot.surface, slot.surface->getBounds() );
+        seq = best;
+        frameTime = slot.time;
+        return true;
+    };
+
+    inline const std::string &getName(){ return name; };
+    inline const ci::Rectf &getStage(){ return stage; };
+};
+
+//a source w/ its own capture thread, producing frames at a fixed rate
+class ThreadedFrameSource : public FrameSource
+{
+protected:
+    double fps;
+    std::atomic<bool> running{false};
+    std::thread thread;
+    ci::Surface8u scratch;
+
+    //makes the next frame in out. false to skip this tick
+    virtual bool produce(ci::Surface8u &out) = 0;
+
+    void run()
+    {
+        std::chrono::duration<double> period( 1.0 / fps );
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        while( running )
+        {
+            if( produce(scratch) ) push( scratch, CRCPMotionAnalysis::StatsRegistry::now() );
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if( next < now ) next = now; //fell behind -- don't try to catch up w/ a burst
+            std::this_thread::sleep_until(next);
+        }
+    };
+
+public:
+    ThreadedFrameSource(const std::string &_name, const ci::Rectf &_stage, double _fps) : FrameSource(_name, _stage), fps( std::max(1.0, _fps) ) {};
+    virtual ~ThreadedFrameSource(){ stop(); }; //derived classes stop too, before what produce() uses goes away
+
+    virtual bool start()
+    {
+        if( running ) return true;
+        running = true;
+        thread = std::thread( &ThreadedFrameSource::run, this );
+        return true;
+    };
+
+    virtual void stop()
+    {
+        running = false;
+        if( thread.joinable() ) thread.join();
+    };
+};
+
+//a bright disc sweeping across a dark view -- phase lets several sources hand it from one to the next
+class SyntheticSource : public ThreadedFrameSource
+{
+protected:
+    int width, height;
+    double phase; //0-1 of a sweep
+    long frames = 0;
+
+    bool produce(ci::Surface8u &out)
+    {
+        if( out.getWidth() != width || out.getHeight() != height ) out = ci::Surface8u( width, height, true );
+        cv::Mat mat = ci::toOcvRef(out);
+        mat.setTo( cv::Scalar(30, 30, 30, 255) );
+
+        double t = std::fmod( phase + frames++ / ( fps * 4 ), 1.0 ); //a sweep every 4s
+        double x = t < 0.5 ? t * 2 : 2 - t * 2; //back & forth
+        cv::circle( mat, cv::Point( (int) ( x * width ), (int) ( height * ( 0.5 + 0.25 * std::sin( t * 2 * M_PI ) ) ) ),
+                    std::max(4, height / 8), cv::Scalar(255, 255, 255, 255), -1 );
+        return true;
+    };
+
+public:
+    SyntheticSource(const std::string &_name, const ci::Rectf &_stage, double _fps, int w, int h, double _phase = 0) :
+        ThreadedFrameSource(_name, _stage, _fps), width( std::max(16, w) ), height( std::max(16, h) ), phase(_phase) {};
+    ~SyntheticSource(){ stop(); };
+};
+
+//images in a folder, in name order, looped -- decoded on the capture thread
+class RecordedSource : public ThreadedFrameSource
+{
+protected:
+    std::vector<ci::fs::path> files;
+    size_t next = 0;
+
+    bool produce(ci::Surface8u &out)
+    {
+        if( files.empty() ) return false;
+        const ci::fs::path &file = files[next];
+        next = ( next + 1 ) % files.size();
+        try
+        {
+            out = ci::Surface8u( ci::loadImage(file) );
+            return true;
+        }
+        catch( ci::Exception &e )
+        {
+            CI_LOG_W( "Could not load " << file << ": " << e.what() );
+            return false;
+        }
+    };
+
+public:
+    RecordedSource(const std::string &_name, const ci::Rectf &_stage, double _fps, const ci::fs::path &folder) : ThreadedFrameSource(_name, _stage, _fps)
+    {
+        if( ci::fs::is_directory(folder) )
+        {
+            for( ci::fs::directory_iterator it(folder), end; it != end; ++it )
+            {
+                std::string ext = it->path().extension().string();
+                std::transform( ext.begin(), ext.end(), ext.begin(), ::tolower );
+                if( ext == ".png" || ext == ".jpg" || ext == ".jpeg" ) files.push_back( it->path() );
+            }
+            std::sort( files.begin(), files.end() );
+        }
+        if( files.empty() ) CI_LOG_W( "No images for recorded source " << name << " in " << folder );
+    };
+    ~RecordedSource(){ stop(); };
+};
+
+//groups the sources' frames into sets that were captured at about the same time
+class FrameSync
+{
+protected:
+    std::vector<FrameSource *> sources;
+    std::vector<long> taken; //each source's newest frame already in a set
+    double tolerance;
+    CRCPMotionAnalysis::LatencyHistogram *skewTimer;
+    long sets, unsynced;
+
+public:
+    FrameSync() : tolerance(SYNC_TOLERANCE), sets(0), unsynced(0)
+    {
+        skewTimer = CRCPMotionAnalysis::StatsRegistry::get( "sync/skew", false );
+    };
+
+    void setSources(const std::vector<FrameSource *> &s)
+    {
+        sources = s;
+        taken.assign( sources.size(), -1 );
+    };
+    inline void setTolerance(double t){ tolerance = t; };
+
+    //true once every source has a frame newer than its last set's -- or the first new one has waited SYNC_WAIT for
+    //the rest, so a slow or dead sensor can't stall the stage. reference is the newest frame's time, the one to line up w/
+    bool ready(double now, double &reference)
+    {
+        bool any = false, all = true;
+        double oldest = now;
+        reference = -1;
+        for(int i=0; i<sources.size(); i++)
+        {
+            long seq;
+            double time;
+            if( !sources[i]->newest(seq, time) || seq <= taken[i] ) { all = false; continue; }
+            any = true;
+            oldest = std::min( oldest, sources[i]->timeOf( taken[i] + 1 ) ); //the first frame it's had since its last set
+            reference = std::max(reference, time);
+        }
+        return any && ( all || now - oldest >= SYNC_WAIT );
+    };
+
+    //source i's frame seq went into the set, skew seconds from the reference
+    void took(int i, long seq, double skew)
+    {
+        taken[i] = std::max( taken[i], seq );
+        CRCPMotionAnalysis::StatsRegistry::record( skewTimer, std::fabs(skew) );
+        if( std::fabs(skew) > tolerance ) unsynced++;
+    };
+
+    //the set was dropped, eg. the pipeline was full -- wait for newer frames
+    void skip()
+    {
+        for(int i=0; i<sources.size(); i++)
+        {
+            long seq;
+            double time;
+            if( sources[i]->newest(seq, time) ) taken[i] = seq;
+        }
+    };
+
+    inline void finishedSet(){ sets++; };
+    inline long getSetCount(){ return sets; };
+    inline long getUnsyncedCount(){ return unsynced; }; //frames more than the tolerance from their set
+};
+
+#endif /* FrameSource_h */
@@ -0,0 +1,299 @@
+//
+//  GestureFeatures.h
+//  Motus
+//
+//  Gesture features computed incrementally -- every ugen here does O(1) work per new sample, keeping running sums
+//  over ring buffers instead of re-scanning a window. Scalar features are written to the ACCELX slot so they can
+//  be chained (eg. AccelMagnitude -> Jerk -> OnsetDetector).
+//  Instead of a message per sample they send small event messages: a windowed value every hop samples, or an
+//  onset / peak when one happens. All events are (sensor id, value[, ...]).
+//  Like FilterBank these expect a fixed rate stream, ie. a Resampler upstream.
+//
+
+#ifndef GestureFeatures_h
+#define GestureFeatures_h
+
+#include <cmath>
+
+#define FEATURE_MAX_EVENTS 64 //events a feature can queue in one frame
+#define FEATURE_MAX_WINDOW 1024 //longest window, in samples
+
+namespace CRCPMotionAnalysis {
+
+//base for the features. queues this frame's events in a fixed array & sends them in appendOSC()
+class FeatureSignalAnalysis : public StreamingSignalAnalysis
+{
+protected:
+    struct Event
+    {
+        const OscAddress *addr;
+        float args[3];
+        int argCount;
+    };
+
+    Event events[FEATURE_MAX_EVENTS];
+    int eventCount;
+    int sensorID;
+    double rate;
+
+    void queueEvent(const OscAddress &addr, float a, float b)
+    {
+        if( eventCount >= FEATURE_MAX_EVENTS ) return;
+        Event &e = events[eventCount++];
+        e.addr = &addr;
+        e.args[0] = sensorID; e.args[1] = a; e.args[2] = b;
+        e.argCount = addr.getArgCount();
+    };
+
+    //copies index & time from the input sample & sets the feature value
+    void emitValue(MocapDeviceData *sample, double value)
+    {
+        MocapDeviceData *mdd = new MocapDeviceData();
+        mdd->setData(MocapDeviceData::DataIndices::INDEX, sample->getData(MocapDeviceData::DataIndices::INDEX));
+        mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, sample->getData(MocapDeviceData::DataIndices::TIME_STAMP));
+        mdd->setData(MocapDeviceData::DataIndices::ACCELX, value);
+        emitSample(mdd);
+    };
+
+    //magnitude of the xyz of a sample -- for the scalar features the other axes are NO_DATA & this is just |x|
+    static double magnitude(MocapDeviceData *sample)
+    {
+        double sum = 0;
+        for(int i=MocapDeviceData::DataIndices::ACCELX; i<=MocapDeviceData::DataIndices::ACCELZ; i++)
+        {
+            double v = sample->getData(i);
+            if( v != NO_DATA ) sum += v*v;
+        }
+        return std::sqrt(sum);
+    };
+
+public:
+    FeatureSignalAnalysis(SignalAnalysis *s1, int id, double _rate=SR, int bufsize=48) : StreamingSignalAnalysis(s1, bufsize)
+    {
+        sensorID = id;
+        rate = _rate;
+        eventCount = 0;
+    };
+
+    virtual void update(float seconds = 0)
+    {
+        eventCount = 0; //events are per frame
+        StreamingSignalAnalysis::update(seconds);
+    };
+
+    virtual void appendOSC(OscPacketWriter &packet)
+    {
+        for(int i=0; i<eventCount; i++)
+            packet.append( *events[i].addr, events[i].args, events[i].argCount );
+    };
+
+    inline int getEventCount(){ return eventCount; };
+};
+
+//|accel| per sample. a stream for other features, sends nothing itself
+class AccelMagnitude : public FeatureSignalAnalysis
+{
+protected:
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        emitValue(sample, magnitude(sample));
+    };
+
+public:
+    AccelMagnitude(SignalAnalysis *s1, int id, double rate=SR, int bufsize=48) : FeatureSignalAnalysis(s1, id, rate, bufsize){};
+};
+
+//mean of |x|^2 over the last window samples -- a running sum w/ a ring buffer of the squares
+class WindowedEnergy : public FeatureSignalAnalysis
+{
+protected:
+    double squares[FEATURE_MAX_WINDOW];
+    int window, hop;
+    int pos, filled, sinceEvent;
+    double sum;
+
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        double m = magnitude(sample);
+        double sq = m*m;
+
+        if( filled == window ) sum -= squares[pos];
+        else filled++;
+        squares[pos] = sq;
+        sum += sq;
+        pos = (pos + 1) % window;
+
+        if( sum < 0 ) sum = 0; //rounding drift
+        double energy = sum / filled;
+        emitValue(sample, energy);
+
+        static const OscAddress addr("/mocap/energy", "ff");
+        if( ++sinceEvent >= hop && filled == window )
+        {
+            queueEvent(addr, energy, 0);
+            sinceEvent = 0;
+        }
+    };
+
+public:
+    WindowedEnergy(SignalAnalysis *s1, int id, int _window=25, int _hop=0, double rate=SR, int bufsize=48) : FeatureSignalAnalysis(s1, id, rate, bufsize)
+    {
+        window = std::max(1, std::min(_window, FEATURE_MAX_WINDOW));
+        hop = _hop > 0 ? _hop : std::max(1, window/2);
+        pos = filled = sinceEvent = 0;
+        sum = 0;
+    };
+};
+
+//rate of change of acceleration, |a[n] - a[n-1]| * rate. a stream, sends nothing itself
+class Jerk : public FeatureSignalAnalysis
+{
+protected:
+    double prev[3];
+    bool hasPrev;
+
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        double cur[3], sum = 0;
+        for(int i=0; i<3; i++)
+        {
+            double v = sample->getData(MocapDeviceData::DataIndices::ACCELX + i);
+            cur[i] = v == NO_DATA ? 0 : v;
+            if( hasPrev ) sum += (cur[i] - prev[i]) * (cur[i] - prev[i]);
+            prev[i] = cur[i];
+        }
+        if( !hasPrev ) { hasPrev = true; return; }
+        emitValue(sample, std::sqrt(sum) * rate);
+    };
+
+public:
+    Jerk(SignalAnalysis *s1, int id, double rate=SR, int bufsize=48) : FeatureSignalAnalysis(s1, id, rate, bufsize)
+    {
+        hasPrev = false;
+    };
+};
+
+//crossings per second of the signal around its running mean, over the last window samples.
+//which axis is a parameter -- ACCELX by default, which is also where the scalar features put their value
+class ZeroCrossingRate : public FeatureSignalAnalysis
+{
+protected:
+    unsigned char crossed[FEATURE_MAX_WINDOW];
+    int window, hop, axis;
+    int pos, filled, count, sinceEvent;
+    double mean; //slow ewma, so gravity / offsets don't count
+    int lastSign;
+
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        double v = sample->getData(axis);
+        if( v == NO_DATA ) return;
+
+        if( filled == 0 && lastSign == 0 ) mean = v;
+        mean += 0.02 * (v - mean);
+        int sign = v > mean ? 1 : -1;
+        unsigned char c = ( lastSign != 0 && sign != lastSign ) ? 1 : 0;
+        lastSign = sign;
+
+        if( filled == window ) count -= crossed[pos];
+        else filled++;
+        crossed[pos] = c;
+        count += c;
+        pos = (pos + 1) % window;
+
+        double zcr = count * rate / filled;
+        emitValue(sample, zcr);
+
+        static const OscAddress addr("/mocap/zcr", "ff");
+        if( ++sinceEvent >= hop && filled == window )
+        {
+            queueEvent(addr, zcr, 0);
+            sinceEvent = 0;
+        }
+    };
+
+public:
+    ZeroCrossingRate(SignalAnalysis *s1, int id, int _window=50, int _hop=0, int _axis=MocapDeviceData::DataIndices::ACCELX, double rate=SR, int bufsize=48)
+        : FeatureSignalAnalysis(s1, id, rate, bufsize)
+    {
+        window = std::max(1, std::min(_window, FEATURE_MAX_WINDOW));
+        hop = _hop > 0 ? _hop : std::max(1, window/2);
+        axis = _axis;
+        pos = filled = count = sinceEvent = 0;
+        mean = 0;
+        lastSign = 0;
+    };
+};
+
+//onsets & peaks of a scalar feature (usually |accel| or jerk). the threshold follows the signal --
+//running mean + sensitivity * running deviation -- & after an onset nothing fires for the refractory period.
+//sends /mocap/onset (id, strength, time) when it goes over & /mocap/peak (id, peak value, time) when it comes back down.
+class OnsetDetector : public FeatureSignalAnalysis
+{
+protected:
+    double sensitivity; //how many deviations over the mean
+    double refractory; //seconds
+    double adapt; //ewma rate for mean & deviation
+    double mean, var;
+    double lastOnset;
+    double peak, peakTime;
+    bool inOnset;
+    int seen;
+
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        double v = magnitude(sample);
+        double t = sample->getData(MocapDeviceData::DataIndices::TIME_STAMP);
+        double threshold = mean + sensitivity * std::sqrt(var);
+
+        static const OscAddress onsetAddr("/mocap/onset", "fff");
+        static const OscAddress peakAddr("/mocap/peak", "fff");
+
+        if( inOnset )
+        {
+            if( v > peak ) { peak = v; peakTime = t; }
+            if( v < threshold ) //back down, the peak is done
+            {
+                queueEvent(peakAddr, peak, peakTime);
+                inOnset = false;
+            }
+        }
+        else if( seen > 1.0/adapt && v > threshold && t - lastOnset >= refractory )
+        {
+            queueEvent(onsetAddr, (v - mean) / std::max(1e-6, std::sqrt(var)), t);
+            lastOnset = t;
+            inOnset = true;
+            peak = v;
+            peakTime = t;
+        }
+
+        //only learn from the background -- otherwise a big gesture raises its own threshold
+        if( !inOnset )
+        {
+            double d = v - mean;
+            mean += adapt * d;
+            var = (1 - adapt) * (var + adapt * d * d);
+        }
+        seen++;
+
+        emitValue(sample, inOnset ? 1 : 0);
+    };
+
+public:
+    OnsetDetector(SignalAnalysis *s1, int id, double _sensitivity=3.0, double _refractory=0.15, double _adapt=0.02, double rate=SR, int bufsize=48)
+        : FeatureSignalAnalysis(s1, id, rate, bufsize)
+    {
+        sensitivity = _sensitivity;
+        refractory = _refractory;
+        adapt = _adapt;
+        mean = var = 0;
+        lastOnset = -1e9;
+        peak = peakTime = 0;
+        inOnset = false;
+        seen = 0;
+    };
+};
+
+};
+
+#endif /* GestureFeatures_h */
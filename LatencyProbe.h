@@ -0,0 +1,323 @@
+//
+//  LatencyProbe.h
+//  Motus
+//
+//  Measures sensor to sound latency on localhost. While it runs:
+//    - an injector thread sends synthetic accel samples to our own receiver (LOCALPORT2), each tagged w/ a sequence number
+//    - the sample carries the number in MocapDeviceData's PROBE_SEQ slot through the sensor
+//    - a ugen has a probe sample once its newest output is stamped at or after the sample's arrival. the ugens copy
+//      the time stamps through, so this works for every node w/o them knowing about the probe
+//    - every node it reaches adds a tiny /motus/probe message (seq, path) to the frame's packet
+//    - an echo thread bound to DESTPORT -- where the synth listens -- timestamps those as they arrive
+//  Each hop is timed from when the sample was injected, into a stats timer per path:
+//    probe/ingest, probe/sensor, probe/<node>, probe/<node>/out
+//  so they show up in /motus/stats & the csv dump. The echo takes the synth's port, so run the probe w/o it.
+//
+
+#ifndef LatencyProbe_h
+#define LatencyProbe_h
+
+#include "asio/asio.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PROBE_SENSOR_ID "9" //the probe shows up as this sensor -- past the wiimotes & the phone
+#define PROBE_ADDR "/motus/probe/accel" //injected: x y z accel & the sequence number
+#define PROBE_ECHO_ADDR "/motus/probe" //sent out: sequence number & path index
+#define PROBE_RATE 50.0 //samples a second, about a wiimote's
+#define PROBE_HISTORY 1024 //sent samples remembered, ie. the longest trackable latency is PROBE_HISTORY / PROBE_RATE
+#define PROBE_TIMEOUT 2.0 //seconds before a sample that never reached a node is given up on
+
+namespace CRCPMotionAnalysis {
+
+class LatencyProbe
+{
+protected:
+    //when each sequence number was sent, on the stats clock. written by the injector, read by everyone else
+    std::mutex sentMutex;
+    double sentTimes[PROBE_HISTORY];
+    int32_t sentSeqs[PROBE_HISTORY];
+
+    //probe samples the sensor has, waiting to reach the nodes. main thread only
+    struct Pending
+    {
+        int32_t seq;
+        double stamp; //the sample's TIME_STAMP, ie. when it arrived
+        double sent;
+        std::vector<bool> reached; //by path index
+    };
+    std::deque<Pending> pending;
+
+    //path names by index, so the echo can name what it gets back. the main thread adds, the echo thread reads
+    std::mutex pathMutex;
+    std::vector<std::string> pathNames;
+    std::vector<LatencyHistogram *> pathTimers, outTimers;
+
+    LatencyHistogram *ingestTimer, *sensorTimer;
+    OscAddress echoAddr;
+
+    std::atomic<bool> running;
+    std::thread injectThread, echoThread;
+    asio::io_service io;
+    std::unique_ptr<asio::ip::udp::socket> injectSocket, echoSocket;
+    unsigned short receivePort, echoPort;
+
+    void remember(int32_t seq, double t)
+    {
+        std::lock_guard<std::mutex> lock(sentMutex);
+        sentSeqs[seq % PROBE_HISTORY] = seq;
+        sentTimes[seq % PROBE_HISTORY] = t;
+    };
+
+    bool sentTime(int32_t seq, double &t)
+    {
+        std::lock_guard<std::mutex> lock(sentMutex);
+        if( seq < 0 || sentSeqs[seq % PROBE_HISTORY] != seq ) return false; //too old, overwritten
+        t = sentTimes[seq % PROBE_HISTORY];
+        return true;
+    };
+
+    int pathIndex(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(pathMutex);
+        for(int i=0; i<pathNames.size(); i++)
+            if( pathNames[i] == name ) return i;
+        pathNames.push_back(name);
+        pathTimers.push_back( StatsRegistry::get( "probe/" + name, false ) );
+        outTimers.push_back( StatsRegistry::get( "probe/" + name + "/out", false ) );
+        return pathNames.size() - 1;
+    };
+
+    //sends a slow wobble -- the ugens need a changing signal, eg. for the derivative to be nonzero
+    void inject(asio::ip::udp::endpoint to)
+    {
+        OscAddress addr( PROBE_ADDR, "fffi" );
+        OscPacketWriter packet;
+        packet.setSink( [&]( const uint8_t *data, size_t size ){
+            asio::error_code error;
+            injectSocket->send_to( asio::buffer(data, size), to, 0, error );
+        } );
+
+        int32_t seq = 0;
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        while( running )
+        {
+            double phase = seq / PROBE_RATE;
+            if( packet.begin(addr) )
+            {
+                packet.writeFloat( 0.5f + 0.4f * std::sin( phase * 2.0 ) );
+                packet.writeFloat( 0.5f + 0.4f * std::cos( phase * 3.0 ) );
+                packet.writeFloat( 0.5f );
+                packet.writeInt( seq );
+                packet.end();
+            }
+            remember( seq, StatsRegistry::now() );
+            packet.flush();
+            seq++;
+
+            next += std::chrono::microseconds( (long) ( 1e6 / PROBE_RATE ) );
+            std::this_thread::sleep_until(next);
+        }
+    };
+
+    static inline int32_t read32(const uint8_t *p)
+    {
+        return int32_t( ( uint32_t(p[0]) << 24 ) | ( uint32_t(p[1]) << 16 ) | ( uint32_t(p[2]) << 8 ) | uint32_t(p[3]) );
+    };
+
+    //finds our echo messages in one received packet. anything else -- the rest of the osc -- is skipped
+    void readEcho(const uint8_t *data, size_t size, double arrived)
+    {
+        if( size >= OSC_BUNDLE_HEADER_SIZE && std::memcmp(data, "#bundle", 8) == 0 )
+        {
+            size_t at = OSC_BUNDLE_HEADER_SIZE;
+            while( at + 4 <= size )
+            {
+                int32_t len = read32(data + at);
+                at += 4;
+                if( len <= 0 || at + len > size ) return;
+                readEcho(data + at, len, arrived);
+                at += len;
+            }
+            return;
+        }
+
+        int headerSize = echoAddr.size();
+        if( size != headerSize + 8 || std::memcmp(data, echoAddr.data(), headerSize) != 0 ) return;
+        int32_t seq = read32(data + headerSize), path = read32(data + headerSize + 4);
+
+        double sent;
+        if( !sentTime(seq, sent) ) return;
+        std::lock_guard<std::mutex> lock(pathMutex);
+        if( path >= 0 && path < outTimers.size() ) StatsRegistry::record( outTimers[path], arrived - sent );
+    };
+
+    void echo()
+    {
+        std::vector<uint8_t> buffer(65536);
+        asio::ip::udp::endpoint from;
+        while( running )
+        {
+            asio::error_code error;
+            size_t size = echoSocket->receive_from( asio::buffer(buffer), from, 0, error );
+            double arrived = StatsRegistry::now(); //first thing -- this is when the synth would have it
+            if( error ) continue;
+            readEcho(buffer.data(), size, arrived);
+        }
+    };
+
+public:
+    LatencyProbe() : echoAddr( PROBE_ECHO_ADDR, "ii" )
+    {
+        std::fill(sentSeqs, sentSeqs + PROBE_HISTORY, -1);
+        std::fill(sentTimes, sentTimes + PROBE_HISTORY, 0.0);
+        ingestTimer = StatsRegistry::get("probe/ingest", false);
+        sensorTimer = StatsRegistry::get("probe/sensor", false);
+        running = false;
+        receivePort = echoPort = 0;
+    };
+
+    ~LatencyProbe()
+    {
+        stop();
+    };
+
+    //starts injecting into receive & listening for the echo on echo. false if the echo port is taken, eg. by the synth
+    bool start(unsigned short receive, unsigned short echoOn)
+    {
+        if( running ) return true;
+        receivePort = receive;
+        echoPort = echoOn;
+        try
+        {
+            echoSocket.reset( new asio::ip::udp::socket( io, asio::ip::udp::endpoint( asio::ip::address_v4::loopback(), echoPort ) ) );
+            injectSocket.reset( new asio::ip::udp::socket( io, asio::ip::udp::endpoint( asio::ip::udp::v4(), 0 ) ) );
+        }
+        catch( asio::system_error &e )
+        {
+            CI_LOG_E( "Latency probe can't bind port " << echoPort << " -- is the synth running? " << e.what() );
+            echoSocket.reset();
+            injectSocket.reset();
+            return false;
+        }
+
+        pending.clear();
+        running = true;
+        asio::ip::udp::endpoint to( asio::ip::address_v4::loopback(), receivePort );
+        injectThread = std::thread( [this, to]{ inject(to); } );
+        echoThread = std::thread( [this]{ echo(); } );
+        return true;
+    };
+
+    void stop()
+    {
+        if( !running ) return;
+        running = false;
+        if( injectThread.joinable() ) injectThread.join();
+
+        //wake the echo thread out of its receive w/ a packet that isn't osc
+        asio::error_code error;
+        uint8_t wake = 0;
+        injectSocket->send_to( asio::buffer(&wake, 1), asio::ip::udp::endpoint( asio::ip::address_v4::loopback(), echoPort ), 0, error );
+        if( echoThread.joinable() ) echoThread.join();
+        echoSocket.reset();
+        injectSocket.reset();
+    };
+
+    inline bool isRunning(){ return running; };
+
+    //is this an injected message? -- it has the sequence number after the accel
+    static bool isProbe(const ci::osc::Message &message)
+    {
+        return message.getNumArgs() == 4 && message.getArgType(3) == ci::osc::ArgType::INTEGER_32;
+    };
+
+    //receiver, when an injected sample arrives
+    void ingested(int32_t seq)
+    {
+        double sent;
+        if( sentTime(seq, sent) ) StatsRegistry::record( ingestTimer, StatsRegistry::now() - sent );
+    };
+
+    //after the sensors update -- picks up the probe samples that made it into the sensor's buffer
+    void traceSensor(SensorData *sensor)
+    {
+        if( !running || sensor->getDeviceID() != PROBE_SENSOR_ID ) return;
+
+        double now = StatsRegistry::now();
+        std::vector<MocapDeviceData *> fresh = sensor->getBuffer( sensor->getNewSampleCount() );
+        for(int i=0; i<fresh.size(); i++)
+        {
+            double seq = fresh[i]->getData(MocapDeviceData::DataIndices::PROBE_SEQ);
+            double sent;
+            if( seq == NO_DATA || !sentTime( (int32_t) seq, sent ) ) continue;
+            StatsRegistry::record( sensorTimer, now - sent );
+
+            Pending p = { (int32_t) seq, fresh[i]->getTimeStamp(), sent };
+            pending.push_back(p);
+        }
+    };
+
+    //after the entity updates -- times the samples through each of its nodes & sends the echoes w/ this frame's osc
+    void traceEntity(SensorData *sensor, Entity *entity, OscPacketWriter &packet)
+    {
+        if( !running || sensor->getDeviceID() != PROBE_SENSOR_ID ) return;
+
+        double now = StatsRegistry::now();
+        const std::map<std::string, SignalAnalysis *> &nodes = entity->getNodes();
+        for( std::map<std::string, SignalAnalysis *>::const_iterator it = nodes.begin(); it != nodes.end(); ++it )
+        {
+            if( !it->second->isFresh() ) continue;
+            std::vector<MocapDeviceData *> out = it->second->getBuffer();
+            if( out.empty() ) continue;
+            double newest = out.back()->getTimeStamp();
+
+            int path = pathIndex(it->first);
+            for(int i=0; i<pending.size(); i++)
+            {
+                Pending &p = pending[i];
+                if( p.stamp > newest ) break; //later samples haven't made it either
+                if( p.reached.size() <= path ) p.reached.resize(path + 1, false);
+                if( p.reached[path] ) continue;
+                p.reached[path] = true;
+
+                StatsRegistry::record( pathTimers[path], now - p.sent );
+                if( packet.begin(echoAddr) )
+                {
+                    packet.writeInt(p.seq);
+                    packet.writeInt(path);
+                    packet.end();
+                }
+            }
+        }
+
+        while( !pending.empty() && now - pending.front().sent > PROBE_TIMEOUT ) pending.pop_front();
+    };
+
+    //p50 & p99 of every path, in ms
+    void report(std::ostream &out)
+    {
+        std::vector<LatencyHistogram *> timers = StatsRegistry::all();
+        for(int i=0; i<timers.size(); i++)
+        {
+            LatencyHistogram *t = timers[i];
+            if( t->getName().compare(0, 6, "probe/") != 0 || t->getCount() == 0 ) continue;
+            out << t->getName() << ": p50 " << t->percentile(0.5) * 1000 << "ms p99 " << t->percentile(0.99) * 1000
+                << "ms (" << t->getCount() << ")" << std::endl;
+        }
+    };
+};
+
+};
+
+#endif /* LatencyProbe_h */
@@ -8,6 +8,8 @@
 #ifndef MeasuredEntities_h
 #define MeasuredEntities_h
 
+#include <climits>
+
 namespace CRCPMotionAnalysis {
 
 //who is being measured? or a collection or who or what's? --
@@ -18,12 +20,19 @@ class Entity : public UGEN
 protected:
     std::vector<UGEN * > hand; //assuming sensor is being held by the hand
     std::vector<UGEN * > foot; //assuming sensor is being held by the hand
-     MocapDataVisualizer *handVisualizer; //assuming sensor is being held by the hand -- this will have to be a vector for mo' body parts, etc.
-    MocapDataVisualizer *der1Visualizer; //assuming sensor is being held by the hand -- this will have to be a vector for mo' body parts, etc.
-    MocapDataVisualizer *der2Visualizer; //assuming sensor is being held by the hand -- this will have to be a vector for mo' body parts, etc.
     
-    Derivative *der1;
-    Derivative *der2;
+    std::vector<MocapDataVisualizer *> visualizers; //only the visualizers that are enabled in the graph
+    std::vector<ci::ColorA> visualizerColors;
+    std::vector<UGEN *> oscSources; //nodes whose osc we send
+    std::map<std::string, SignalAnalysis *> nodes; //by name in the graph
+    
+    //what was attached, so the graph can be rebuilt when the graph file changes
+    struct Attachment
+    {
+        int idz;
+        SensorData *sensor;
+    };
+    std::vector<Attachment> attachments;
 
     bool handInit = false; //whether we have set up the hand ugens
     int handID; //this will correspond to wii mote # or some OSC id'ing the sensor
@@ -35,94 +44,398 @@ public:
         handInit = false;
     };
     
+    virtual ~Entity()
+    {
+        clear();
+    };
+    
     bool isInit()
     {
         return handInit;
     };
     
-
-    void addSensorBodyPart(int idz, SensorData *sensor, BodyPart whichBody )
+    static BodyPart bodyPartFromName(const std::string &part)
+    {
+        if( part == "foot" ) return FOOT;
+        return HAND;
+    };
+    
+    std::vector<UGEN * > *getBodyPartUgens(BodyPart whichBody)
     {
-        //which body part is the sensor of?
-        std::vector<UGEN * > *bUgens; //the ugen vector to add ugens to
         switch (whichBody)
         {
-            case HAND: //well it has to be currently, but ya know, in case this gets expanded...
-                bUgens = &hand;
-                handInit = true;
-                handID = idz;
-                break;
+            case FOOT:
+                return &foot;
+            case HAND:
             default:
-                break;
+                return &hand;
         };
+    };
+
+    //creates the ugens the graph describes for this sensor. disabled nodes -- and everything downstream of them -- are skipped
+    void addSensorBodyPart(int idz, SensorData *sensor, const GraphDescription &graph = GraphConfig::defaultGraph())
+    {
+        BodyPart whichBody = bodyPartFromName(graph.part);
+        std::vector<UGEN * > *bUgens = getBodyPartUgens(whichBody); //the ugen vector to add ugens to
+        if( whichBody == HAND )
+        {
+            handInit = true;
+            handID = idz;
+        }
         
-        //add all the basic signal analysis that happens for ea. sensor
-        InputSignal *signal_input = new InputSignal(idz); //1. create an input
-        signal_input->setInput(sensor);
-        bUgens->push_back( signal_input );
-        
-        //add an averaging filter
-        AveragingFilter *avgfilter = new AveragingFilter(signal_input);
-        bUgens->push_back( avgfilter );
-        
-        //add a first derivative
-        der1 = new Derivative( avgfilter );
-        bUgens->push_back( der1 );
-        
-        //add a second derivative
-        der2 = new Derivative( der1 );
-        bUgens->push_back( der2 );
-        
-        //add the visualizers
-        handVisualizer = new MocapDataVisualizer( avgfilter );
-        bUgens->push_back( handVisualizer );
-        
-        der1Visualizer = new MocapDataVisualizer( der1 );
-        bUgens->push_back( der1Visualizer );
-        
-        der2Visualizer = new MocapDataVisualizer( der2 );
-        bUgens->push_back( der2Visualizer );
+        Attachment a = { idz, sensor };
+        attachments.push_back(a);
         
-
-
+        std::map<std::string, SignalAnalysis *> created;
+        for( const NodeDescription &desc : graph.nodes )
+        {
+            if( !desc.enabled ) continue;
+            
+            SignalAnalysis *in1 = NULL, *in2 = NULL;
+            if( !desc.input.empty() )
+            {
+                if( !created.count(desc.input) ) continue; //upstream is disabled or missing -- nothing to feed this node
+                in1 = created[desc.input];
+            }
+            if( !desc.input2.empty() )
+            {
+                if( !created.count(desc.input2) ) continue;
+                in2 = created[desc.input2];
+            }
+            if( in1 == NULL && nodeNeedsInput(desc) ) continue;
+            
+            SignalAnalysis *node = createNode(desc, idz, sensor, in1, in2);
+            if( node == NULL ) continue;
+            
+            node->setTimer( StatsRegistry::get( "ugen/" + std::to_string(idz) + "/" + desc.name ) );
+            created[desc.name] = node;
+            nodes[desc.name] = node;
+            bUgens->push_back( node );
+            if( desc.osc ) oscSources.push_back( node );
+            
+            MocapDataVisualizer *viz = dynamic_cast<MocapDataVisualizer *>(node);
+            if( viz != NULL )
+            {
+                visualizers.push_back(viz);
+                visualizerColors.push_back(desc.color);
+            }
+        }
     }
     
-    virtual void draw()
+    //kept for the original call -- the body part now comes from the graph
+    void addSensorBodyPart(int idz, SensorData *sensor, BodyPart whichBody )
     {
-        color(0, 0, 1, 1.0f);
-        handVisualizer->draw();
-        color(1, 0, 0, 1.0f);
-        der1Visualizer->draw();
-        color(1, 0, 1, 1.0f);
-        der2Visualizer->draw();
+        GraphDescription graph = GraphConfig::defaultGraph();
+        graph.part = whichBody == FOOT ? "foot" : "hand";
+        addSensorBodyPart(idz, sensor, graph);
     }
     
+    //deletes all the ugens. the sensors belong to the app so they stay.
+    void clear()
+    {
+        for(int i=0; i<hand.size(); i++) delete hand[i];
+        for(int i=0; i<foot.size(); i++) delete foot[i];
+        hand.clear();
+        foot.clear();
+        visualizers.clear();
+        visualizerColors.clear();
+        oscSources.clear();
+        nodes.clear();
+        handInit = false;
+    };
+    
+    //tear down & re-create the graphs for every attached sensor, eg. after the graph file changed
+    void rebuild(GraphConfig &config)
+    {
+        std::vector<Attachment> attached = attachments;
+        clear();
+        attachments.clear();
+        for( Attachment &a : attached )
+            addSensorBodyPart( a.idz, a.sensor, config.getGraph( a.sensor->getDeviceID() ) );
+    };
+    
+    //our visualizers & their colors, for the app to draw
+    inline const std::vector<MocapDataVisualizer *> &getVisualizers(){ return visualizers; };
+    inline const std::vector<ci::ColorA> &getVisualizerColors(){ return visualizerColors; };
+    
     
     //if we wanted to gather & send OSC from our ugens or send our own osc.. do it here.
     virtual std::vector<ci::osc::Message> getOSC()
     {
         std::vector<ci::osc::Message> msgs;
-        for (int i = 0 ; i < hand.size(); i++)
+        for (int i = 0 ; i < oscSources.size(); i++)
         {
-            for (int j = 0; j < hand[i]->getOSC().size(); j++) {
-                msgs.push_back( hand[i]->getOSC()[i] );
-            }
+            if( !oscSources[i]->isFresh() ) continue; //nothing new since the last send
+            std::vector<ci::osc::Message> m = oscSources[i]->getOSC();
+            msgs.insert( msgs.end(), m.begin(), m.end() );
         }
         return msgs;
     };
     
+    //what the app sends with -- all the fresh ugens' messages go straight into the packet
+    virtual void appendOSC(OscPacketWriter &packet)
+    {
+        for (int i = 0 ; i < oscSources.size(); i++)
+        {
+            if( oscSources[i]->isFresh() ) oscSources[i]->appendOSC(packet);
+        }
+    };
+    
+    
+    //a node by its name in the graph, eg. "resample". NULL if this entity doesn't have it
+    SignalAnalysis *getNode(const std::string &name)
+    {
+        std::map<std::string, SignalAnalysis *>::iterator it = nodes.find(name);
+        return it == nodes.end() ? NULL : it->second;
+    };
+    
+    //every node, by its name in the graph
+    const std::map<std::string, SignalAnalysis *> &getNodes()
+    {
+        return nodes;
+    };
     
-    //update all the ugens we own. all of them that need updating..
+    //id of the (first) sensor we measure
+    int getID()
+    {
+        return attachments.empty() ? -1 : attachments[0].idz;
+    };
+    
+    //update all the ugens we own. all of them that need updating.. -- each ugen is in the graph once & in
+    //dependency order, and only recomputes if its inputs produced new samples this frame
     virtual void update(float seconds = 0)
     {
         for(int i=0; i<hand.size(); i++) {
-            hand[i]->update(seconds);
+            hand[i]->process(seconds);
+        }
+        for(int i=0; i<foot.size(); i++) {
+            foot[i]->process(seconds);
         }
-        der1->update(seconds);
-        der2->update(seconds);
     };
 
 };
+
+#define FUSION_WINDOW 64 //ticks in the sliding correlation window -- ~1.25 sec at SR
+#define FUSION_MAX_LAG 5 //ticks either way that synchrony looks for one limb leading another
+#define FUSION_HOP 5 //ticks between /mocap/fusion messages
+#define FUSION_NODE "resample" //the node of each member entity that gets fused -- it has to be on the Resampler's global grid
+
+//fuses several entities (hands, feet, phone) into one time aligned frame per resampler tick & computes the cross sensor
+//features once, here, instead of in every consumer. for each pair of sensors, over a sliding window:
+//  distance -- mean |accel a - accel b|, how differently they are moving
+//  correlation -- pearson correlation of |accel| at zero lag
+//  synchrony & lag -- the best correlation within +/- FUSION_MAX_LAG ticks & the lag it was at (+ means b follows a)
+//everything is kept as running sums (incremental covariance), so a tick is O(pairs * lags) no matter the window.
+class FusionEntity : public UGEN
+{
+protected:
+    static const int LAGS = 2*FUSION_MAX_LAG + 1;
+    static const int RING = FUSION_WINDOW + 2*FUSION_MAX_LAG + 1;
+    
+    struct Member
+    {
+        Entity *entity;
+        std::vector<ci::vec3> accel; //ring of aligned samples, indexed by fused tick count
+        std::vector<double> mag;
+    };
+    
+    struct Pair
+    {
+        int a, b;
+        double sx[LAGS], sy[LAGS], sxx[LAGS], syy[LAGS], sxy[LAGS];
+        double distSum;
+        int count;
+        
+        float distance, correlation, synchrony, lag;
+    };
+    
+    std::vector<Member> members;
+    std::vector<Pair> pairs;
+    std::vector<MocapDeviceData *> aligned; //scratch -- this tick's sample from each member
+    std::vector< std::vector<MocapDeviceData *> > buffers; //scratch -- each member's resampled window
+    
+    std::string nodeName;
+    double rate;
+    long nextTick; //next resampler tick to fuse
+    long fused; //ticks fused so far
+    int sinceHop;
+    bool hopped; //new features to send this frame
+    
+    static long tickOf(MocapDeviceData *d)
+    {
+        return std::lround( d->getData(MocapDeviceData::DataIndices::INDEX) );
+    };
+    
+    //the member's sample at tick, or NULL if it doesn't have one
+    static MocapDeviceData *sampleAt(const std::vector<MocapDeviceData *> &buf, long tick)
+    {
+        if( buf.empty() ) return NULL;
+        long pos = tick - tickOf(buf.front());
+        if( pos >= 0 && pos < buf.size() && tickOf(buf[pos]) == tick ) return buf[pos];
+        for(int i=0; i<buf.size(); i++) if( tickOf(buf[i]) == tick ) return buf[i]; //there was a dropout in the window
+        return NULL;
+    };
+    
+    void resetPairs()
+    {
+        pairs.clear();
+        for(int a=0; a<members.size(); a++)
+        {
+            for(int b=a+1; b<members.size(); b++)
+            {
+                Pair p;
+                std::memset(&p, 0, sizeof(Pair));
+                p.a = a; p.b = b;
+                pairs.push_back(p);
+            }
+        }
+        fused = 0;
+        sinceHop = 0;
+    };
+    
+    //adds the pairs at the window's center tick c & drops the ones that fell out of the window
+    void updatePair(Pair &p)
+    {
+        Member &A = members[p.a], &B = members[p.b];
+        long c = fused - 1 - FUSION_MAX_LAG; //center tick -- has FUSION_MAX_LAG ticks on both sides
+        if( c < FUSION_MAX_LAG ) return;
+        bool full = p.count == FUSION_WINDOW;
+        long old = c - FUSION_WINDOW;
+        
+        for(int l=0; l<LAGS; l++)
+        {
+            int lag = l - FUSION_MAX_LAG;
+            double x = A.mag[c % RING], y = B.mag[(c + lag) % RING];
+            p.sx[l] += x; p.sy[l] += y; p.sxx[l] += x*x; p.syy[l] += y*y; p.sxy[l] += x*y;
+            if( full )
+            {
+                double ox = A.mag[old % RING], oy = B.mag[(old + lag) % RING];
+                p.sx[l] -= ox; p.sy[l] -= oy; p.sxx[l] -= ox*ox; p.syy[l] -= oy*oy; p.sxy[l] -= ox*oy;
+            }
+        }
+        
+        p.distSum += glm::length( A.accel[c % RING] - B.accel[c % RING] );
+        if( full ) p.distSum -= glm::length( A.accel[old % RING] - B.accel[old % RING] );
+        else p.count++;
+    };
+    
+    void computeFeatures(Pair &p)
+    {
+        if( p.count == 0 ) return;
+        double n = p.count;
+        p.distance = p.distSum / n;
+        p.synchrony = -1;
+        p.lag = 0;
+        for(int l=0; l<LAGS; l++)
+        {
+            double cov = p.sxy[l]/n - (p.sx[l]/n) * (p.sy[l]/n);
+            double vx = p.sxx[l]/n - (p.sx[l]/n) * (p.sx[l]/n);
+            double vy = p.syy[l]/n - (p.sy[l]/n) * (p.sy[l]/n);
+            double corr = ( vx > 1e-12 && vy > 1e-12 ) ? cov / std::sqrt(vx * vy) : 0;
+            if( l == FUSION_MAX_LAG ) p.correlation = corr;
+            if( corr > p.synchrony )
+            {
+                p.synchrony = corr;
+                p.lag = ( l - FUSION_MAX_LAG ) / rate;
+            }
+        }
+    };
+    
+    void fuseTick()
+    {
+        for(int m=0; m<members.size(); m++)
+        {
+            ci::vec3 a = aligned[m]->getAccelData();
+            members[m].accel[fused % RING] = a;
+            members[m].mag[fused % RING] = glm::length(a);
+        }
+        fused++;
+        for(int i=0; i<pairs.size(); i++) updatePair(pairs[i]);
+        
+        if( ++sinceHop >= FUSION_HOP )
+        {
+            sinceHop = 0;
+            for(int i=0; i<pairs.size(); i++) computeFeatures(pairs[i]);
+            hopped = true;
+        }
+    };
+    
+public:
+    FusionEntity(double _rate=SR, const std::string &node=FUSION_NODE)
+    {
+        rate = _rate;
+        nodeName = node;
+        nextTick = -1;
+        fused = 0;
+        sinceHop = 0;
+        hopped = false;
+    };
+    
+    //adds an entity to the fused frame -- eg. every entity the app makes
+    void addMember(Entity *entity)
+    {
+        Member m;
+        m.entity = entity;
+        m.accel.assign(RING, ci::vec3(0));
+        m.mag.assign(RING, 0);
+        members.push_back(m);
+        aligned.resize(members.size());
+        buffers.resize(members.size());
+        resetPairs();
+    };
+    
+    inline int getMemberCount(){ return members.size(); };
+    
+    virtual void update(float seconds = 0)
+    {
+        hopped = false;
+        if( members.size() < 2 ) return;
+        
+        //look the node up every frame -- a graph reload replaces it
+        long first = LONG_MIN, last = LONG_MAX;
+        for(int m=0; m<members.size(); m++)
+        {
+            SignalAnalysis *node = members[m].entity->getNode(nodeName);
+            if( node == NULL ) return;
+            buffers[m] = node->getBuffer();
+            if( buffers[m].empty() ) return;
+            first = std::max(first, tickOf(buffers[m].front()));
+            last = std::min(last, tickOf(buffers[m].back()));
+        }
+        
+        if( nextTick < first ) nextTick = first; //start up, or we fell behind the windows
+        for( ; nextTick <= last; nextTick++ )
+        {
+            bool complete = true;
+            for(int m=0; m<members.size() && complete; m++)
+            {
+                aligned[m] = sampleAt(buffers[m], nextTick);
+                complete = aligned[m] != NULL;
+            }
+            if( complete ) fuseTick(); //a sensor dropped out at this tick -- skip it rather than fuse a partial frame
+        }
+    };
+    
+    virtual std::vector<ci::osc::Message> getOSC()
+    {
+        std::vector<ci::osc::Message> msgs;
+        return msgs;
+    };
+    
+    //one /mocap/fusion (id a, id b, distance, correlation, synchrony, lag in seconds) per pair every hop
+    virtual void appendOSC(OscPacketWriter &packet)
+    {
+        if( !hopped ) return;
+        static const OscAddress addr("/mocap/fusion", "ffffff");
+        for(int i=0; i<pairs.size(); i++)
+        {
+            Pair &p = pairs[i];
+            float args[6] = { (float) members[p.a].entity->getID(), (float) members[p.b].entity->getID(),
+                              p.distance, p.correlation, p.synchrony, p.lag };
+            packet.append(addr, args, 6);
+        }
+    };
+};
     
 };
 
@@ -38,6 +38,8 @@ Float der1y = 0.;
 Float prevDer1y = 0.;
 Float dist = 0.;
 
+//square values are normalized in Motus -- position of the square w/ the most motion in [0,1] across the camera,
+//& the fraction of it that moved -- so they don't change w/ the grid or the camera's resolution
 Float xPos = 0.;
 Float prevXPos = 0.;
 Float yPos = 0.;
@@ -45,6 +47,14 @@ Float prevYPos = 0.;
 Float maxMotion = 0.;
 Float prevMaxMotion = 0.;
 
+Float LOUD_MOTION = 0.4; //motion fraction that plays at full amplitude
+
+//gesture events -- computed in Motus so we don't re-derive them here
+boolean onset = false;
+Float energy = 0.;
+
+Float HIGH_ENERGY = 3.; //mean |accel|^2 where the viz's ellipses are at their most opaque -- 3 axes at full scale
+
 
 //Tri oscillator and envelope -> max motion value is passed in 
 TriOsc tri;
@@ -109,6 +119,10 @@ void oscEvent(OscMessage msg) { //checks for incoming osc messages
     } else if ( addr.contains("mocap/derivative") ) {
         der1x = msg.get(0).floatValue();
         der1y = msg.get(1).floatValue();
+    } else if ( addr.contains("mocap/onset") ) {
+        onset = true; //args: sensor id, strength, time
+    } else if ( addr.contains("mocap/energy") ) {
+        energy = msg.get(1).floatValue(); //args: sensor id, energy
     } else if ( addr.contains("mocap/square") ) {
         maxMotion = msg.get(0).floatValue();
         xPos = msg.get(1).floatValue();
@@ -119,8 +133,8 @@ void oscEvent(OscMessage msg) { //checks for incoming osc messages
 
 void handleTri() {
   //map values
-  Float midiX = map(xPos, 0, 640, 49, 84);
-  Float mappedMotion = map(maxMotion, 0, 300000, 0, 0.05);
+  Float midiX = map(xPos, 0, 1, 49, 84);
+  Float mappedMotion = map(min(maxMotion, LOUD_MOTION), 0, LOUD_MOTION, 0, 0.05);
   //Float xA = map(xAccel, 0, 10, 0, 1);
   //Float yA = map(yAccel, 0, 10, 0, 1);
   if (midiX == null) {
@@ -154,15 +168,16 @@ void handleViz() {
   float yA = map(yAccel, 0, 1, 0, 10);
   float d1x = map(der1x, 0, 1000, 0, width);
   float d1y = map(der1y, 0, 1000, 0, height);
-  float xP = map(xPos, 0, 640, 100, width);
-  float yP = map(yPos, 0, 480, 100, height);
+  float xP = map(xPos, 0, 1, 100, width);
+  float yP = map(yPos, 0, 1, 100, height);
   
   dist = sqrt(der1y*der1y - der1x*der1x);
   
   float colRed = map(xAccel, 0, 1, 0, 255);
   float colGreen = map(yAccel, 0, 1, 0, 255);
   float colBlue = map(dist, 0, 80, 0, 255);
-  float colAlpha = map(maxMotion, 0, 300000, 0, 255);
+  float colAlpha = map(min(maxMotion, LOUD_MOTION), 0, LOUD_MOTION, 0, 255);
+  float fillAlpha = map(min(energy, HIGH_ENERGY), 0, HIGH_ENERGY, 20, 80); //more vigorous movement, denser ellipses
   //println(colRed + " " + colGreen + " " + colBlue);
   //println("maxM: " + maxMotion + " colAlpha: " + colAlpha);
   
@@ -173,7 +188,7 @@ void handleViz() {
   noFill();
   bezier(0, 0, xP, yP, xA, yA, d1x, d1y);
   noStroke();
-  fill(255, 20);
+  fill(255, fillAlpha);
   ellipse(xA, yA, d1x, d1y);
   
   //println(xP + " " + yP + " " + xA + " " + yA + " " + d1x + " " + d1y);
@@ -182,7 +197,7 @@ void handleViz() {
 }
 
 void handleDrums() {
-  Float xSound = map(xPos, 0, 640, 0, 1);
+  Float xSound = xPos;
   Float ySound = map(der1y, 0, 100, 0, 1);
   //dead code prevents null exception from sound library
   if (xSound == null) {
@@ -199,7 +214,8 @@ void handleDrums() {
   }
   
   file.amp(xSound);
-  if (der1x > 50) {
+  if (der1x > 50 || onset) {
+    onset = false;
     if (!file.isPlaying()) {
       file.stop();
       file.play();
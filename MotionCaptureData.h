@@ -12,6 +12,8 @@
 #define WIIMOTE_ACCELMIN 0.0
 #define DEVICE_ARG_COUNT_MAX 24
 
+#include <atomic>
+
 namespace CRCPMotionAnalysis {
 
 
@@ -27,7 +29,7 @@ class MocapDeviceData
         double getAccelMax(){ return WIIMOTE_ACCELMAX; };
         double getAccelMin(){ return WIIMOTE_ACCELMIN; };
     public:
-        enum DataIndices { INDEX=0, TIME_STAMP=1, ACCELX=2, ACCELY=3, ACCELZ=4, GYROX=11, GYROY=12, GYROZ=13, POSX= 14, POSY=15, QX=20, QY=21, QZ=22, QA=23 };
+        enum DataIndices { INDEX=0, TIME_STAMP=1, ACCELX=2, ACCELY=3, ACCELZ=4, GYROX=11, GYROY=12, GYROZ=13, POSX= 14, POSY=15, PROBE_SEQ=16, QX=20, QY=21, QZ=22, QA=23 };
     
         //scale accel to 0 - 1 -- obv. not needed if wiimote
         void scaleAccel()
@@ -127,8 +129,31 @@ class MocapDeviceData
             
         };
         
+        //how many MocapDeviceData exist right now -- for checking the ugens free what they allocate
+        static std::atomic<long> &liveCount()
+        {
+            static std::atomic<long> count(0);
+            return count;
+        };
+        static long getLiveCount(){ return liveCount().load(); };
+    
+        MocapDeviceData(const MocapDeviceData &other)
+        {
+            std::copy(other.data, other.data + DEVICE_ARG_COUNT_MAX + 1, data);
+            std::copy(other.quaternion, other.quaternion + 4, quaternion);
+            std::copy(other.orientationMatrix, other.orientationMatrix + 3, orientationMatrix);
+            liveCount()++;
+        }
+    
+        ~MocapDeviceData()
+        {
+            liveCount()--;
+        }
+    
         MocapDeviceData()
         {
+            liveCount()++;
+            
             //init memory
             for(int i=0; i<DEVICE_ARG_COUNT_MAX; i++)
             {
@@ -0,0 +1,873 @@
+//
+//  MotusEngine.cpp
+//  Motus
+//
+//  The engine's definitions -- MotusEngine.h has the overview. Built into both the app & motus-server.
+//
+
+#include "MotusEngine.h"
+
+MotusEngine::MotusEngine(asio::io_service &io) : mSender(LOCALPORT, DESTHOST, DESTPORT, protocol::v4(), io), mReceiver( LOCALPORT2, protocol::v4(), mReceiveIo )
+{
+    mClockStart = std::chrono::steady_clock::now();
+    seconds = 0;
+}
+
+MotusEngine::~MotusEngine()
+{
+    mReceiveIo.stop(); //the receiver's handlers use the engine
+    if( mReceiveThread.joinable() ) mReceiveThread.join();
+    mPipeline.stop(); //before the stages' state goes away
+    for(int i=0; i<mSources.size(); i++)
+    {
+        mSources[i]->stop();
+        delete mSources[i]; //the astra readers before astra goes
+    }
+    mSources.clear();
+    astra::terminate();
+}
+
+//the sources in the file, or one astra over the whole stage
+void MotusEngine::loadSources(const fs::path &path)
+{
+    if( !path.empty() && fs::exists(path) )
+    {
+        try
+        {
+            JsonTree json( loadFile(path) );
+            if( json.hasChild("tolerance") ) mSync.setTolerance( json.getValueForKey<float>("tolerance") );
+            if( json.hasChild("sources") )
+            {
+                for( const JsonTree &src : json.getChild("sources").getChildren() )
+                {
+                    std::string type = src.hasChild("type") ? src.getValueForKey("type") : "astra";
+                    std::string name = src.hasChild("name") ? src.getValueForKey("name") : type + std::to_string( mSources.size() );
+                    Rectf stage( 0, 0, 1, 1 );
+                    if( src.hasChild("stage") && src.getChild("stage").getNumChildren() >= 4 )
+                    {
+                        const JsonTree &r = src.getChild("stage");
+                        stage = Rectf( r[0].getValue<float>(), r[1].getValue<float>(), r[2].getValue<float>(), r[3].getValue<float>() );
+                    }
+                    double fps = src.hasChild("fps") ? src.getValueForKey<double>("fps") : 30;
+
+                    if( type == "astra" ) mSources.push_back( new AstraSource( name, stage, src.hasChild("uri") ? src.getValueForKey("uri") : "device/default" ) );
+                    else if( type == "synthetic" )
+                    {
+                        ivec2 size( 640, 480 );
+                        if( src.hasChild("size") && src.getChild("size").getNumChildren() >= 2 )
+                            size = ivec2( src.getChild("size")[0].getValue<int>(), src.getChild("size")[1].getValue<int>() );
+                        mSources.push_back( new SyntheticSource( name, stage, fps, size.x, size.y, stage.x1 ) ); //phase follows the stage, so the disc crosses over
+                    }
+                    else if( type == "recorded" ) mSources.push_back( new RecordedSource( name, stage, fps, src.hasChild("path") ? src.getValueForKey("path") : "" ) );
+                    else CI_LOG_W( "Unknown source type " << type );
+                }
+            }
+            CI_LOG_I( "Loaded " << mSources.size() << " frame sources from " << path );
+        }
+        catch( ci::Exception &e )
+        {
+            CI_LOG_E( "Error loading sources file " << path << ": " << e.what() );
+        }
+    }
+    if( mSources.empty() ) mSources.push_back( new AstraSource( "astra", Rectf(0, 0, 1, 1) ) );
+
+    for(int i=0; i<mSources.size(); i++)
+    {
+        if( !mSources[i]->start() ) CI_LOG_W( "Frame source " << mSources[i]->getName() << " didn't start" );
+        if( !mPrimaryAstra ) mPrimaryAstra = dynamic_cast<AstraSource *>( mSources[i] );
+    }
+    mSync.setSources(mSources);
+}
+
+//set up the astra, osc & the analysis
+bool MotusEngine::setup(const fs::path &graphFile, const fs::path &maskFile, const fs::path &sourcesFile, const fs::path &outputsFile)
+{
+    //initialize astra, then the sensors
+    astra::initialize();
+    loadSources( sourcesFile );
+
+    //ugen graph -- falls back to the built in chain if the file isn't there
+    mGraphConfig.load( graphFile );
+
+    mMask.load( maskFile );
+    //the depth band is in the astra's view, so it only masks the stage when that astra is all of it
+    if( mPrimaryAstra && mSources.size() == 1 ) mPrimaryAstra->getListener().setMask( &mMask );
+    else if( mSources.size() > 1 ) CI_LOG_W( "Several frame sources -- the mask's depth band is off, its regions are in stage coordinates" );
+
+    mRing.load( outputsFile ); //before the pipeline -- the analysis checks if it wants the difference image
+
+    cv::setNumThreads(ANALYSIS_THREADS);
+    mPipeline.start( [this]( PipelineFrame *frame ){ prepareFrame(frame); },
+                     [this]( PipelineFrame *frame ){ analyzeFrame(frame); } );
+
+    try{
+        mSender.bind();
+    }
+    catch( osc::Exception &e)
+    {
+        CI_LOG_E( "Error binding" << e.what() << " val: " << e.value() );
+        return false;
+    }
+    mPacket.setSink( [this]( const uint8_t *data, size_t size ){ sendPacket(data, size); } );
+    mFanout.setSocket( mSender.getSocket()->native_handle() );
+    if( !mFanout.load( outputsFile ) ) mFanout.subscribe( DESTHOST, DESTPORT, std::vector<std::string>() );
+
+    receive( SUBSCRIBE_ADDR, [this]( const osc::Message &msg, double arrival ){
+        updateSubscription(msg, true);
+    });
+
+    receive( SUBSCRIBE_BINARY_ADDR, [this]( const osc::Message &msg, double arrival ){
+        updateSubscription(msg, true, true);
+    });
+
+    receive( UNSUBSCRIBE_ADDR, [this]( const osc::Message &msg, double arrival ){
+        updateSubscription(msg, false);
+    });
+
+    receive( STATS_ADDR, [this]( const osc::Message &msg, double arrival ){
+        replyStats(msg); //someone wants the timers
+    });
+
+    receive( PROBE_ADDR, [this]( const osc::Message &msg, double arrival ){
+        if( !CRCPMotionAnalysis::LatencyProbe::isProbe(msg) ) return;
+        mProbe.ingested( msg.getArgInt32(3) );
+        addPhoneAndWiiData(msg, PROBE_SENSOR_ID, arrival); //the same path a wiimote's samples take
+    });
+
+    receive( SYNTIEN_MESSAGE, [this]( const osc::Message &msg, double arrival ){
+        updatePhoneValues(msg, arrival); //listening for phone
+    });
+
+    for (int i=0; i<MAX_NUM_OF_WIIMOTES; i++) //receiving for all wiimotes that we are getting osc from
+    {
+        std::stringstream addr;
+        addr << WIIMOTE_ACCEL_MESSAGE_PART1 << i << WIIMOTE_ACCEL_MESSAGE_PART2;
+        receive( addr.str(), [this]( const osc::Message &msg, double arrival ){
+            updateWiiValues(msg, arrival); //listening for wiimote
+        });
+    }
+
+    try {
+        // Bind the receiver to the endpoint. This function may throw.
+        mReceiver.bind();
+    }
+    catch( const osc::Exception &ex ) {
+        CI_LOG_E( "Error binding: " << ex.what() << " val: " << ex.value() );
+        return false;
+    }
+
+    // UDP opens the socket and "listens" accepting any message from any endpoint. The listen
+    // function takes an error handler for the underlying socket. Any errors that would
+    // call this function are because of problems with the socket or with the remote message.
+    mReceiver.listen(
+                     []( asio::error_code error, protocol::endpoint endpoint ) -> bool {
+                         if( error ) {
+                             CI_LOG_E( "Error Listening: " << error.message() << " val: " << error.value() << " endpoint: " << endpoint );
+                             return false;
+                         }
+                         else
+                             return true;
+                     });
+    mReceiveThread = std::thread( [this]{ mReceiveIo.run(); } ); //returns when the destructor stops it, or the socket fails
+    return true;
+}
+
+//handler runs on the main thread -- the receive thread only copies the message & when it arrived
+void MotusEngine::receive(const std::string &address, ReceiveFn handler)
+{
+    int index = mHandlers.size();
+    mHandlers.push_back(handler);
+    mReceiver.setListener( address, [this, index]( const osc::Message &msg ){
+        double arrival = elapsed(); //the thread waits on the socket, so this is only its wake up after the packet
+        std::lock_guard<std::mutex> lock(mReceivedMutex);
+        mReceived.push_back( { msg, arrival, index } );
+    });
+}
+
+//everything received since the last update, in the order it arrived
+void MotusEngine::dispatchReceived()
+{
+    mReceiving.clear();
+    {
+        std::lock_guard<std::mutex> lock(mReceivedMutex);
+        mReceiving.swap(mReceived);
+    }
+    for(int i=0; i<mReceiving.size(); i++) mHandlers[ mReceiving[i].handler ]( mReceiving[i].message, mReceiving[i].arrival );
+    mDispatched = mReceiving.size();
+}
+
+void MotusEngine::handleKey(char key)
+{
+    if( key == 'b' ) //cycle the background subtraction mode
+    {
+        std::lock_guard<std::mutex> lock(mAnalysisMutex);
+        mBackground.nextMode();
+        std::cout << "background mode: " << mBackground.getModeName() << std::endl;
+    }
+    else if( key == 'r' ) //grab the empty stage as the static reference
+    {
+        mCaptureReference = true;
+    }
+    else if( key == 'm' ) //report MocapDeviceData leaks
+    {
+        std::cout << "live MocapDeviceData: " << CRCPMotionAnalysis::MocapDeviceData::getLiveCount()
+                  << " leaked per frame: " << ( mFramesCounted ? double(mUnownedCount - mUnownedAtReport) / mFramesCounted : 0 ) << std::endl;
+        mFramesCounted = 0;
+    }
+    else if( key == 'k' ) //analyze the whole frame / only the mask's live tiles
+    {
+        std::lock_guard<std::mutex> lock(mAnalysisMutex);
+        mMask.setEnabled( !mMask.isEnabled() );
+        std::cout << "analysis mask " << ( mMask.isEnabled() ? "on" : "off" ) << std::endl;
+    }
+    else if( key == 'p' ) //favor latency or throughput in the frame pipeline
+    {
+        mPipeline.setPolicy( mPipeline.getPolicy() == FramePipeline::LOWEST_LATENCY ? FramePipeline::THROUGHPUT : FramePipeline::LOWEST_LATENCY );
+        std::cout << "pipeline policy: " << mPipeline.getPolicyName() << std::endl;
+    }
+    else if( key == 'l' ) //report the frame latency
+    {
+        std::cout << "capture to screen: " << mPipeline.getLatency() * 1000 << "ms (last " << mPipeline.getLastLatency() * 1000 << "ms)"
+                  << " prepare: " << mPipeline.getStageLatency(PipelineFrame::PREPARED) * 1000 << "ms"
+                  << " analyze: " << mPipeline.getStageLatency(PipelineFrame::ANALYZED) * 1000 << "ms"
+                  << " send: " << mPipeline.getStageLatency(PipelineFrame::SENT) * 1000 << "ms"
+                  << " render: " << mPipeline.getStageLatency(PipelineFrame::RENDERED) * 1000 << "ms"
+                  << " dropped: " << mPipeline.getDropped()
+                  << " frame sets: " << mSync.getSetCount() << " (" << mSync.getUnsyncedCount() << " frames out of sync)" << std::endl;
+    }
+    else if( key == 'a' ) //adapt the quality to the frame budget, or stay at full
+    {
+        mQuality.setAdaptive( !mQuality.isAdaptive() );
+        reportQuality();
+    }
+    else if( key == 'f' ) //who the osc goes to & how much they got
+    {
+        mFanout.report(std::cout);
+        if( mRing.isOpen() ) std::cout << "shared memory ring: " << mRing.getPublished() << " frames" << std::endl;
+    }
+    else if( key == 't' ) //dump the stage timers
+    {
+        dumpStats();
+    }
+    else if( key == 'o' ) //latency probe on/off -- needs the synth's port, so quit the synth first
+    {
+        if( mProbe.isRunning() )
+        {
+            mProbe.stop();
+            mProbe.report(std::cout);
+        }
+        else if( mProbe.start(LOCALPORT2, DESTPORT) ) std::cout << "latency probe on" << std::endl;
+    }
+}
+
+//the frame for the renderer, if a new one was analyzed since it last took one
+PipelineFrame *MotusEngine::takeRenderFrame()
+{
+    PipelineFrame *frame = mRenderFrame;
+    mRenderFrame = NULL;
+    return frame;
+}
+
+//the renderer is done w/ it -- counts towards the capture to screen latency
+void MotusEngine::rendered(PipelineFrame *frame)
+{
+    mPipeline.stamp(frame, PipelineFrame::RENDERED);
+    mPipeline.release(frame);
+}
+
+//outdated vestige
+void MotusEngine::sendOSC(std::string addr, float posX, float posY, float vel, float acc)
+{
+    osc::Message msg;
+    msg.setAddress(addr);
+    msg.append(posX); //adds a parameter
+    msg.append(posY);
+    msg.append(vel);
+    msg.append(acc);
+    
+    mSender.send(msg);
+    
+}
+
+//this has not been implemented into signal tree paradigm yet. ah well. TODO: implement as such
+void MotusEngine::updatePhoneValues(const osc::Message &message, double arrival)
+{
+    addPhoneAndWiiData(message, PHONE_ID, arrival);
+}
+
+//gets data from osc message then adds wiimote data to sensors
+void MotusEngine::addPhoneAndWiiData(const osc::Message &message, std::string _id, double arrival)
+{
+    MOTUS_TIME_SCOPE("osc/ingest");
+    CRCPMotionAnalysis::MocapDeviceData *sensorData = new CRCPMotionAnalysis::MocapDeviceData;
+    std::string dID = _id ;
+    int which = std::atoi(_id.c_str()); //convert to int
+    
+    CRCPMotionAnalysis::SensorData *sensor = getSensor( _id, which );
+    
+    //set time stamp -- when this message came off the socket, not when update() ran, so the Resampler sees the real spacing
+    sensorData->setData( CRCPMotionAnalysis::MocapDeviceData::DataIndices::TIME_STAMP, arrival );
+    
+    //add accel data
+    for(int i= 0; i<3; i++)
+        sensorData->setData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::ACCELX+i, message.getArgFloat(i));
+    
+    //the latency probe's samples carry their sequence number after the accel
+    if( CRCPMotionAnalysis::LatencyProbe::isProbe(message) )
+        sensorData->setData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::PROBE_SEQ, message.getArgInt32(3));
+    
+    //the phone also sends its gyro (rad/s) after the accel -- wiimotes don't
+    if( message.getNumArgs() >= 6 )
+    {
+        for(int i= 0; i<3; i++)
+            sensorData->setData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::GYROX+i, message.getArgFloat(3+i));
+    }
+    
+    sensor->addSensorData(sensorData); //hands it to the sensors
+}
+
+//return sensor with id & or create one w/detected id then return that one
+CRCPMotionAnalysis::SensorData *MotusEngine::getSensor( std::string _id, int which )
+{
+
+        bool found = false;
+        int index = 0;
+        
+        while( !found && index < mSensors.size() )
+        {
+            found = mSensors[index]->same( _id, which );
+            index++;
+        }
+    
+        if(found)
+        {
+            return mSensors[index-1];
+        }
+        else
+        {
+            CRCPMotionAnalysis::SensorData *sensor = new CRCPMotionAnalysis::SensorData( _id, which ); //create a sensor
+            mSensors.push_back(sensor);
+            mSensorTimers.push_back( CRCPMotionAnalysis::StatsRegistry::get( "sensor/" + _id + "/update" ) );
+
+            //add to 'entity' the data structure which can combine sensors. the graph config says which body part & ugens it gets
+            int entityID  = mSensors.size()-1;
+            CRCPMotionAnalysis::Entity *entity = new CRCPMotionAnalysis::Entity();
+            entity->addSensorBodyPart(entityID, sensor, mGraphConfig.getGraph(_id) );
+            mEntities.push_back(entity);
+            mFusion.addMember(entity);
+            mOrientation.addMember(entity);
+            return sensor; 
+        }
+}
+
+
+//finds the id of the wiimote then adds the wiidata to ugens
+void MotusEngine::updateWiiValues(const osc::Message &message, double arrival)
+{
+    //get which wii
+    std::string addr = message.getAddress();
+    std::string pt1 = WIIMOTE_ACCEL_MESSAGE_PART1;
+    int index = addr.find_first_of(pt1);
+    std::string whichWii = addr.substr(index+pt1.length(), 1);
+    addPhoneAndWiiData(message, whichWii, arrival);
+}
+
+//replies to a stats query w/ a message per timer: name, count, mean, p50, p99 & max in ms
+void MotusEngine::replyStats(const osc::Message &message)
+{
+    std::string arg = message.getNumArgs() > 0 && message.getArgType(0) == osc::ArgType::STRING ? message.getArgString(0) : "";
+    
+    std::vector<CRCPMotionAnalysis::LatencyHistogram *> timers = CRCPMotionAnalysis::StatsRegistry::all();
+    for(int i=0; i<timers.size(); i++)
+    {
+        osc::Message msg( STATS_ADDR "/timer" );
+        msg.append( timers[i]->getName() );
+        msg.append( (int32_t) timers[i]->getCount() );
+        msg.append( (float) ( timers[i]->getMean() * 1000 ) );
+        msg.append( (float) ( timers[i]->percentile(0.5) * 1000 ) );
+        msg.append( (float) ( timers[i]->percentile(0.99) * 1000 ) );
+        msg.append( (float) ( timers[i]->getMax() * 1000 ) );
+        mSender.send(msg);
+    }
+    
+    osc::Message end( STATS_ADDR "/end" ); //so the asker knows it has them all
+    end.append( (int32_t) timers.size() );
+    mSender.send(end);
+    
+    if( arg == "csv" ) dumpStats();
+    else if( arg == "reset" ) CRCPMotionAnalysis::StatsRegistry::resetAll();
+}
+
+//writes every timer to a csv in the documents folder
+void MotusEngine::dumpStats()
+{
+    fs::path path = getDocumentsDirectory() / STATS_FILE;
+    std::ofstream out( path.string() );
+    if( !out )
+    {
+        CI_LOG_E( "Could not write stats to " << path );
+        return;
+    }
+    CRCPMotionAnalysis::StatsRegistry::writeCSV(out);
+    CI_LOG_I( "Wrote stats to " << path );
+}
+
+//after the frame is drawn, or after update() w/o a window -- if it went over budget, says which stage took the longest
+void MotusEngine::finishFrame()
+{
+    static CRCPMotionAnalysis::LatencyHistogram *frameTimer = CRCPMotionAnalysis::StatsRegistry::get("frame");
+    double frameTime = CRCPMotionAnalysis::StatsRegistry::now() - mFrameStart;
+    CRCPMotionAnalysis::StatsRegistry::record( frameTimer, frameTime );
+    
+    if( frameTime > FRAME_BUDGET )
+    {
+        CRCPMotionAnalysis::LatencyHistogram *slowest = CRCPMotionAnalysis::StatsRegistry::slowestThisFrame(frameTimer);
+        osc::Message msg( STATS_ADDR "/overrun" );
+        msg.append( slowest ? slowest->getName() : std::string("unknown") );
+        msg.append( (float) ( slowest ? slowest->getLast() * 1000 : 0 ) );
+        msg.append( (float) ( frameTime * 1000 ) );
+        mSender.send(msg);
+    }
+    if( mQuality.update(frameTime, mWorkerSeconds) ) reportQuality();
+    CRCPMotionAnalysis::StatsRegistry::beginFrame(); //osc that arrives before the next update counts towards the next frame
+}
+
+//the active quality level -- sent when it changes: level, name, analysis scale, grid size, smoothed load in ms
+void MotusEngine::reportQuality()
+{
+    const QualityLevel &quality = mQuality.getLevel();
+    osc::Message msg( "/motus/quality" );
+    msg.append( (int32_t) mQuality.getLevelIndex() );
+    msg.append( std::string(quality.name) );
+    msg.append( quality.analysisScale );
+    msg.append( (int32_t) quality.gridSize );
+    msg.append( (float) ( mQuality.getLoad() * 1000 ) );
+    mSender.send(msg);
+    std::cout << "quality: " << quality.name << " (" << mQuality.getLoad() * 1000 << "ms a frame" << ( mQuality.isAdaptive() ? "" : ", fixed" ) << ")" << std::endl;
+}
+
+//capture stage, main thread -- one frame from each source, lined up w/ the reference time, copied into a pipeline frame
+//since the sources reuse their surfaces. false if every frame is in flight
+bool MotusEngine::captureSet(double reference)
+{
+    PipelineFrame *frame = mPipeline.acquire();
+    if( !frame )
+    {
+        mSync.skip(); //drop this set
+        return false;
+    }
+
+    frame->views.resize( mSources.size() );
+    int count = 0;
+    for(int i=0; i<mSources.size(); i++)
+    {
+        PipelineView &view = frame->views[count];
+        long seq;
+        if( !mSources[i]->copyClosest( reference, view.surface, seq, view.time ) ) continue; //nothing from it yet
+        view.stage = mSources[i]->getStage();
+        mSync.took( i, seq, view.time - reference );
+        count++;
+    }
+    frame->views.resize(count);
+    if( count == 0 )
+    {
+        mPipeline.release(frame, false);
+        return false;
+    }
+    mSync.finishedSet();
+
+    //the stage at the first sensor's resolution, eg. two side by side are twice as wide
+    PipelineView &first = frame->views[0];
+    ivec2 stageSize( (int) ( first.surface->getWidth() / std::max(0.01f, first.stage.getWidth()) ), (int) ( first.surface->getHeight() / std::max(0.01f, first.stage.getHeight()) ) );
+    mSurface = first.surface;
+    submitCapture(frame, stageSize);
+    return true;
+}
+
+//capture stage for a single surface, eg. a webcam's -- the whole stage
+void MotusEngine::capture(const SurfaceRef &surface)
+{
+    PipelineFrame *frame = mPipeline.acquire();
+    if( !frame ) return; //every frame is in flight -- skip this one
+
+    frame->views.resize(1);
+    PipelineView &view = frame->views[0];
+    if( !view.surface || view.surface->getSize() != surface->getSize() )
+        view.surface = Surface::create( surface->getWidth(), surface->getHeight(), true );
+    view.surface->copyFrom( *surface, surface->getBounds() );
+    view.stage = Rectf( 0, 0, 1, 1 );
+    view.time = CRCPMotionAnalysis::StatsRegistry::now();
+    submitCapture(frame, surface->getSize());
+}
+
+//sizes & quality for the captured frame, then on to the prepare stage
+void MotusEngine::submitCapture(PipelineFrame *frame, ivec2 stageSize)
+{
+    //results are in the output's coordinates -- the stage's if nobody said otherwise
+    ivec2 output = mOutputSize.x > 0 && mOutputSize.y > 0 ? mOutputSize : stageSize;
+    frame->outputWidth = output.x;
+    frame->outputHeight = output.y;
+
+    //the quality level decides how much analysis this frame gets
+    const QualityLevel &quality = mQuality.getLevel();
+    frame->analysisWidth = std::max( 1, (int) ( output.x * quality.analysisScale ) );
+    frame->analysisHeight = std::max( 1, (int) ( output.y * quality.analysisScale ) );
+    frame->gridSize = quality.gridSize;
+    mPipeline.submit(frame);
+}
+
+//prepare stage, worker thread -- converts each view to gray once & resizes it into its part of the stage, the views in
+//parallel, then blurs the stage into the frame's analysis buffer
+void MotusEngine::prepareFrame(PipelineFrame *frame)
+{
+    MOTUS_TIME_SCOPE_OFF_FRAME("cv/prepare");
+    double started = CRCPMotionAnalysis::StatsRegistry::now();
+    cv::Size size( frame->analysisWidth, frame->analysisHeight );
+    frame->analysis.allocate( size.width, size.height );
+    frame->resized.create( size, CV_8UC1 );
+    if( frame->views.size() > 1 ) frame->resized.setTo(0); //stage no sensor sees stays still
+
+    cv::parallel_for_( cv::Range( 0, (int) frame->views.size() ), [&]( const cv::Range &range ){
+        for(int i=range.start; i<range.end; i++)
+        {
+            PipelineView &view = frame->views[i];
+            cv::Rect roi = cv::Rect( (int) ( view.stage.x1 * size.width ), (int) ( view.stage.y1 * size.height ),
+                                     (int) ( view.stage.getWidth() * size.width ), (int) ( view.stage.getHeight() * size.height ) ) & cv::Rect( 0, 0, size.width, size.height );
+            if( roi.area() <= 0 ) continue;
+            view.gray.fromSurface(view.surface);
+            cv::Mat part = frame->resized(roi); //the right size & type already, so resize writes into the stage
+            cv::resize( view.gray.getMat(), part, roi.size() );
+        }
+    });
+    cv::Mat blurred = frame->analysis.getMat();
+    mPrepareTiles.blur(frame->resized, blurred, cv::Size(9,9));
+    frame->prepareSeconds = CRCPMotionAnalysis::StatsRegistry::now() - started;
+}
+
+//differencing w/ the previous frame, or the background model. true if it summed the squares too
+bool MotusEngine::frameDifference(const cv::Mat &curr)
+{
+    if (mBackground.apply(curr, mFrameDiff)) { mMask.apply(mFrameDiff); return false; } //foreground from the background model instead -- it has to see every pixel, so mask after
+    if (!mPrevFrame.data || mPrevFrame.size() != curr.size()) return false; //sizes differ for one frame after a window resize
+
+    //member buffers are only allocated on the first frame (or a resize), after that opencv writes into them.
+    //only the mask's live tiles -- the blur reads its border from outside each rect, so the result is the same as the full frame's
+    mTiles.difference(curr, mPrevFrame, mBlurredFrame, mFrameDiff, mMask.isEnabled() ? &mLiveRects : NULL, mAnalysisSquares);
+    return true;
+}
+
+//analysis stage, worker thread -- masking, differencing & the square sums, which go back to the main thread in the frame
+void MotusEngine::analyzeFrame(PipelineFrame *frame)
+{
+    MOTUS_TIME_SCOPE_OFF_FRAME("cv/analyze");
+    double started = CRCPMotionAnalysis::StatsRegistry::now();
+    std::lock_guard<std::mutex> lock(mAnalysisMutex);
+    cv::Mat curr = frame->analysis.getMat();
+    if( frame->gridSize != mAnalysisGrid || curr.size() != mAnalysisSize ) //quality level or window changed
+    {
+        mAnalysisSquares.divideScreen( frame->gridSize, curr.cols, curr.rows );
+        mAnalysisGrid = frame->gridSize;
+        mAnalysisSize = curr.size();
+    }
+    if( mCaptureReference.exchange(false) ) mBackground.captureReference(curr);
+
+    mMask.compile( curr.cols, curr.rows );
+    mMask.getLiveRects(mLiveRects);
+
+    bool counted = frameDifference(curr);
+    if (mFrameDiff.data) //count the pixels for frame differencing -- partial sums per band, then added up
+    {
+        if (!counted) mTiles.count(mFrameDiff, mMask.isEnabled() ? &mLiveRects : NULL, mAnalysisSquares);
+        mTiles.reduce(mAnalysisSquares);
+    }
+
+    //normalized here, once -- nothing after this needs to know the analysis size
+    mAnalysisSquares.normalize();
+    vector<Square> &squares = mAnalysisSquares.getSquares();
+    frame->squareCounts.resize( squares.size() );
+    frame->squareMotion.resize( squares.size() );
+    for(int i=0; i<squares.size(); i++)
+    {
+        frame->squareCounts[i] = squares[i].getFeatureCount();
+        frame->squareMotion[i] = squares[i].getMotion();
+    }
+    frame->peak = mAnalysisSquares.getPeak();
+    if( mRing.wantsMask() && mFrameDiff.data ) mFrameDiff.copyTo(frame->diff);
+    else frame->diff.release();
+    frame->maskedFraction = mMask.getMaskedFraction();
+
+    curr.copyTo(mPrevFrame); //the pipeline frame gets reused, so keep our own copy to difference with
+    frame->analyzeSeconds = CRCPMotionAnalysis::StatsRegistry::now() - started;
+}
+
+//send stage, main thread -- osc for the analyzed frames, & the newest one is what draw() shows next
+void MotusEngine::sendFrameResults()
+{
+    MOTUS_TIME_SCOPE("cv/send");
+    PipelineFrame *frame;
+    while( ( frame = mPipeline.takeResult() ) != NULL )
+    {
+        ivec2 output( frame->outputWidth, frame->outputHeight );
+        if( frame->gridSize != mDisplayGrid || output != mDisplaySize ) //the squares in output coordinates, same layout as the analysis'
+        {
+            squareDiff.divideScreen( frame->gridSize, output.x, output.y );
+            mDisplayGrid = frame->gridSize;
+            mDisplaySize = output;
+        }
+        vector<Square> &squares = squareDiff.getSquares();
+        if( frame->squareMotion.size() == squares.size() )
+        {
+            for(int i=0; i<squares.size(); i++)
+            {
+                squares[i].setFeatureCount( frame->squareCounts[i] ); //at the analysis size
+                squares[i].setMotion( frame->squareMotion[i] );
+            }
+            mBinaryGridFrame = frame->index;
+        }
+        if( !frame->diff.empty() ) cv::swap( mRingDiff, frame->diff ); //the frame keeps the old buffer to fill next time
+        mWorkerSeconds = std::max( frame->prepareSeconds, frame->analyzeSeconds );
+
+        //how much of the frame we skip -- sent when it changes, eg. someone walks out of the depth band
+        if( std::fabs(frame->maskedFraction - mReportedMasked) >= 0.01f )
+        {
+            static const CRCPMotionAnalysis::OscAddress maskedAddr( "/motus/masked", "f" );
+            float args[1] = { frame->maskedFraction };
+            mPacket.append( maskedAddr, args, 1 );
+            mReportedMasked = frame->maskedFraction;
+        }
+
+        //motion fraction & the square's center, all in [0,1]
+        sendSquareOSC( "/mocap/square", motionFixedToFloat(frame->peak.motion), motionFixedToFloat(frame->peak.x), motionFixedToFloat(frame->peak.y) );
+        mPipeline.stamp(frame, PipelineFrame::SENT);
+
+        if( !mRendering ) //headless -- sending the osc was the last stage
+        {
+            mPipeline.stamp(frame, PipelineFrame::RENDERED);
+            mPipeline.release(frame);
+            continue;
+        }
+        if( mRenderFrame ) mPipeline.release(mRenderFrame, false); //never got drawn
+        mRenderFrame = frame;
+    }
+
+    //latency once a second -- capture to screen, analysis & frames dropped, in ms
+    if( seconds - mLastLatencyReport >= 1.0 )
+    {
+        static const CRCPMotionAnalysis::OscAddress latencyAddr( "/motus/latency", "ffff" );
+        float args[4] = { (float) ( mPipeline.getLatency() * 1000 ), (float) ( mPipeline.getStageLatency(PipelineFrame::PREPARED) * 1000 ),
+                          (float) ( mPipeline.getStageLatency(PipelineFrame::ANALYZED) * 1000 ), (float) mPipeline.getDropped() };
+        mPacket.append( latencyAddr, args, 4 );
+        mLastLatencyReport = seconds;
+    }
+}
+
+void MotusEngine::sendSquareOSC( string address, float maxSquareMotion, float maxSquareX, float maxSquareY ) //sends Osc messages containing square values
+{
+    static const CRCPMotionAnalysis::OscAddress squareAddr( "/mocap/square", "fff" );
+    
+    //cout << "maxMotion: " << maxSquareMotion << " maxX: " << maxSquareY << " maxY: " << maxSquareY << endl;
+    
+    if( address == "/mocap/square" ) mPacket.append( squareAddr, maxSquareMotion, maxSquareX, maxSquareY );
+    else
+    {
+        CRCPMotionAnalysis::OscAddress addr( address.c_str(), "fff" );
+        mPacket.append( addr, maxSquareMotion, maxSquareX, maxSquareY );
+    }
+}
+
+//an encoded packet, skipping osc::Message entirely -- split up for the subscribers & sent at the end of the frame
+void MotusEngine::sendPacket(const uint8_t *data, size_t size)
+{
+    mFanout.add(data, size);
+}
+
+//adds, changes or removes an osc subscriber: host, port, [patterns, space separated], [frames a second], [max datagram bytes]
+//binary subscribers: host, port, [frames a second]
+void MotusEngine::updateSubscription(const osc::Message &message, bool subscribe, bool binary)
+{
+    if( message.getNumArgs() < 2 || message.getArgType(0) != osc::ArgType::STRING || message.getArgType(1) != osc::ArgType::INTEGER_32 )
+    {
+        CI_LOG_W( message.getAddress() << " needs a host & port" );
+        return;
+    }
+    std::string host = message.getArgString(0);
+    int port = message.getArgInt32(1);
+    if( !subscribe )
+    {
+        if( !mFanout.unsubscribe(host, port) ) CI_LOG_W( "No osc subscriber " << host << ":" << port );
+        return;
+    }
+    if( binary )
+    {
+        double rate = message.getNumArgs() > 2 && message.getArgType(2) == osc::ArgType::FLOAT ? message.getArgFloat(2) : 0;
+        mFanout.subscribe( host, port, std::vector<std::string>(), rate, OSC_PACKET_MAX, true );
+        return;
+    }
+
+    std::string patterns = message.getNumArgs() > 2 && message.getArgType(2) == osc::ArgType::STRING ? message.getArgString(2) : "";
+    double rate = message.getNumArgs() > 3 && message.getArgType(3) == osc::ArgType::FLOAT ? message.getArgFloat(3) : 0;
+    int bundle = message.getNumArgs() > 4 && message.getArgType(4) == osc::ArgType::INTEGER_32 ? message.getArgInt32(4) : OSC_PACKET_MAX;
+    mFanout.subscribe( host, port, CRCPMotionAnalysis::OscFanout::splitPatterns(patterns), rate, bundle );
+}
+
+//the newest sample of one of an entity's nodes, x y z into out. false if it doesn't have the node or it's empty
+bool MotusEngine::binaryField(CRCPMotionAnalysis::Entity *entity, const char *node, float *out, float &time)
+{
+    CRCPMotionAnalysis::SignalAnalysis *ugen = entity->getNode(node);
+    CRCPMotionAnalysis::MocapDeviceData *d = ugen ? ugen->getNewest() : NULL;
+    if( !d ) return false;
+    out[0] = d->getData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::ACCELX);
+    out[1] = d->getData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::ACCELY);
+    out[2] = d->getData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::ACCELZ);
+    time = std::max( time, (float) d->getData(CRCPMotionAnalysis::MocapDeviceData::DataIndices::TIME_STAMP) );
+    return true;
+}
+
+//every entity's state & the motion grid in one binary datagram -- only built when a binary subscriber takes this frame,
+//or there's a shared memory ring
+void MotusEngine::sendBinaryFrame()
+{
+    if( !mFanout.wantsBinary() && !mRing.isOpen() ) return;
+    MOTUS_TIME_SCOPE("binary/encode");
+    mBinary.begin(mFrameStart);
+
+    for(int i=0; i<mEntities.size() && i<BINARY_MAX_ENTITIES; i++)
+    {
+        CRCPMotionAnalysis::BinaryEntity e;
+        e.id = (uint16_t) mEntities[i]->getID();
+        if( binaryField( mEntities[i], "resample", e.raw, e.time ) ) e.valid |= CRCPMotionAnalysis::BINARY_RAW;
+        if( binaryField( mEntities[i], "avg", e.smooth, e.time ) || binaryField( mEntities[i], "smooth", e.smooth, e.time ) ) e.valid |= CRCPMotionAnalysis::BINARY_SMOOTH;
+        if( binaryField( mEntities[i], "der1", e.der1, e.time ) ) e.valid |= CRCPMotionAnalysis::BINARY_DER1;
+        if( binaryField( mEntities[i], "der2", e.der2, e.time ) ) e.valid |= CRCPMotionAnalysis::BINARY_DER2;
+        if( i < mOrientation.getMemberCount() && !mOrientation.getBuffer(i).empty() ) //entities & orientation members are added together
+        {
+            ci::vec4 q = mOrientation.getOrientation(i);
+            e.orientation[0] = q.x; e.orientation[1] = q.y; e.orientation[2] = q.z; e.orientation[3] = q.w;
+            e.valid |= CRCPMotionAnalysis::BINARY_ORIENTATION;
+        }
+        mBinary.addEntity(e);
+    }
+
+    //the squares are column major, the frame's grid is row major
+    vector<Square> &squares = squareDiff.getSquares();
+    int n = mDisplayGrid;
+    uint16_t peakCell = BINARY_NO_PEAK, peakMotion = 0;
+    if( n > 0 && squares.size() == n * n )
+    {
+        mBinaryGrid.resize( n * n );
+        for(int i=0; i<squares.size(); i++)
+            mBinaryGrid[ ( i % n ) * n + i / n ] = (uint16_t) std::min( std::max( squares[i].getMotion(), 0 ), 0xFFFF );
+        mBinary.setGrid( n, n, mBinaryGrid.data() );
+
+        MotionPeak peak = squareDiff.getPeak();
+        if( peak.square >= 0 )
+        {
+            peakCell = ( peak.square % n ) * n + peak.square / n;
+            peakMotion = (uint16_t) std::min( peak.motion, 0xFFFF );
+        }
+    }
+    mBinary.finish( peakCell, peakMotion, (uint32_t) mBinaryGridFrame );
+    mFanout.addBinary( mBinary.data(), mBinary.getSize() );
+    if( mRing.isOpen() ) mRing.publish( mBinary.data(), mBinary.getSize(), mRingDiff.empty() ? NULL : &mRingDiff );
+}
+
+//update entities and ugens and send OSC, if relevant
+void MotusEngine::update()
+{
+    mFrameStart = CRCPMotionAnalysis::StatsRegistry::now();
+    mFanout.beginFrame(mFrameStart); //which subscribers get this frame
+    dispatchReceived(); //the osc that came in since the last update, before the sensors update
+    
+    astra_status_t status;
+    {
+        MOTUS_TIME_SCOPE("astra/update"); //the listener's callback runs in here
+        status = astra_temp_update();
+    }
+    
+    //astras got their frames in the update -- the threaded sources have been filling theirs all along
+    for(int i=0; i<mSources.size(); i++) mSources[i]->poll();
+
+    //checks if there is a new frame set, if so, updates the surface & starts it down the pipeline
+    double reference;
+    newFrame = false;
+    if( mSync.ready( CRCPMotionAnalysis::StatsRegistry::now(), reference ) )
+    {
+        MOTUS_TIME_SCOPE("cv/capture");
+        newFrame = captureSet(reference);
+    }
+    
+    if( mPrimaryAstra ) mPrimaryAstra->getListener().getPointCloud().appendOSC(mPacket); //3D positions from every depth frame since the last update
+    
+    seconds = elapsed(); //clock the time update is called to sync incoming messages
+    
+    //re-wire the ugens if the graph file was edited
+    if( mGraphConfig.checkForChanges(seconds) )
+    {
+        for(int i=0; i<mEntities.size(); i++)
+            mEntities[i]->rebuild(mGraphConfig);
+    }
+    
+//    if(mPrevFrame.data){
+//        mDiffFrame = frameDifference();
+//    }
+
+    //update sensors
+    for(int i=0; i<mSensors.size(); i++)
+    {
+        {
+            CRCPMotionAnalysis::ScopedTimer timer( mSensorTimers[i] );
+            mSensors[i]->update(seconds);
+        }
+        mProbe.traceSensor(mSensors[i]);
+    }
+    //update all entities -- each of their ugens is timed on its own
+    for(int i=0; i<mEntities.size(); i++)
+    {
+        mEntities[i]->update(seconds);
+        mProbe.traceEntity(mSensors[i], mEntities[i], mPacket); //entities are made w/ their sensor, so same order
+    }
+
+    {
+        MOTUS_TIME_SCOPE("fusion/update");
+        mFusion.update(seconds); //after the entities, it reads their resampled streams
+    }
+    {
+        MOTUS_TIME_SCOPE("orientation/update");
+        mOrientation.update(seconds); //same
+    }
+    
+    //send OSC from the entities -- after all are updated..
+    for(int i=0; i<mEntities.size(); i++)
+    {
+        mEntities[i]->appendOSC(mPacket);
+    }
+    mFusion.appendOSC(mPacket);
+    mOrientation.appendOSC(mPacket);
+    
+    //framedifferencing -- whatever the pipeline finished since the last update
+    sendFrameResults();
+    sendBinaryFrame();
+    
+    mPacket.flush(); //the rest of this frame's messages...
+    {
+        MOTUS_TIME_SCOPE("osc/send");
+        mFanout.send(); //...& out to everyone
+    }
+    
+    checkMocapMemory();
+    
+
+}
+
+//tracks MocapDeviceData held outside the sensor buffers. 'm' reports its net growth per frame, which should be 0
+void MotusEngine::checkMocapMemory()
+{
+    long live = CRCPMotionAnalysis::MocapDeviceData::getLiveCount();
+    long buffered = 0;
+    for(int i=0; i<mSensors.size(); i++)
+        buffered += mSensors[i]->getBufferedCount();
+    
+    mUnownedCount = live - buffered; //what the ugens hold -- bounded by their buffer sizes, so this shouldn't trend up
+    if( mFramesCounted == 0 ) mUnownedAtReport = mUnownedCount;
+    mFramesCounted++;
+}
@@ -0,0 +1,269 @@
+//
+//  MotusEngine.h
+//  Motus
+//
+//  Everything Motus does besides drawing: the osc in & out, the sensors & their ugen graphs, the astra capture &
+//  the frame analysis pipeline. MotusApp puts a window on it, & MotusServer runs it headless on a machine w/o a
+//  display -- so nothing in here may touch the window or gl.
+//  Sizes come from the output size -- the window's, or the sensor's when there's no window -- never from the window.
+//  Frames come from one or more sources (FrameSource.h), synchronized into sets & analyzed as one stage.
+//
+
+#ifndef MotusEngine_h
+#define MotusEngine_h
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "cinder/Json.h"
+#include "cinder/Log.h"
+#include "cinder/Surface.h"
+#include "cinder/Utilities.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "CinderOpenCV.h"
+
+#include "Osc.h"
+
+#include "MotionCaptureData.h"
+#include "Sensor.h"
+#include "OscPacket.h"
+#include "OscFanout.h"
+#include "BinaryFrame.h"
+#include "SharedFrameRing.h"
+#include "Stats.h"
+#include "UGENs.h"
+#include "FilterBank.h"
+#include "GestureFeatures.h"
+#include "SpectralAnalysis.h"
+#include "ProcessingGraph.h"
+#include "MeasuredEntities.h"
+#include "Orientation.h"
+#include "LatencyProbe.h"
+#include "SquareGenerator.hpp"
+
+//orbbec stuff
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include "Astra.h"
+#include "FrameSource.h"
+
+#include "FramePool.h"
+#include "BackgroundModel.h"
+#include "TiledAnalysis.h"
+#include "FramePipeline.h"
+#include "QualityController.h"
+
+
+#define LOCALPORT 8886
+#define LOCALPORT2 8887
+#define DESTHOST "127.0.0.1"
+#define DESTPORT 8888
+#define MAX_CORNERS 300 //sets up a constant
+#define QUALITY_LEVEL 0.005 //whatever corner you find is good
+#define MIN_DISTANCE 3 //how far away the corners have to be from each other
+#define ELAPSED_FRAMES 300 //number of elapsed frames to check features
+
+#define NUMBER_OF_SQUARES 20
+#define ANALYSIS_THREADS 8 //caps opencv's thread pool -- the show machine has 8 cores
+
+//osc messages
+#define ACCEL_ADDR "/wii/accel"
+#define SYNTIEN_MESSAGE "/syntien/motion/1/scope1"
+#define WIIMOTE_ACCEL_MESSAGE_PART1 "/wii/"
+#define WIIMOTE_ACCEL_MESSAGE_PART2 "/accel/pry"
+#define WIIMOTE_BUTTON_1 "/wii/1/button/1"
+
+#define MAX_NUM_OF_WIIMOTES 6 //limitation of bluetooth class 2
+#define PHONE_ID "7" //this assumes only one phone using Syntien or some such -- can modify if you have more...
+
+#define GRAPH_FILE "graph.json" //ugen graph description, in assets/. edits are picked up while running
+#define MASK_FILE "mask.json" //regions of interest & depth band, in assets/
+#define SOURCES_FILE "sources.json" //the sensors & where they are on the stage, in assets/
+#define OUTPUTS_FILE "outputs.json" //who the osc goes to, in assets/. none means DESTHOST:DESTPORT gets everything
+#define STATS_FILE "motus_stats.csv" //timer dump, in the documents folder
+
+#define SUBSCRIBE_ADDR "/motus/subscribe" //host, port, [patterns, space separated], [frames a second], [max datagram bytes]
+#define SUBSCRIBE_BINARY_ADDR "/motus/subscribe/binary" //host, port, [frames a second] -- the binary frame instead of osc
+#define UNSUBSCRIBE_ADDR "/motus/unsubscribe" //host, port
+#define STATS_ADDR "/motus/stats" //query -- replies w/ every timer. an arg of "reset" clears them after, "csv" dumps them too
+#define FRAME_BUDGET (1.0/60.0) //seconds of update + draw. longer frames report the stage that took the longest
+
+#define SAMPLE_WINDOW_MOD 300
+#define MAX_FEATURES 300
+
+using namespace ci;
+using namespace std;
+
+using Receiver = osc::ReceiverUdp;
+using protocol = asio::ip::udp;
+
+class MotusEngine
+{
+public:
+    //the osc sender runs on io -- the app's, or the server's own. the receiver runs on the engine's own thread
+    MotusEngine(asio::io_service &io);
+    ~MotusEngine();
+
+    //starts the sensors, binds the osc & starts the pipeline. false if a port couldn't be bound
+    //no sources file means the one default astra, no outputs file the one default destination
+    bool setup(const fs::path &graphFile, const fs::path &maskFile, const fs::path &sourcesFile = fs::path(), const fs::path &outputsFile = fs::path());
+
+    //one frame: astra, sensors, ugens & whatever the pipeline finished -- sent as osc
+    void update();
+    //after the frame is done, drawn or not -- frame time, the budget & the quality level
+    void finishFrame();
+
+    //a frame from some other source, eg. a webcam -- the whole stage
+    void capture(const SurfaceRef &surface);
+
+    //the coordinates squares are reported in, eg. the window's. 0 x 0 -> the stage at the first sensor's resolution
+    inline void setOutputSize(ivec2 size){ mOutputSize = size; };
+
+    //w/o a renderer, frames are done as soon as their osc is sent
+    inline void setRendering(bool r){ mRendering = r; };
+
+    //the newest analyzed frame, for the renderer to upload. hand it back w/ rendered()
+    PipelineFrame *takeRenderFrame();
+    void rendered(PipelineFrame *frame);
+
+    //the first sensor's view of the newest frame set, if there was one this update
+    inline bool hasNewFrame(){ return newFrame; };
+    //if any osc was handled this update
+    inline bool hasNewOSC(){ return mDispatched > 0; };
+    inline SurfaceRef getSurface(){ return mSurface; };
+
+    inline SquareFrameDiff &getSquares(){ return squareDiff; };
+    inline QualityController &getQuality(){ return mQuality; };
+    std::vector<CRCPMotionAnalysis::Entity *> &getEntities(){ return mEntities; };
+
+    //the keyboard commands -- the app's keys, or typed into the server
+    void handleKey(char key);
+
+    //seconds since the engine started
+    inline double elapsed(){ return std::chrono::duration<double>( std::chrono::steady_clock::now() - mClockStart ).count(); };
+
+protected:
+    std::chrono::steady_clock::time_point mClockStart;
+    SurfaceRef                 mSurface;
+    ivec2 mOutputSize;
+    bool mRendering = true;
+
+    //analysis stage -- only touched on the pipeline's analysis thread, or w/ mAnalysisMutex held
+    std::mutex mAnalysisMutex;
+    cv::Mat mPrevFrame, mFrameDiff;
+    cv::Mat mBlurredFrame; //scratch buffer, reused every frame
+    BackgroundModel mBackground; //background subtraction, when not differencing with the previous frame
+    AnalysisMask mMask; //tiles outside the stage / depth band are skipped
+    vector<cv::Rect> mLiveRects; //the mask's live tiles this frame
+    TiledFrameDiff mTiles; //runs the differencing & square sums a band per core
+    SquareFrameDiff mAnalysisSquares; //the analysis thread's squares -- copied to squareDiff w/ each result
+    std::atomic<bool> mCaptureReference{false}; //take the next analyzed frame as the static reference
+
+    int mAnalysisGrid = 0; //the layout of mAnalysisSquares -- redone when a frame asks for another
+    cv::Size mAnalysisSize;
+
+    //prepare stage -- only touched on the pipeline's prepare thread
+    TiledFrameDiff mPrepareTiles;
+
+    FramePipeline mPipeline; //capture -> prepare -> analyze -> send & render. declared after what its stages use
+    PipelineFrame *mRenderFrame = NULL; //newest analyzed frame, waiting for the renderer
+    float mReportedMasked = -1; //masked fraction we last sent
+    QualityController mQuality{ FRAME_BUDGET, NUMBER_OF_SQUARES }; //trades analysis quality for frame rate under load
+    double mWorkerSeconds = 0; //slowest worker stage of the newest analyzed frame
+    int mDisplayGrid = 0; //the layout of squareDiff
+    ivec2 mDisplaySize;
+    void reportQuality();
+    double mLastLatencyReport = 0;
+
+    osc::SenderUdp             mSender; //its socket sends everything. replies to queries still go to its one destination
+    CRCPMotionAnalysis::OscPacketWriter mPacket; //everything sent each frame goes out as bundles from this one buffer...
+    CRCPMotionAnalysis::OscFanout mFanout; //...to each subscriber, filtered
+    void sendPacket(const uint8_t *data, size_t size);
+    void updateSubscription(const osc::Message &message, bool subscribe, bool binary = false);
+
+    CRCPMotionAnalysis::BinaryFrameWriter mBinary; //the binary frame, for subscribers that want all of it
+    std::vector<uint16_t> mBinaryGrid; //scratch -- the display squares' motion, row major
+    long mBinaryGridFrame = 0; //the analyzed frame the display squares are from
+    void sendBinaryFrame();
+    bool binaryField(CRCPMotionAnalysis::Entity *entity, const char *node, float *out, float &time);
+    CRCPMotionAnalysis::SharedFrameRing mRing; //...& the same frame into shared memory, for consumers on this machine
+    cv::Mat mRingDiff; //the newest analyzed difference image, when the ring takes it
+
+     SquareFrameDiff squareDiff;
+
+    void sendOSC(std::string addr,  float posX, float posY, float vel, float acc);
+
+    //osc in -- received & stamped on its own thread, so a sample's time is when it came off the socket, not when
+    //update() got round to it. handled on the main thread at the start of update(), in the order it arrived.
+    //still a user space stamp: the thread's wake up is in it, & a packet's samples come microseconds apart whatever their
+    //real spacing -- ties are spaced out by the Resampler (UGENs.h), none are dropped
+    typedef std::function<void( const osc::Message &message, double arrival )> ReceiveFn;
+    struct Received
+    {
+        osc::Message message;
+        double arrival; //elapsed() as it came off the socket
+        int handler; //into mHandlers
+    };
+    asio::io_service mReceiveIo; //before mReceiver, which runs on it
+    Receiver mReceiver;
+    std::thread mReceiveThread;
+    std::vector<ReceiveFn> mHandlers; //only added to in setup(), before the thread starts
+    std::mutex mReceivedMutex;
+    std::vector<Received> mReceived; //waiting for update() -- w/ mReceivedMutex held
+    std::vector<Received> mReceiving; //main thread's, swapped w/ mReceived so the lock isn't held while handling
+    int mDispatched = 0;
+    void receive(const std::string &address, ReceiveFn handler);
+    void dispatchReceived();
+
+    void updatePhoneValues(const osc::Message &message, double arrival);
+    void updateWiiValues(const osc::Message &message, double arrival);
+    void addPhoneAndWiiData(const osc::Message &message, std::string _id, double arrival);
+
+    CRCPMotionAnalysis::SensorData *getSensor( std::string _id, int which ); // find sensor or wiimote in list via id
+    std::vector<CRCPMotionAnalysis::SensorData *> mSensors; //all the sensors which have sent us OSC -- well only wiimotes so far
+    std::vector<CRCPMotionAnalysis::LatencyHistogram *> mSensorTimers; //times each sensor's update, same order as mSensors
+    std::vector<CRCPMotionAnalysis::Entity *> mEntities;  //who are we measuring? change name when specifics are known.
+    CRCPMotionAnalysis::GraphConfig mGraphConfig; //which ugens each sensor gets
+    CRCPMotionAnalysis::FusionEntity mFusion; //cross-sensor features over all the entities
+    CRCPMotionAnalysis::OrientationEntity mOrientation; //quaternions & linear accel of the sensors w/ gyros
+    CRCPMotionAnalysis::LatencyProbe mProbe; //injects tagged samples & times them out to the synth's port
+
+    float seconds;
+    bool newFrame = false;
+
+    //MocapDeviceData accounting -- sensors hold at most SENSORDATA_BUFFER_SIZE each, so past that the count should stay flat
+    long mUnownedCount = 0; //MocapDeviceData not held by a sensor, ie. held by the ugens
+    long mUnownedAtReport = 0; //...as of the start of this report period
+    int mFramesCounted = 0;
+    void checkMocapMemory();
+
+    //stage timing
+    double mFrameStart = 0; //when this frame's update() started, on the stats clock
+    void replyStats(const osc::Message &message);
+    void dumpStats();
+
+    //frame sources -- synchronized into one set per pipeline frame
+    std::vector<FrameSource *> mSources;
+    AstraSource *mPrimaryAstra = NULL; //the first astra -- its point cloud goes out as osc, & its depth feeds the mask
+    FrameSync mSync;
+    void loadSources(const fs::path &path);
+    bool captureSet(double reference);
+    void submitCapture(PipelineFrame *frame, ivec2 stageSize);
+
+    void prepareFrame(PipelineFrame *frame);
+    void analyzeFrame(PipelineFrame *frame);
+    bool frameDifference(const cv::Mat &curr);
+    void sendFrameResults();
+    void sendSquareOSC(string address, float maxSquareMotion, float maxSquareX, float maxSquareY );
+};
+
+#endif /* MotusEngine_h */
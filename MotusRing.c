@@ -0,0 +1,239 @@
+/*
+ * MotusRing.c
+ * Motus
+ *
+ * The shared-memory ring's reader -- see MotusRing.h. The engine's side is SharedFrameRing.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* kill & shm_open aren't declared under -std=c99 otherwise */
+
+#include "MotusRing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MOTUS_RING_RETRIES 4 /* times a read starts over when the engine laps it */
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t) ( p[0] | ( p[1] << 8 ) );
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ( (uint32_t) p[1] << 8 ) | ( (uint32_t) p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+}
+
+static float getFloat(const uint8_t *p)
+{
+    uint32_t v = get32(p);
+    float f;
+    memcpy(&f, &v, 4);
+    return f;
+}
+
+static const MotusRingSlot *slotOf(const MotusRingReader *ring, uint64_t frame)
+{
+    const MotusRingHeader *h = ring->header;
+    return (const MotusRingSlot *) ( ring->base + h->headerSize + ( frame % h->slotCount ) * h->slotSize );
+}
+
+int motus_ring_open(MotusRingReader *ring, const char *name)
+{
+    struct stat st;
+    const MotusRingHeader *h;
+
+    memset(ring, 0, sizeof(MotusRingReader));
+    ring->fd = shm_open(name, O_RDONLY, 0);
+    if( ring->fd < 0 ) return -1;
+    if( fstat(ring->fd, &st) != 0 || (size_t) st.st_size < sizeof(MotusRingHeader) )
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        errno = EINVAL;
+        return -1;
+    }
+
+    ring->size = (size_t) st.st_size;
+    ring->base = (uint8_t *) mmap(NULL, ring->size, PROT_READ, MAP_SHARED, ring->fd, 0);
+    if( ring->base == MAP_FAILED )
+    {
+        ring->base = NULL;
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    /* the engine writes the magic last, so a ring still being set up reads as not there yet */
+    h = (const MotusRingHeader *) ring->base;
+    if( __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != MOTUS_RING_MAGIC || h->version != MOTUS_RING_VERSION || h->slotCount == 0 ||
+        h->slotSize < sizeof(MotusRingSlot) + h->frameMax + h->maskMax || h->headerSize + (size_t) h->slotCount * h->slotSize > ring->size )
+    {
+        motus_ring_close(ring);
+        errno = EAGAIN;
+        return -1;
+    }
+    ring->header = h;
+    ring->last = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void motus_ring_close(MotusRingReader *ring)
+{
+    if( ring->base ) munmap(ring->base, ring->size);
+    if( ring->fd >= 0 ) close(ring->fd);
+    memset(ring, 0, sizeof(MotusRingReader));
+    ring->fd = -1;
+}
+
+int motus_ring_alive(const MotusRingReader *ring)
+{
+    if( !ring->header || __atomic_load_n(&ring->header->closed, __ATOMIC_ACQUIRE) ) return 0;
+    return kill(ring->header->writerPid, 0) == 0 || errno == EPERM; /* crashed engines don't get to close the ring */
+}
+
+int motus_ring_acquire(MotusRingReader *ring, MotusRingView *view)
+{
+    const MotusRingHeader *h = ring->header;
+    int attempt;
+    if( !h || __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE) ) return -1;
+
+    for(attempt = 0; attempt < MOTUS_RING_RETRIES; attempt++)
+    {
+        uint64_t published = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+        uint64_t frame;
+        const MotusRingSlot *slot;
+        const uint8_t *data;
+        uint64_t seq;
+        uint32_t size, offset;
+        uint16_t w, hgt;
+
+        if( published == 0 || published == ring->last ) return 0;
+        frame = published - 1;
+        slot = slotOf(ring, frame);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if( seq != 2 * frame + 2 ) continue; /* already being overwritten -- a newer frame is on its way */
+
+        /* the sizes are in the slot too, so they're checked like the data is */
+        size = slot->frameSize;
+        w = slot->maskWidth;
+        hgt = slot->maskHeight;
+        offset = slot->maskOffset;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if( __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq ) continue;
+        if( size > h->frameMax ) continue;
+
+        data = (const uint8_t *) slot + sizeof(MotusRingSlot);
+        view->frame = frame;
+        view->seq = seq;
+        view->data = data;
+        view->size = size;
+        view->mask = NULL;
+        view->maskWidth = view->maskHeight = 0;
+        if( w > 0 && hgt > 0 && (uint64_t) offset + (uint64_t) w * hgt <= h->frameMax + h->maskMax )
+        {
+            view->mask = data + offset;
+            view->maskWidth = w;
+            view->maskHeight = hgt;
+        }
+
+        ring->missed += frame - ring->last; /* published since this reader's last frame, less the one it's getting */
+        ring->last = published;
+        return 1;
+    }
+    return 0;
+}
+
+int motus_ring_valid(const MotusRingReader *ring, const MotusRingView *view)
+{
+    const MotusRingSlot *slot = slotOf(ring, view->frame);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); /* the caller's reads through the view happen before this check */
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == view->seq;
+}
+
+int motus_ring_read(MotusRingReader *ring, uint8_t *frame, size_t frameCapacity, uint8_t *mask, size_t maskCapacity, MotusRingView *view)
+{
+    int attempt;
+    for(attempt = 0; attempt < MOTUS_RING_RETRIES; attempt++)
+    {
+        MotusRingView v;
+        size_t maskSize;
+        int got = motus_ring_acquire(ring, &v);
+        if( got != 1 ) return got;
+        if( v.size > frameCapacity )
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        memcpy(frame, v.data, v.size);
+        maskSize = (size_t) v.maskWidth * v.maskHeight;
+        if( mask && v.mask && maskSize <= maskCapacity ) memcpy(mask, v.mask, maskSize);
+        else maskSize = 0;
+
+        if( motus_ring_valid(ring, &v) )
+        {
+            *view = v;
+            view->data = frame;
+            view->mask = maskSize > 0 ? mask : NULL;
+            if( maskSize == 0 ) view->maskWidth = view->maskHeight = 0;
+            return 1;
+        }
+        ring->last = v.frame; /* torn -- let acquire hand out the newest again */
+    }
+    return 0;
+}
+
+int motus_frame_parse(const uint8_t *data, uint32_t size, MotusFrameInfo *info)
+{
+    uint32_t headerSize, frameSize, entityBytes, gridBytes;
+    uint64_t t;
+    if( size < 40 || memcmp(data, "MOTS", 4) != 0 || get16(data + 4) != 1 ) return -1;
+
+    headerSize = get16(data + 6);
+    frameSize = get32(data + 12);
+    info->sequence = get32(data + 8);
+    t = (uint64_t) get32(data + 16) | ( (uint64_t) get32(data + 20) << 32 );
+    memcpy(&info->time, &t, 8);
+    info->entityCount = get16(data + 24);
+    info->entitySize = get16(data + 26);
+    info->gridWidth = get16(data + 28);
+    info->gridHeight = get16(data + 30);
+    info->peakCell = get16(data + 32);
+    info->peakMotion = get16(data + 34);
+    info->gridFrame = get32(data + 36);
+
+    entityBytes = (uint32_t) info->entityCount * info->entitySize;
+    gridBytes = 2u * info->gridWidth * info->gridHeight;
+    if( info->entitySize < 72 || frameSize > size || headerSize + entityBytes + gridBytes > frameSize ) return -1;
+    info->entities = data + headerSize;
+    info->grid = info->entities + entityBytes;
+    return 0;
+}
+
+void motus_frame_entity(const MotusFrameInfo *info, int i, MotusEntityState *entity)
+{
+    const uint8_t *e = info->entities + (size_t) i * info->entitySize;
+    int k;
+    entity->id = get16(e);
+    entity->valid = get16(e + 2);
+    entity->time = getFloat(e + 4);
+    for(k = 0; k < 3; k++)
+    {
+        entity->raw[k] = getFloat(e + 8 + 4 * k);
+        entity->smooth[k] = getFloat(e + 20 + 4 * k);
+        entity->der1[k] = getFloat(e + 32 + 4 * k);
+        entity->der2[k] = getFloat(e + 44 + 4 * k);
+    }
+    for(k = 0; k < 4; k++) entity->orientation[k] = getFloat(e + 56 + 4 * k);
+}
+
+float motus_frame_cell(const MotusFrameInfo *info, int x, int y)
+{
+    if( x < 0 || y < 0 || x >= info->gridWidth || y >= info->gridHeight ) return 0;
+    return get16( info->grid + 2 * ( (size_t) y * info->gridWidth + x ) ) / 65535.0f;
+}
@@ -0,0 +1,145 @@
+/*
+ * MotusRing.h
+ * Motus
+ *
+ * Reads the engine's frames from shared memory, for consumers on the same machine -- no socket, no parsing of osc,
+ * & the frame is read where the engine wrote it. Plain C, so anything w/ a C ffi can use it: build MotusRing.c
+ * into the consumer (cc -c MotusRing.c, & -lrt on older linux).
+ *
+ * The engine publishes one slot per frame into a ring of slots & never waits on readers. Each slot has a sequence
+ * word that's odd while it's being written, so a reader checks the word again after reading & knows if the slot was
+ * overwritten under it. Any number of readers, none of them write to the ring.
+ *
+ *   MotusRingReader ring;
+ *   MotusRingView view;
+ *   MotusFrameInfo frame;
+ *   if( motus_ring_open(&ring, MOTUS_RING_NAME) != 0 ) ...
+ *   while( running )
+ *   {
+ *       if( motus_ring_acquire(&ring, &view) == 1 && motus_frame_parse(view.data, view.size, &frame) == 0 )
+ *       {
+ *           float x = motus_frame_cell(&frame, 3, 4); ...                   <-- straight out of the ring
+ *           if( !motus_ring_valid(&ring, &view) ) ...                       <-- overwritten meanwhile, drop what was read
+ *       }
+ *   }
+ *   motus_ring_close(&ring);
+ *
+ * The slot holds the binary frame (BinaryFrame.h has the layout) & optionally the difference image, 8 bit gray.
+ * With MOTUS_RING_SLOTS slots at 60 frames a second a reader has over 100ms to finish w/ a view.
+ */
+
+#ifndef MotusRing_h
+#define MotusRing_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOTUS_RING_NAME "/motus" /* shm_open name, the default the engine publishes to */
+#define MOTUS_RING_MAGIC 0x52544F4Du /* "MOTR" */
+#define MOTUS_RING_VERSION 1
+#define MOTUS_RING_SLOTS 8
+#define MOTUS_RING_FRAME_MAX 4096 /* bytes of binary frame a slot holds */
+#define MOTUS_RING_MASK_MAX_WIDTH 320 /* larger difference images are shrunk to fit */
+#define MOTUS_RING_MASK_MAX_HEIGHT 240
+#define MOTUS_RING_ALIGN 64 /* slots start on their own cache lines */
+
+/* at the start of the segment, written once when the engine opens it -- except published & closed */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize; /* where slot 0 starts */
+    uint32_t slotCount;
+    uint32_t slotSize; /* bytes, slot header included */
+    uint32_t frameMax;
+    uint32_t maskMax; /* bytes of difference image a slot holds, 0 if the engine doesn't send it */
+    int32_t writerPid;
+    uint64_t published; /* frames published. frame n is in slot n % slotCount */
+    uint32_t closed; /* the engine shut down -- reopen to get the next one's ring */
+    uint8_t reserved[MOTUS_RING_ALIGN - 44];
+} MotusRingHeader;
+
+typedef struct
+{
+    uint64_t seq; /* 2n+1 while frame n is written, 2n+2 once it's done */
+    uint32_t frameSize; /* bytes of binary frame, right after this header */
+    uint16_t maskWidth, maskHeight; /* 0 if there's no difference image in this frame */
+    uint32_t maskOffset; /* from the start of the slot's data */
+    uint8_t reserved[MOTUS_RING_ALIGN - 20];
+} MotusRingSlot;
+
+typedef struct
+{
+    int fd;
+    uint8_t *base;
+    size_t size;
+    const MotusRingHeader *header;
+    uint64_t last; /* frames published when this reader last acquired */
+    uint64_t missed; /* frames published that this reader never acquired */
+} MotusRingReader;
+
+/* one frame, pointing into the ring -- good until motus_ring_valid says otherwise */
+typedef struct
+{
+    uint64_t frame;
+    uint64_t seq;
+    const uint8_t *data; /* the binary frame */
+    uint32_t size;
+    const uint8_t *mask; /* difference image, row major, NULL if there's none */
+    uint16_t maskWidth, maskHeight;
+} MotusRingView;
+
+/* 0, or -1 w/ errno set, eg. ENOENT if the engine isn't running */
+int motus_ring_open(MotusRingReader *ring, const char *name);
+void motus_ring_close(MotusRingReader *ring);
+
+/* 1 if the engine is still publishing to this ring -- 0 means close & open again */
+int motus_ring_alive(const MotusRingReader *ring);
+
+/* the newest frame, if it's one this reader hasn't had: 1 & view filled in, 0 if nothing new, -1 if the ring was closed */
+int motus_ring_acquire(MotusRingReader *ring, MotusRingView *view);
+
+/* 1 if view's slot still holds its frame, ie. everything read through the view so far is consistent */
+int motus_ring_valid(const MotusRingReader *ring, const MotusRingView *view);
+
+/* the newest frame copied out, retrying if it's overwritten while copying. the view points into frame & mask.
+   same returns as motus_ring_acquire -- mask can be NULL to skip the image */
+int motus_ring_read(MotusRingReader *ring, uint8_t *frame, size_t frameCapacity, uint8_t *mask, size_t maskCapacity, MotusRingView *view);
+
+/* a binary frame's header, w/ where its entities & grid are */
+typedef struct
+{
+    uint32_t sequence;
+    double time;
+    uint16_t entityCount, entitySize;
+    uint16_t gridWidth, gridHeight;
+    uint16_t peakCell, peakMotion;
+    uint32_t gridFrame;
+    const uint8_t *entities;
+    const uint8_t *grid;
+} MotusFrameInfo;
+
+typedef struct
+{
+    uint16_t id;
+    uint16_t valid; /* 1 raw, 2 smooth, 4 der1, 8 der2, 16 orientation */
+    float time;
+    float raw[3], smooth[3], der1[3], der2[3];
+    float orientation[4]; /* w x y z */
+} MotusEntityState;
+
+/* 0, or -1 if data isn't a frame this library knows */
+int motus_frame_parse(const uint8_t *data, uint32_t size, MotusFrameInfo *info);
+void motus_frame_entity(const MotusFrameInfo *info, int i, MotusEntityState *entity);
+/* cell x, y's motion as a fraction of the cell, 0-1 */
+float motus_frame_cell(const MotusFrameInfo *info, int x, int y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MotusRing_h */
@@ -0,0 +1,97 @@
+/*
+ * motus-server
+ * Runs the Motus engine w/o a window or gl -- capture, analysis & osc out only -- so the analysis can have a
+ * rack machine to itself at whatever rate it manages, while the visuals run somewhere else.
+ * Squares & positions are in the sensor's coordinates. Keys are the app's, typed in w/ return.
+ * Nothing here or in the engine's headers uses cinder's app framework or gl. Built by CMakeLists.txt:
+ *   cmake -S . -B build -DCINDER_PATH=<cinder> -DASTRA_ROOT=<astra sdk> && cmake --build build --target motus-server
+ *   build/motus-server [assets folder]
+ * The assets folder defaults to the one next to the executable, then ./assets.
+ */
+
+#include "MotusEngine.h"
+
+#include <csignal>
+#include <thread>
+
+#define SERVER_IDLE_MS 1 //sleep when an update had nothing to do, instead of spinning
+
+static std::atomic<bool> sRunning{true};
+
+//the folder the engine's files are read from -- the command line's, or assets/ next to the executable or in the working directory
+static ci::fs::path findAssets(int argc, char *argv[])
+{
+    if( argc > 1 ) return ci::fs::path(argv[1]);
+    ci::fs::path nextToUs = ci::fs::path(argv[0]).parent_path() / "assets";
+    if( ci::fs::is_directory(nextToUs) ) return nextToUs;
+    return ci::fs::path("assets");
+}
+
+static void onSignal(int)
+{
+    sRunning = false;
+}
+
+//reads commands from stdin on its own thread, so the loop never blocks on it.
+//getline can't be interrupted, so the thread -- & this -- live as long as the process
+class CommandReader
+{
+protected:
+    std::mutex mutex;
+    std::string pending;
+    std::thread thread;
+
+public:
+    CommandReader()
+    {
+        thread = std::thread( [this]{
+            std::string line;
+            while( sRunning && std::getline(std::cin, line) )
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending += line;
+            }
+        } );
+        thread.detach();
+    };
+
+    std::string take()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string keys;
+        keys.swap(pending);
+        return keys;
+    };
+};
+
+int main(int argc, char *argv[])
+{
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    asio::io_service io;
+    asio::io_service::work work(io); //the osc sender's handlers run when we poll -- the receiver has its own thread
+
+    MotusEngine engine(io);
+    engine.setRendering(false);
+    ci::fs::path assets = findAssets(argc, argv);
+    if( !engine.setup( assets / GRAPH_FILE, assets / MASK_FILE, assets / SOURCES_FILE, assets / OUTPUTS_FILE ) ) return 1;
+    std::cout << "motus-server running -- osc in on " << LOCALPORT2 << ", out to the subscribers in " << OUTPUTS_FILE << " (f lists them)" << std::endl;
+
+    CommandReader *commands = new CommandReader();
+    while( sRunning )
+    {
+        io.poll(); //the sender's handlers
+        engine.update();
+        bool busy = engine.hasNewOSC();
+        engine.finishFrame();
+
+        std::string keys = commands->take();
+        for(int i=0; i<keys.size(); i++) engine.handleKey(keys[i]);
+
+        if( !busy && !engine.hasNewFrame() ) std::this_thread::sleep_for( std::chrono::milliseconds(SERVER_IDLE_MS) );
+    }
+
+    std::cout << "motus-server stopping" << std::endl;
+    return 0;
+}
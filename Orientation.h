@@ -0,0 +1,294 @@
+//
+//  Orientation.h
+//  Motus
+//
+//  Orientation of every sensor that sends gyro data (the phones, via Syntien) -- Madgwick's gradient descent
+//  filter fusing gyro & accel into a quaternion, plus the acceleration w/ gravity taken out of it.
+//  All sensors are integrated together: each one is a lane of an OrientationBank, state stored structure-of-arrays,
+//  and each resampler tick runs one branch-free loop over the lanes so the compiler can put them in simd registers.
+//  Reads each entity's resampled stream, so like FusionEntity it runs after the entities every frame.
+//
+
+#ifndef Orientation_h
+#define Orientation_h
+
+#include <cmath>
+
+#define ORIENTATION_LANES 8 //sensors per bank, padded to a full avx register of floats
+#define ORIENTATION_BETA 0.1f //madgwick gain -- higher trusts accel more, lower trusts the gyro more
+#define ORIENTATION_GRAVITY_ADAPT 0.005f //ewma rate of the gravity magnitude estimate, per tick
+#define ORIENTATION_NODE "resample" //the node each sensor's accel & gyro are read from -- it needs a fixed rate
+
+namespace CRCPMotionAnalysis {
+
+//ORIENTATION_LANES madgwick imu filters run in lock step. gyro in rad/s, accel in any unit (it only gives a direction)
+class OrientationBank
+{
+public:
+    alignas(32) float q0[ORIENTATION_LANES], q1[ORIENTATION_LANES], q2[ORIENTATION_LANES], q3[ORIENTATION_LANES]; //w, x, y, z
+    alignas(32) float gx[ORIENTATION_LANES], gy[ORIENTATION_LANES], gz[ORIENTATION_LANES]; //inputs
+    alignas(32) float ax[ORIENTATION_LANES], ay[ORIENTATION_LANES], az[ORIENTATION_LANES];
+    alignas(32) float active[ORIENTATION_LANES]; //1 if the lane has a sample this tick, else 0 & its state is left alone
+    alignas(32) float gravity[ORIENTATION_LANES]; //running |accel| at rest, in the sensor's units
+    alignas(32) float lx[ORIENTATION_LANES], ly[ORIENTATION_LANES], lz[ORIENTATION_LANES]; //outputs -- linear accel
+    float beta;
+
+    OrientationBank(float _beta=ORIENTATION_BETA)
+    {
+        beta = _beta;
+        for(int i=0; i<ORIENTATION_LANES; i++) reset(i);
+    };
+
+    void reset(int i)
+    {
+        q0[i] = 1; q1[i] = q2[i] = q3[i] = 0;
+        gx[i] = gy[i] = gz[i] = ax[i] = ay[i] = az[i] = 0;
+        active[i] = 0;
+        gravity[i] = 0;
+        lx[i] = ly[i] = lz[i] = 0;
+    };
+
+    //one tick of dt seconds for every lane
+    void update(float dt)
+    {
+        for(int i=0; i<ORIENTATION_LANES; i++)
+        {
+            float w = q0[i], x = q1[i], y = q2[i], z = q3[i];
+
+            //rate of change from the gyro
+            float dw = 0.5f * ( -x * gx[i] - y * gy[i] - z * gz[i] );
+            float dx = 0.5f * ( w * gx[i] + y * gz[i] - z * gy[i] );
+            float dy = 0.5f * ( w * gy[i] - x * gz[i] + z * gx[i] );
+            float dz = 0.5f * ( w * gz[i] + x * gy[i] - y * gx[i] );
+
+            //corrective step towards the gravity direction the accel sees. the selects keep this branch free --
+            //no accel (or free fall) just means no correction
+            float aSq = ax[i]*ax[i] + ay[i]*ay[i] + az[i]*az[i];
+            float aMag = std::sqrt(aSq);
+            float aInv = aSq > 0 ? 1.0f / aMag : 0;
+            float nx = ax[i] * aInv, ny = ay[i] * aInv, nz = az[i] * aInv;
+
+            float s0 = 4*w*y*y + 2*y*nx + 4*w*x*x - 2*x*ny;
+            float s1 = 4*x*z*z - 2*z*nx + 4*w*w*x - 2*w*ny - 4*x + 8*x*x*x + 8*x*y*y + 4*x*nz;
+            float s2 = 4*w*w*y + 2*w*nx + 4*y*z*z - 2*z*ny - 4*y + 8*y*x*x + 8*y*y*y + 4*y*nz;
+            float s3 = 4*x*x*z - 2*x*nx + 4*y*y*z - 2*y*ny;
+            float sSq = s0*s0 + s1*s1 + s2*s2 + s3*s3;
+            float sInv = ( sSq > 0 && aSq > 0 ) ? beta / std::sqrt(sSq) : 0;
+            dw -= s0 * sInv; dx -= s1 * sInv; dy -= s2 * sInv; dz -= s3 * sInv;
+
+            //integrate & renormalize, only for the lanes w/ a sample
+            float step = dt * active[i];
+            w += dw * step; x += dx * step; y += dy * step; z += dz * step;
+            float qInv = 1.0f / std::sqrt(w*w + x*x + y*y + z*z);
+            q0[i] = w * qInv; q1[i] = x * qInv; q2[i] = y * qInv; q3[i] = z * qInv;
+            w = q0[i]; x = q1[i]; y = q2[i]; z = q3[i];
+
+            //gravity in the sensor frame is the world's up rotated by the inverse of q. scale it by the running
+            //|accel| so it works whatever units the sensor sends (g or m/s^2)
+            float g = gravity[i] == 0 ? aMag : gravity[i] + ORIENTATION_GRAVITY_ADAPT * ( aMag - gravity[i] );
+            gravity[i] = active[i] > 0 ? g : gravity[i];
+            float vx = 2 * ( x*z - w*y );
+            float vy = 2 * ( w*x + y*z );
+            float vz = w*w - x*x - y*y + z*z;
+            lx[i] = ax[i] - gravity[i] * vx;
+            ly[i] = ay[i] - gravity[i] * vy;
+            lz[i] = az[i] - gravity[i] * vz;
+        }
+    };
+};
+
+//estimates the orientation of each member entity's sensor from its resampled accel & gyro.
+//per tick & sensor w/ gyro data it keeps a sample w/ the quaternion in QX..QA (QA is w), the gravity free accel in
+//ACCELX..Z & the gyro as it came in. sends /mocap/orientation (id, w, x, y, z) & /mocap/linear (id, x, y, z) for each.
+//entities w/o gyro (wiimotes) are members too -- their lane just never runs.
+class OrientationEntity : public UGEN
+{
+protected:
+    struct Member
+    {
+        Entity *entity;
+        long nextTick; //next resampler tick to integrate
+        int cursor; //scratch -- position in this frame's buffer
+        std::vector<MocapDeviceData *> out; //newest last, at most bufsize
+        int fresh; //how many of out are new this frame
+    };
+
+    std::vector<Member> members;
+    std::vector<OrientationBank> banks; //member m is lane m % ORIENTATION_LANES of bank m / ORIENTATION_LANES
+    std::vector< std::vector<MocapDeviceData *> > buffers; //scratch -- each member's resampled window
+    std::string nodeName;
+    double rate;
+    int bufsize;
+
+    static long tickOf(MocapDeviceData *d)
+    {
+        return std::lround( d->getData(MocapDeviceData::DataIndices::INDEX) );
+    };
+
+    static bool hasGyro(MocapDeviceData *d)
+    {
+        return d->getData(MocapDeviceData::DataIndices::GYROX) != NO_DATA;
+    };
+
+    static float value(MocapDeviceData *d, int index)
+    {
+        double v = d->getData(index);
+        return v == NO_DATA ? 0 : v;
+    };
+
+    void emit(int m, MocapDeviceData *in)
+    {
+        OrientationBank &bank = banks[m / ORIENTATION_LANES];
+        int i = m % ORIENTATION_LANES;
+
+        MocapDeviceData *mdd = new MocapDeviceData();
+        mdd->setData(MocapDeviceData::DataIndices::INDEX, in->getData(MocapDeviceData::DataIndices::INDEX));
+        mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, in->getData(MocapDeviceData::DataIndices::TIME_STAMP));
+        mdd->setData(MocapDeviceData::DataIndices::ACCELX, bank.lx[i]);
+        mdd->setData(MocapDeviceData::DataIndices::ACCELY, bank.ly[i]);
+        mdd->setData(MocapDeviceData::DataIndices::ACCELZ, bank.lz[i]);
+        mdd->setData(MocapDeviceData::DataIndices::GYROX, bank.gx[i]);
+        mdd->setData(MocapDeviceData::DataIndices::GYROY, bank.gy[i]);
+        mdd->setData(MocapDeviceData::DataIndices::GYROZ, bank.gz[i]);
+        mdd->setQuarternion(bank.q1[i], bank.q2[i], bank.q3[i], bank.q0[i]);
+
+        Member &member = members[m];
+        member.out.push_back(mdd);
+        member.fresh++;
+        if( member.out.size() > bufsize )
+        {
+            delete member.out.front();
+            member.out.erase( member.out.begin() );
+            member.fresh = std::min(member.fresh, (int) member.out.size());
+        }
+    };
+
+public:
+    OrientationEntity(double _rate=SR, int _bufsize=48, const std::string &node=ORIENTATION_NODE)
+    {
+        rate = _rate;
+        bufsize = _bufsize;
+        nodeName = node;
+    };
+
+    ~OrientationEntity()
+    {
+        for(int m=0; m<members.size(); m++)
+            for(int i=0; i<members[m].out.size(); i++) delete members[m].out[i];
+    };
+
+    void addMember(Entity *entity)
+    {
+        Member m;
+        m.entity = entity;
+        m.nextTick = -1;
+        m.cursor = 0;
+        m.fresh = 0;
+        members.push_back(m);
+        buffers.resize(members.size());
+        if( banks.size() * ORIENTATION_LANES < members.size() ) banks.push_back( OrientationBank() );
+    };
+
+    inline int getMemberCount(){ return members.size(); };
+
+    //this member's orientation samples, oldest first
+    inline const std::vector<MocapDeviceData *> &getBuffer(int m){ return members[m].out; };
+
+    //w, x, y, z of the member's latest estimate
+    ci::vec4 getOrientation(int m)
+    {
+        OrientationBank &bank = banks[m / ORIENTATION_LANES];
+        int i = m % ORIENTATION_LANES;
+        return ci::vec4(bank.q0[i], bank.q1[i], bank.q2[i], bank.q3[i]);
+    };
+
+    //walks all the members' new ticks in order -- every tick loads the lanes that have a sample & updates each bank once
+    virtual void update(float seconds = 0)
+    {
+        for(int m=0; m<members.size(); m++)
+        {
+            members[m].fresh = 0;
+            members[m].cursor = 0;
+            buffers[m].clear();
+
+            SignalAnalysis *node = members[m].entity->getNode(nodeName); //looked up every frame -- a graph reload replaces it
+            if( node == NULL ) continue;
+            buffers[m] = node->getBuffer();
+            while( members[m].cursor < buffers[m].size() && tickOf(buffers[m][members[m].cursor]) < members[m].nextTick )
+                members[m].cursor++;
+        }
+
+        float dt = 1.0 / rate;
+        while( true )
+        {
+            long tick = LONG_MAX;
+            for(int m=0; m<members.size(); m++)
+                if( members[m].cursor < buffers[m].size() ) tick = std::min(tick, tickOf(buffers[m][members[m].cursor]));
+            if( tick == LONG_MAX ) break;
+
+            bool any = false;
+            for(int m=0; m<members.size(); m++)
+            {
+                OrientationBank &bank = banks[m / ORIENTATION_LANES];
+                int i = m % ORIENTATION_LANES;
+                bank.active[i] = 0;
+
+                Member &member = members[m];
+                if( member.cursor >= buffers[m].size() ) continue;
+                MocapDeviceData *in = buffers[m][member.cursor];
+                if( tickOf(in) != tick ) continue;
+                member.cursor++;
+                member.nextTick = tick + 1;
+                if( !hasGyro(in) ) continue;
+
+                bank.ax[i] = value(in, MocapDeviceData::DataIndices::ACCELX);
+                bank.ay[i] = value(in, MocapDeviceData::DataIndices::ACCELY);
+                bank.az[i] = value(in, MocapDeviceData::DataIndices::ACCELZ);
+                bank.gx[i] = value(in, MocapDeviceData::DataIndices::GYROX);
+                bank.gy[i] = value(in, MocapDeviceData::DataIndices::GYROY);
+                bank.gz[i] = value(in, MocapDeviceData::DataIndices::GYROZ);
+                bank.active[i] = 1;
+                any = true;
+            }
+            if( !any ) continue;
+
+            for(int b=0; b<banks.size(); b++) banks[b].update(dt);
+
+            for(int m=0; m<members.size(); m++)
+            {
+                if( banks[m / ORIENTATION_LANES].active[m % ORIENTATION_LANES] > 0 )
+                    emit(m, buffers[m][members[m].cursor - 1]);
+            }
+        }
+    };
+
+    virtual std::vector<ci::osc::Message> getOSC()
+    {
+        std::vector<ci::osc::Message> msgs;
+        return msgs;
+    };
+
+    virtual void appendOSC(OscPacketWriter &packet)
+    {
+        static const OscAddress orientationAddr("/mocap/orientation", "fffff");
+        static const OscAddress linearAddr("/mocap/linear", "ffff");
+        for(int m=0; m<members.size(); m++)
+        {
+            Member &member = members[m];
+            float id = member.entity->getID();
+            for(int i = member.out.size() - member.fresh; i<member.out.size(); i++)
+            {
+                MocapDeviceData *d = member.out[i];
+                float q[5] = { id, d->getQuarternion(3), d->getQuarternion(0), d->getQuarternion(1), d->getQuarternion(2) };
+                packet.append(orientationAddr, q, 5);
+                float a[4] = { id, (float) d->getData(MocapDeviceData::DataIndices::ACCELX), (float) d->getData(MocapDeviceData::DataIndices::ACCELY),
+                               (float) d->getData(MocapDeviceData::DataIndices::ACCELZ) };
+                packet.append(linearAddr, a, 4);
+            }
+        }
+    };
+};
+
+};
+
+#endif /* Orientation_h */
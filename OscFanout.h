@@ -0,0 +1,441 @@
+//
+//  OscFanout.h
+//  Motus
+//
+//  Sends the frame's osc to every consumer -- the sound patch, the lights, the visuals machine -- instead of one
+//  destination & a relay per extra consumer. Each subscriber has its own
+//    patterns -- which addresses it wants, '*' matches anything (slashes too) & '?' one character
+//    rate -- frames a second it gets, the ones in between are skipped. 0 is every frame
+//    bundle -- max bytes in one of its datagrams, for receivers w/ small buffers
+//  The messages are encoded once by the OscPacketWriter. Here they are only split at their size prefixes, matched
+//  once per address (the result is cached by the address' hash) & copied into each subscriber's bundles -- or not
+//  copied at all for subscribers that take everything. The frame's datagrams for every subscriber then go out in
+//  one sendmmsg call (a sendto each where there's no sendmmsg), so another consumer is a few memcpys, not another encode.
+//  Binary subscribers get the frame in BinaryFrame.h's layout instead of the osc -- one datagram a frame, shared the
+//  same way, w/ only their rate applying.
+//  Read from assets/outputs.json, & changed at runtime w/ /motus/subscribe, /motus/subscribe/binary & /motus/unsubscribe:
+//  {
+//    "subscribers": [ { "host": "127.0.0.1", "port": 8888 },                                     <-- everything, every frame
+//                     { "host": "10.0.0.20", "port": 7000, "patterns": ["/mocap/square", "/mocap/*/hand*"], "rate": 30, "bundle": 512 },
+//                     { "host": "10.0.0.30", "port": 7100, "format": "binary" } ]
+//  }
+//
+
+#ifndef OscFanout_h
+#define OscFanout_h
+
+#include "cinder/Json.h"
+#include "cinder/Log.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "OscPacket.h"
+
+#define FANOUT_MAX_SUBSCRIBERS 16
+#define FANOUT_MAX_DATAGRAMS 128 //a frame's worth over all subscribers -- more than that & it sends early
+#define FANOUT_MIN_BUNDLE 64 //smallest datagram a subscriber can ask for
+
+static_assert( FANOUT_MAX_SUBSCRIBERS <= FANOUT_MAX_DATAGRAMS, "a shared bundle is queued for every subscriber at once" );
+
+namespace CRCPMotionAnalysis {
+
+struct OscSubscriber
+{
+    std::string host;
+    int port;
+    sockaddr_in addr;
+    std::vector<std::string> patterns;
+    double rate; //frames a second, 0 == all
+    int bundleSize; //max bytes a datagram
+    bool passAll; //takes every message whole, so it can share the writer's bundles
+    bool binary; //takes the binary frame, not the osc
+
+    //per frame
+    bool active; //taking this frame, by its rate
+    double lastFrame;
+    uint8_t staging[OSC_PACKET_MAX]; //the bundle being filled
+    size_t stagingSize;
+    std::unordered_map<uint64_t, bool> matches; //by address hash -- only grows by the number of distinct addresses
+
+    unsigned long datagrams, messages, bytes;
+
+    OscSubscriber() : port(0), rate(0), bundleSize(OSC_PACKET_MAX), passAll(true), binary(false), active(false), lastFrame(-1), stagingSize(0), datagrams(0), messages(0), bytes(0)
+    {
+        std::memset( &addr, 0, sizeof(addr) );
+    };
+};
+
+class OscFanout
+{
+protected:
+    struct Datagram
+    {
+        size_t offset, size;
+        int subscriber;
+    };
+
+    int socket; //the sender's, so replies still come from the port we send from
+    std::vector<OscSubscriber *> subscribers;
+    uint8_t *arena; //this frame's datagrams, back to back
+    size_t used;
+    std::vector<Datagram> datagrams;
+    unsigned long sendErrors;
+
+#ifdef __linux__
+    mmsghdr msgs[FANOUT_MAX_DATAGRAMS];
+#endif
+    iovec iovs[FANOUT_MAX_DATAGRAMS];
+
+    //'*' any run, slashes too -- '?' any one character
+    static bool glob(const char *pattern, const char *str)
+    {
+        const char *star = NULL, *resume = NULL;
+        while( *str )
+        {
+            if( *pattern == '?' || *pattern == *str ) { pattern++; str++; }
+            else if( *pattern == '*' ) { star = pattern++; resume = str; }
+            else if( star ) { pattern = star + 1; str = ++resume; }
+            else return false;
+        }
+        while( *pattern == '*' ) pattern++;
+        return *pattern == 0;
+    };
+
+    static uint64_t hash(const char *str)
+    {
+        uint64_t h = 14695981039346656037ULL; //fnv-1a
+        for( ; *str; str++ ) h = ( h ^ (uint8_t) *str ) * 1099511628211ULL;
+        return h;
+    };
+
+    bool matches(OscSubscriber *sub, const char *address)
+    {
+        uint64_t h = hash(address);
+        std::unordered_map<uint64_t, bool>::iterator it = sub->matches.find(h);
+        if( it != sub->matches.end() ) return it->second;
+
+        bool match = false;
+        for(int i=0; i<sub->patterns.size() && !match; i++) match = glob( sub->patterns[i].c_str(), address );
+        sub->matches[h] = match;
+        return match;
+    };
+
+    //room in the arena for size bytes, & for the count datagrams that will point at them -- sends what's there first if it's full
+    uint8_t *reserve(size_t size, int count = 1)
+    {
+        if( used + size > FANOUT_MAX_DATAGRAMS * OSC_PACKET_MAX || datagrams.size() + count > FANOUT_MAX_DATAGRAMS ) transmit();
+        return arena + used;
+    };
+
+    //subscribers taking this frame whole -- passAll or binary ones
+    int countActive(bool binary)
+    {
+        int count = 0;
+        for(int s=0; s<subscribers.size(); s++)
+            if( subscribers[s]->active && ( binary ? subscribers[s]->binary : subscribers[s]->passAll ) ) count++;
+        return count;
+    };
+
+    //one copy in the arena, queued for every active subscriber that takes it whole
+    void share(const uint8_t *data, size_t size, bool binary)
+    {
+        int count = countActive(binary);
+        if( count == 0 ) return;
+        std::memcpy( reserve(size, count), data, size );
+        for(int s=0; s<subscribers.size(); s++)
+        {
+            OscSubscriber *sub = subscribers[s];
+            if( !sub->active || !( binary ? sub->binary : sub->passAll ) ) continue;
+            queue( used, size, s );
+            if( binary ) sub->messages++;
+        }
+        used += size;
+    };
+
+    void queue(size_t offset, size_t size, int subscriber)
+    {
+        Datagram d = { offset, size, subscriber };
+        datagrams.push_back(d);
+    };
+
+    static void beginBundle(OscSubscriber *sub)
+    {
+        std::memcpy( sub->staging, "#bundle\0\0\0\0\0\0\0\0\1", OSC_BUNDLE_HEADER_SIZE ); //time tag of 1 == immediately
+        sub->stagingSize = OSC_BUNDLE_HEADER_SIZE;
+    };
+
+    //moves a subscriber's staged bundle into the arena, if it has messages
+    void close(int s)
+    {
+        OscSubscriber *sub = subscribers[s];
+        if( sub->stagingSize <= OSC_BUNDLE_HEADER_SIZE ) return;
+        uint8_t *dst = reserve(sub->stagingSize);
+        std::memcpy( dst, sub->staging, sub->stagingSize );
+        queue( used, sub->stagingSize, s );
+        used += sub->stagingSize;
+        beginBundle(sub);
+    };
+
+    static bool resolve(const std::string &host, int port, sockaddr_in &addr)
+    {
+        std::memset( &addr, 0, sizeof(addr) );
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if( inet_pton( AF_INET, host.c_str(), &addr.sin_addr ) == 1 ) return true;
+
+        addrinfo hints, *found = NULL;
+        std::memset( &hints, 0, sizeof(hints) );
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if( getaddrinfo( host.c_str(), NULL, &hints, &found ) != 0 || !found ) return false;
+        addr.sin_addr = ( (sockaddr_in *) found->ai_addr )->sin_addr;
+        freeaddrinfo(found);
+        return true;
+    };
+
+public:
+    OscFanout() : socket(-1), used(0), sendErrors(0)
+    {
+        arena = new uint8_t[FANOUT_MAX_DATAGRAMS * OSC_PACKET_MAX];
+        datagrams.reserve(FANOUT_MAX_DATAGRAMS);
+    };
+
+    ~OscFanout()
+    {
+        for(int i=0; i<subscribers.size(); i++) delete subscribers[i];
+        delete [] arena;
+    };
+
+    //a bound udp socket to send from
+    inline void setSocket(int fd){ socket = fd; };
+
+    //adds a subscriber, or changes the one at host:port. no patterns is everything -- binary ones take the whole frame
+    bool subscribe(const std::string &host, int port, const std::vector<std::string> &patterns, double rate = 0, int bundleSize = OSC_PACKET_MAX, bool binary = false)
+    {
+        OscSubscriber *sub = NULL;
+        for(int i=0; i<subscribers.size(); i++)
+            if( subscribers[i]->host == host && subscribers[i]->port == port ) sub = subscribers[i];
+        if( !sub )
+        {
+            if( subscribers.size() >= FANOUT_MAX_SUBSCRIBERS )
+            {
+                CI_LOG_W( "Too many osc subscribers, not adding " << host << ":" << port );
+                return false;
+            }
+            sub = new OscSubscriber();
+            if( !resolve(host, port, sub->addr) )
+            {
+                CI_LOG_W( "Could not resolve osc subscriber " << host );
+                delete sub;
+                return false;
+            }
+            sub->host = host;
+            sub->port = port;
+            subscribers.push_back(sub);
+        }
+
+        sub->patterns.clear();
+        for(int i=0; i<patterns.size(); i++) if( !patterns[i].empty() ) sub->patterns.push_back(patterns[i]);
+        if( sub->patterns.empty() ) sub->patterns.push_back("*");
+        sub->matches.clear();
+        sub->rate = std::max(0.0, rate);
+        sub->bundleSize = std::max( FANOUT_MIN_BUNDLE, std::min(bundleSize, OSC_PACKET_MAX) );
+        sub->binary = binary;
+        sub->passAll = !binary && sub->patterns.size() == 1 && sub->patterns[0] == "*" && sub->bundleSize == OSC_PACKET_MAX;
+        beginBundle(sub);
+        if( binary ) CI_LOG_I( "binary subscriber " << host << ":" << port << " -- rate " << sub->rate );
+        else CI_LOG_I( "osc subscriber " << host << ":" << port << " -- " << sub->patterns.size() << " patterns, rate " << sub->rate << ", bundle " << sub->bundleSize );
+        return true;
+    };
+
+    //splits a space separated pattern list, eg. from an osc arg
+    static std::vector<std::string> splitPatterns(const std::string &list)
+    {
+        std::vector<std::string> patterns;
+        std::stringstream ss(list);
+        std::string p;
+        while( ss >> p ) patterns.push_back(p);
+        return patterns;
+    };
+
+    bool unsubscribe(const std::string &host, int port)
+    {
+        for(int i=0; i<subscribers.size(); i++)
+        {
+            if( subscribers[i]->host != host || subscribers[i]->port != port ) continue;
+            send(); //queued datagrams refer to subscribers by index
+            delete subscribers[i];
+            subscribers.erase( subscribers.begin() + i );
+            return true;
+        }
+        return false;
+    };
+
+    bool load(const ci::fs::path &path)
+    {
+        if( path.empty() || !ci::fs::exists(path) ) return false;
+        try
+        {
+            ci::JsonTree json( ci::loadFile(path) );
+            if( !json.hasChild("subscribers") ) return false;
+            for( const ci::JsonTree &s : json.getChild("subscribers").getChildren() )
+            {
+                std::vector<std::string> patterns;
+                if( s.hasChild("patterns") )
+                    for( const ci::JsonTree &p : s.getChild("patterns").getChildren() ) patterns.push_back( p.getValue() );
+                subscribe( s.getValueForKey("host"), s.getValueForKey<int>("port"), patterns,
+                           s.hasChild("rate") ? s.getValueForKey<double>("rate") : 0,
+                           s.hasChild("bundle") ? s.getValueForKey<int>("bundle") : OSC_PACKET_MAX,
+                           s.hasChild("format") && s.getValueForKey("format") == "binary" );
+            }
+            CI_LOG_I( "Loaded osc subscribers from " << path );
+            return !subscribers.empty();
+        }
+        catch( ci::Exception &e )
+        {
+            CI_LOG_E( "Error loading osc subscribers " << path << ": " << e.what() );
+            return false;
+        }
+    };
+
+    //which subscribers take this frame, by their rates. now in seconds
+    void beginFrame(double now)
+    {
+        for(int i=0; i<subscribers.size(); i++)
+        {
+            OscSubscriber *sub = subscribers[i];
+            sub->active = sub->rate <= 0 || sub->lastFrame < 0 || now - sub->lastFrame >= 1.0 / sub->rate - 0.002; //a bit early is on time
+            if( sub->active ) sub->lastFrame = now;
+        }
+    };
+
+    //a bundle from the packet writer -- the writer reuses its buffer after this, so whatever's kept is copied
+    void add(const uint8_t *bundle, size_t size)
+    {
+        if( size <= OSC_BUNDLE_HEADER_SIZE || std::memcmp(bundle, "#bundle", 8) != 0 ) return;
+
+        share( bundle, size, false ); //everyone who takes it all shares one copy
+
+        //the rest get the messages they match, w/o re-encoding
+        for(size_t at = OSC_BUNDLE_HEADER_SIZE; at + 4 <= size; )
+        {
+            uint32_t len = ( (uint32_t) bundle[at] << 24 ) | ( (uint32_t) bundle[at+1] << 16 ) | ( (uint32_t) bundle[at+2] << 8 ) | bundle[at+3];
+            if( at + 4 + len > size ) break; //malformed
+            const uint8_t *element = bundle + at;
+            const char *address = (const char *) element + 4;
+            size_t elementSize = 4 + len;
+            at += elementSize;
+
+            for(int s=0; s<subscribers.size(); s++)
+            {
+                OscSubscriber *sub = subscribers[s];
+                if( !sub->active || sub->binary ) continue;
+                if( sub->passAll ) { sub->messages++; continue; }
+                if( !matches(sub, address) ) continue;
+
+                if( sub->stagingSize + elementSize > sub->bundleSize ) close(s);
+                if( OSC_BUNDLE_HEADER_SIZE + elementSize > OSC_PACKET_MAX ) continue; //never fits
+                std::memcpy( sub->staging + sub->stagingSize, element, elementSize ); //a message bigger than the bundle size goes alone
+                sub->stagingSize += elementSize;
+                sub->messages++;
+            }
+        }
+    };
+
+    //a binary frame, one copy for every binary subscriber taking this frame
+    void addBinary(const uint8_t *frame, size_t size)
+    {
+        if( size == 0 || size > FANOUT_MAX_DATAGRAMS * OSC_PACKET_MAX ) return;
+        share( frame, size, true );
+    };
+
+    //anyone taking the binary frame this frame -- so it's only built when it goes somewhere
+    inline bool wantsBinary(){ return countActive(true) > 0; };
+
+    //the queued datagrams, in as few syscalls as there are
+    void transmit()
+    {
+        if( datagrams.empty() ) return;
+
+        int count = datagrams.size();
+        for(int i=0; i<count; i++)
+        {
+            iovs[i].iov_base = arena + datagrams[i].offset;
+            iovs[i].iov_len = datagrams[i].size;
+            OscSubscriber *sub = subscribers[ datagrams[i].subscriber ];
+            sub->datagrams++;
+            sub->bytes += datagrams[i].size;
+        }
+
+        if( socket >= 0 )
+        {
+#ifdef __linux__
+            for(int i=0; i<count; i++)
+            {
+                std::memset( &msgs[i], 0, sizeof(mmsghdr) );
+                msgs[i].msg_hdr.msg_name = &subscribers[ datagrams[i].subscriber ]->addr;
+                msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            for(int sent = 0; sent < count; )
+            {
+                int n = sendmmsg( socket, msgs + sent, count - sent, 0 );
+                if( n <= 0 ) { sendErrors += count - sent; break; } //eg. the socket buffer is full -- drop the rest of the frame
+                sent += n;
+            }
+#else
+            for(int i=0; i<count; i++)
+            {
+                sockaddr_in &addr = subscribers[ datagrams[i].subscriber ]->addr;
+                if( sendto( socket, iovs[i].iov_base, iovs[i].iov_len, 0, (sockaddr *) &addr, sizeof(addr) ) < 0 ) sendErrors++;
+            }
+#endif
+        }
+        datagrams.clear();
+        used = 0;
+    };
+
+    //the frame's datagrams to everyone, bundles still being filled too. call at the end of the frame
+    void send()
+    {
+        for(int s=0; s<subscribers.size(); s++) close(s);
+        transmit();
+    };
+
+    inline int getSubscriberCount(){ return subscribers.size(); };
+    inline unsigned long getSendErrors(){ return sendErrors; };
+
+    void report(std::ostream &out)
+    {
+        for(int i=0; i<subscribers.size(); i++)
+        {
+            OscSubscriber *sub = subscribers[i];
+            out << sub->host << ":" << sub->port << " --";
+            if( sub->binary ) out << " binary rate " << sub->rate << " | " << sub->messages << " frames, ";
+            else
+            {
+                for(int p=0; p<sub->patterns.size(); p++) out << " " << sub->patterns[p];
+                out << " rate " << sub->rate << " bundle " << sub->bundleSize << " | " << sub->messages << " messages in ";
+            }
+            out << sub->datagrams << " datagrams, " << sub->bytes << " bytes" << std::endl;
+        }
+        out << "send errors: " << sendErrors << std::endl;
+    };
+};
+
+};
+
+#endif /* OscFanout_h */
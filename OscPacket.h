@@ -0,0 +1,206 @@
+//
+//  OscPacket.h
+//  Motus
+//
+//  Allocation-free OSC encoding. Addresses & type tags are encoded once into an OscAddress, and the ugens append
+//  their samples straight into a fixed packet buffer as messages of an OSC bundle. When the bundle is full it is
+//  handed to the sink (a udp send) and the buffer is reused, so sending thousands of values a second touches the heap never.
+//
+
+#ifndef OscPacket_h
+#define OscPacket_h
+
+#include "cinder/Log.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#define OSC_HEADER_MAX 64 //max bytes for an encoded address + type tags
+#define OSC_PACKET_MAX 1472 //one udp datagram w/o fragmenting. oscP5 reads at most 1536 bytes by default, so stay under that
+#define OSC_BUNDLE_HEADER_SIZE 16 //"#bundle\0" + 8 byte time tag
+
+namespace CRCPMotionAnalysis {
+
+//an interned address + type tag string, encoded & padded once
+class OscAddress
+{
+protected:
+    uint8_t header[OSC_HEADER_MAX];
+    int headerSize;
+    int argCount;
+    bool valid; //fit in the header -- a ugen's address can be anything, so too long ones are refused, not written past it
+
+    //bytes of a string w/ its null terminator, padded to a multiple of 4
+    static size_t paddedSize(const char *str)
+    {
+        return ( std::strlen(str) + 1 + 3 ) & ~(size_t) 3;
+    };
+
+    //copies a string w/ its null terminator, padded w/ nulls to a multiple of 4
+    static int writePadded(uint8_t *dst, const char *str)
+    {
+        int len = std::strlen(str) + 1;
+        int padded = ( len + 3 ) & ~3;
+        std::memcpy(dst, str, len);
+        std::memset(dst + len, 0, padded - len);
+        return padded;
+    };
+
+public:
+    //typeTags w/o the leading comma, eg. "ff" for two floats
+    OscAddress(const char *address, const char *typeTags) : headerSize(0), argCount( std::strlen(typeTags) ), valid(false)
+    {
+        char tags[OSC_HEADER_MAX];
+        tags[0] = ',';
+        if( argCount <= OSC_HEADER_MAX - 2 ) std::memcpy(tags + 1, typeTags, argCount + 1);
+        if( argCount > OSC_HEADER_MAX - 2 || paddedSize(address) + paddedSize(tags) > OSC_HEADER_MAX )
+        {
+            static int logged = 0; //ugens make their addresses per message, so only the first few
+            if( logged < 10 )
+            {
+                logged++;
+                CI_LOG_E( "OSC address too long, not sending it: " << address );
+            }
+            return;
+        }
+
+        headerSize = writePadded(header, address);
+        headerSize += writePadded(header + headerSize, tags);
+        valid = true;
+    };
+
+    inline const uint8_t *data() const { return header; };
+    inline int size() const { return headerSize; };
+    inline int getArgCount() const { return argCount; };
+    inline bool isValid() const { return valid; };
+    inline int messageSize() const { return headerSize + 4*argCount; }; //all our args are 4 bytes
+};
+
+//builds OSC bundles in a fixed buffer
+class OscPacketWriter
+{
+public:
+    typedef std::function<void(const uint8_t *, size_t)> Sink;
+
+protected:
+    uint8_t buffer[OSC_PACKET_MAX];
+    size_t size;
+    size_t messageStart; //where the current message's size prefix is
+    int messageCount;
+    unsigned long packetsSent;
+    Sink sink;
+
+    inline void write32(uint32_t v)
+    {
+        buffer[size++] = (v >> 24) & 0xFF;
+        buffer[size++] = (v >> 16) & 0xFF;
+        buffer[size++] = (v >> 8) & 0xFF;
+        buffer[size++] = v & 0xFF;
+    };
+
+    void beginBundle()
+    {
+        std::memcpy(buffer, "#bundle\0", 8);
+        size = 8;
+        write32(0); //time tag of 1 == immediately
+        write32(1);
+        messageCount = 0;
+    };
+
+    //patches the size prefix of the message we just finished
+    inline void endMessage()
+    {
+        uint32_t len = size - messageStart - 4;
+        buffer[messageStart] = (len >> 24) & 0xFF;
+        buffer[messageStart+1] = (len >> 16) & 0xFF;
+        buffer[messageStart+2] = (len >> 8) & 0xFF;
+        buffer[messageStart+3] = len & 0xFF;
+        messageCount++;
+    };
+
+public:
+    OscPacketWriter()
+    {
+        packetsSent = 0;
+        beginBundle();
+    };
+
+    //where full packets go -- set once, eg. to a udp send
+    void setSink(const Sink &s)
+    {
+        sink = s;
+    };
+
+    //starts a message w/ room for all its args, sending the current bundle first if it would overflow
+    bool begin(const OscAddress &addr)
+    {
+        if( !addr.isValid() ) return false; //too long to encode -- logged when it was made
+        size_t needed = 4 + addr.messageSize();
+        if( size + needed > OSC_PACKET_MAX ) flush();
+        if( size + needed > OSC_PACKET_MAX ) return false; //message can't fit in any packet
+
+        messageStart = size;
+        size += 4; //size prefix, patched in endMessage()
+        std::memcpy(buffer + size, addr.data(), addr.size());
+        size += addr.size();
+        return true;
+    };
+
+    inline void writeFloat(float f)
+    {
+        uint32_t v;
+        std::memcpy(&v, &f, 4);
+        write32(v);
+    };
+
+    inline void writeInt(int32_t i)
+    {
+        write32( (uint32_t) i );
+    };
+
+    inline void end()
+    {
+        endMessage();
+    };
+
+    //the common cases
+    inline void append(const OscAddress &addr, float a, float b)
+    {
+        if( !begin(addr) ) return;
+        writeFloat(a); writeFloat(b);
+        end();
+    };
+
+    inline void append(const OscAddress &addr, float a, float b, float c)
+    {
+        if( !begin(addr) ) return;
+        writeFloat(a); writeFloat(b); writeFloat(c);
+        end();
+    };
+
+    inline void append(const OscAddress &addr, const float *args, int count)
+    {
+        if( !begin(addr) ) return;
+        for(int i=0; i<count; i++) writeFloat(args[i]);
+        end();
+    };
+
+    //sends whatever has been appended. call at the end of the frame
+    void flush()
+    {
+        if( messageCount > 0 && sink )
+        {
+            sink(buffer, size);
+            packetsSent++;
+        }
+        beginBundle();
+    };
+
+    inline bool empty(){ return messageCount == 0; };
+    inline unsigned long getPacketsSent(){ return packetsSent; };
+};
+
+};
+
+#endif /* OscPacket_h */
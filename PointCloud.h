@@ -0,0 +1,343 @@
+//
+//  PointCloud.h
+//  Motus
+//
+//  3D analysis of the astra's point stream -- world space XYZ instead of the depth image.
+//  Points are binned into a voxel grid (downsampling ~300k points to a few thousand occupied voxels), the voxels
+//  occupied this frame are compared w/ last frame's for 3D motion, and connected clusters of voxels are the
+//  performers, each w/ a bounding volume. Everything is in meters.
+//  The voxel hash is open addressing in a fixed table that is cleared by bumping a frame stamp, so once the
+//  first frame is in nothing is allocated. Runs in the listener's frame callback, ie. once per depth frame.
+//
+
+#ifndef PointCloud_h
+#define PointCloud_h
+
+#include "OscPacket.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define VOXEL_SIZE 0.1f //meters
+#define VOXEL_HASH_BITS 16 //table of 64k voxels -- a 6x3x6m stage at 10cm is 21.6k
+#define POINT_STRIDE 2 //use every 2nd pixel in x & y -- still ~20 points per 10cm voxel at 3m
+#define POINT_MIN_DEPTH 0.3f //meters -- closer than this is noise / the camera's housing
+#define POINT_MAX_DEPTH 8.0f
+#define PERFORMER_MIN_VOXELS 20 //clusters smaller than this are noise, not a person
+#define PERFORMER_MAX 8
+#define POINTCLOUD_MAX_PENDING 4 //depth frames that can be analyzed before the app sends them
+
+//fixed size voxel table. a slot belongs to this frame if its stamp is the current one
+class VoxelHash
+{
+public:
+    struct Voxel
+    {
+        int64_t key;
+        uint32_t stamp;
+        int count;
+        float sx, sy, sz; //sum of the points, for the centroid
+        int label; //cluster it belongs to, -1 if none yet
+    };
+
+protected:
+    std::vector<Voxel> slots;
+    std::vector<int> used; //slots filled this frame, in insert order
+    uint32_t stamp;
+    int mask;
+    int dropped; //points that didn't fit
+
+    static inline uint32_t hash(int64_t key)
+    {
+        uint64_t h = (uint64_t) key * 0x9E3779B97F4A7C15ull;
+        return (uint32_t) ( h >> 32 );
+    };
+
+public:
+    VoxelHash(int bits=VOXEL_HASH_BITS)
+    {
+        slots.resize(1 << bits);
+        for(int i=0; i<slots.size(); i++) slots[i].stamp = 0;
+        used.reserve(slots.size());
+        mask = slots.size() - 1;
+        stamp = 1; //empty
+        dropped = 0;
+    };
+
+    //packs voxel coords into a key -- 21 bits each, so +/- 100km at 10cm
+    static inline int64_t key(int ix, int iy, int iz)
+    {
+        const int64_t bias = 1 << 20;
+        return ( (ix + bias) << 42 ) | ( (iy + bias) << 21 ) | (iz + bias);
+    };
+
+    static inline void unpack(int64_t k, int &ix, int &iy, int &iz)
+    {
+        const int64_t bias = 1 << 20;
+        ix = (int) ( ( k >> 42 ) & 0x1FFFFF ) - bias;
+        iy = (int) ( ( k >> 21 ) & 0x1FFFFF ) - bias;
+        iz = (int) ( k & 0x1FFFFF ) - bias;
+    };
+
+    //empties the table in O(1)
+    void clear()
+    {
+        stamp++;
+        if( stamp == 0 ) //wrapped -- every ~4 billion frames
+        {
+            for(int i=0; i<slots.size(); i++) slots[i].stamp = 0;
+            stamp = 1;
+        }
+        used.clear();
+        dropped = 0;
+    };
+
+    //the voxel for key, created if it isn't there. NULL if the table is too full
+    Voxel *insert(int64_t k)
+    {
+        if( used.size() * 2 > slots.size() ) { dropped++; return NULL; } //keep probes short -- load factor <= 0.5
+        uint32_t i = hash(k) & mask;
+        while( slots[i].stamp == stamp )
+        {
+            if( slots[i].key == k ) return &slots[i];
+            i = (i + 1) & mask;
+        }
+        Voxel &v = slots[i];
+        v.key = k; v.stamp = stamp; v.count = 0;
+        v.sx = v.sy = v.sz = 0;
+        v.label = -1;
+        used.push_back(i);
+        return &v;
+    };
+
+    Voxel *find(int64_t k)
+    {
+        uint32_t i = hash(k) & mask;
+        while( slots[i].stamp == stamp )
+        {
+            if( slots[i].key == k ) return &slots[i];
+            i = (i + 1) & mask;
+        }
+        return NULL;
+    };
+
+    inline int size(){ return used.size(); };
+    inline Voxel &at(int n){ return slots[ used[n] ]; };
+    inline int getDropped(){ return dropped; };
+};
+
+//one person on stage -- a connected cluster of voxels
+struct Performer
+{
+    float minX, minY, minZ, maxX, maxY, maxZ; //bounding volume, meters
+    float cx, cy, cz; //centroid of the points
+    int voxels;
+    float motion; //fraction of its voxels that weren't occupied last frame
+};
+
+class PointCloudAnalysis
+{
+public:
+    struct Delta
+    {
+        float x, y, z; //voxel center, meters
+        int change; //+1 newly occupied, -1 newly empty
+    };
+
+    struct Result
+    {
+        int frameIndex;
+        int occupied, appeared, vanished;
+        int performerCount;
+        Performer performers[PERFORMER_MAX];
+    };
+
+protected:
+    VoxelHash hashes[2]; //this frame & last, swapped each frame
+    int current;
+    float voxelSize;
+    int stride;
+
+    std::vector<Delta> deltas;
+    std::vector<VoxelHash::Voxel *> stack; //flood fill scratch
+
+    Result pending[POINTCLOUD_MAX_PENDING]; //analyzed, not yet sent
+    int pendingCount;
+    Result latest; //newest analyzed, kept after it's sent
+    int frameIndex;
+
+    inline VoxelHash &curr(){ return hashes[current]; };
+    inline VoxelHash &prev(){ return hashes[1 - current]; };
+
+    inline float center(int i){ return ( i + 0.5f ) * voxelSize; };
+
+    void binPoints(const float *xyz, int width, int height)
+    {
+        float inv = 1.0f / voxelSize;
+        for(int y=0; y<height; y+=stride)
+        {
+            const float *p = xyz + 3 * y * width;
+            for(int x=0; x<width; x+=stride, p+=3*stride)
+            {
+                float wz = p[2] * 0.001f; //astra world coords are mm
+                if( wz < POINT_MIN_DEPTH || wz > POINT_MAX_DEPTH ) continue; //0 == no reading
+                float wx = p[0] * 0.001f, wy = p[1] * 0.001f;
+
+                VoxelHash::Voxel *v = curr().insert( VoxelHash::key( (int) std::floor(wx * inv), (int) std::floor(wy * inv), (int) std::floor(wz * inv) ) );
+                if( v == NULL ) continue;
+                v->count++;
+                v->sx += wx; v->sy += wy; v->sz += wz;
+            }
+        }
+    };
+
+    //voxels that changed occupancy since last frame
+    void findDeltas(Result &r)
+    {
+        deltas.clear();
+        r.appeared = r.vanished = 0;
+        int ix, iy, iz;
+
+        for(int i=0; i<curr().size(); i++)
+        {
+            VoxelHash::Voxel &v = curr().at(i);
+            if( prev().find(v.key) != NULL ) continue;
+            VoxelHash::unpack(v.key, ix, iy, iz);
+            deltas.push_back( { center(ix), center(iy), center(iz), 1 } );
+            r.appeared++;
+        }
+        for(int i=0; i<prev().size(); i++)
+        {
+            VoxelHash::Voxel &v = prev().at(i);
+            if( curr().find(v.key) != NULL ) continue;
+            VoxelHash::unpack(v.key, ix, iy, iz);
+            deltas.push_back( { center(ix), center(iy), center(iz), -1 } );
+            r.vanished++;
+        }
+    };
+
+    //flood fills 6-connected voxels into clusters & keeps the biggest as performers
+    void findPerformers(Result &r)
+    {
+        r.performerCount = 0;
+        int ix, iy, iz;
+        static const int offsets[6][3] = { {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1} };
+
+        for(int i=0; i<curr().size(); i++)
+        {
+            VoxelHash::Voxel &seed = curr().at(i);
+            if( seed.label != -1 ) continue;
+
+            Performer p;
+            p.minX = p.minY = p.minZ = 1e9f;
+            p.maxX = p.maxY = p.maxZ = -1e9f;
+            double sx = 0, sy = 0, sz = 0;
+            int points = 0, fresh = 0;
+            p.voxels = 0;
+
+            seed.label = i;
+            stack.clear();
+            stack.push_back(&seed);
+            while( !stack.empty() )
+            {
+                VoxelHash::Voxel &v = *stack.back();
+                stack.pop_back();
+                VoxelHash::unpack(v.key, ix, iy, iz);
+
+                p.minX = std::min(p.minX, ix * voxelSize); p.maxX = std::max(p.maxX, (ix + 1) * voxelSize);
+                p.minY = std::min(p.minY, iy * voxelSize); p.maxY = std::max(p.maxY, (iy + 1) * voxelSize);
+                p.minZ = std::min(p.minZ, iz * voxelSize); p.maxZ = std::max(p.maxZ, (iz + 1) * voxelSize);
+                sx += v.sx; sy += v.sy; sz += v.sz;
+                points += v.count;
+                p.voxels++;
+                if( prev().find(v.key) == NULL ) fresh++;
+
+                for(int n=0; n<6; n++)
+                {
+                    VoxelHash::Voxel *nb = curr().find( VoxelHash::key(ix + offsets[n][0], iy + offsets[n][1], iz + offsets[n][2]) );
+                    if( nb == NULL || nb->label != -1 ) continue;
+                    nb->label = i;
+                    stack.push_back(nb);
+                }
+            }
+            if( p.voxels < PERFORMER_MIN_VOXELS ) continue;
+
+            p.cx = sx / points; p.cy = sy / points; p.cz = sz / points;
+            p.motion = (float) fresh / p.voxels;
+
+            //keep the PERFORMER_MAX biggest, biggest first
+            int pos = r.performerCount;
+            while( pos > 0 && r.performers[pos-1].voxels < p.voxels ) pos--;
+            if( pos >= PERFORMER_MAX ) continue;
+            int last = std::min(r.performerCount, PERFORMER_MAX - 1);
+            for(int k=last; k>pos; k--) r.performers[k] = r.performers[k-1];
+            r.performers[pos] = p;
+            if( r.performerCount < PERFORMER_MAX ) r.performerCount++;
+        }
+    };
+
+public:
+    PointCloudAnalysis(float _voxelSize=VOXEL_SIZE, int _stride=POINT_STRIDE)
+    {
+        voxelSize = _voxelSize;
+        stride = std::max(1, _stride);
+        current = 0;
+        pendingCount = 0;
+        frameIndex = 0;
+        latest.frameIndex = -1;
+        deltas.reserve(1 << VOXEL_HASH_BITS);
+        stack.reserve(1 << VOXEL_HASH_BITS);
+    };
+
+    //xyz is width*height points, 3 floats each, in mm -- eg. an astra::PointFrame's data()
+    void process(const float *xyz, int width, int height)
+    {
+        current = 1 - current;
+        curr().clear();
+
+        Result &r = pendingCount < POINTCLOUD_MAX_PENDING ? pending[pendingCount++] : pending[POINTCLOUD_MAX_PENDING - 1]; //app fell behind -- keep the newest
+        r.frameIndex = frameIndex++;
+
+        binPoints(xyz, width, height);
+        r.occupied = curr().size();
+        findDeltas(r);
+        findPerformers(r);
+        latest = r;
+    };
+
+    //this frame's changed voxels
+    inline const std::vector<Delta> &getDeltas(){ return deltas; };
+
+    //the newest result, sent or not -- NULL before the first frame
+    const Result *getLatest()
+    {
+        return latest.frameIndex >= 0 ? &latest : NULL;
+    };
+
+    //sends every frame analyzed since the last call:
+    //  /depth/voxels (frame, occupied, appeared, vanished)
+    //  /depth/performer (frame, index, cx, cy, cz, minX, minY, minZ, maxX, maxY, maxZ, motion) for each performer
+    void appendOSC(CRCPMotionAnalysis::OscPacketWriter &packet)
+    {
+        static const CRCPMotionAnalysis::OscAddress voxelAddr("/depth/voxels", "ffff");
+        static const CRCPMotionAnalysis::OscAddress performerAddr("/depth/performer", "ffffffffffff");
+
+        for(int f=0; f<pendingCount; f++)
+        {
+            Result &r = pending[f];
+            float counts[4] = { (float) r.frameIndex, (float) r.occupied, (float) r.appeared, (float) r.vanished };
+            packet.append(voxelAddr, counts, 4);
+
+            for(int i=0; i<r.performerCount; i++)
+            {
+                Performer &p = r.performers[i];
+                float args[12] = { (float) r.frameIndex, (float) i, p.cx, p.cy, p.cz, p.minX, p.minY, p.minZ, p.maxX, p.maxY, p.maxZ, p.motion };
+                packet.append(performerAddr, args, 12);
+            }
+        }
+        pendingCount = 0;
+    };
+};
+
+#endif /* PointCloud_h */
@@ -0,0 +1,268 @@
+//
+//  ProcessingGraph.h
+//  Motus
+//
+//  Declarative description of the ugen chain for each body part / sensor, loaded from a json file.
+//  Entity instantiates the nodes from this at startup and again whenever the file changes on disk,
+//  so the chain can be re-wired during a show without restarting.
+//
+//  File layout:
+//  {
+//    "sensors": { "default": "hand", "7": "phone" },     <-- sensor id -> graph name
+//    "graphs": {
+//      "hand": { "part": "hand", "nodes": [
+//          { "name": "input", "type": "InputSignal", "buffer": 48 },
+//          { "name": "avg", "type": "AveragingFilter", "input": "input", "window": 10 },
+//          { "name": "avgViz", "type": "MocapDataVisualizer", "input": "avg", "enabled": false, "color": [0, 0, 1] } ] }
+//    }
+//  }
+//  Numeric keys other than the reserved ones are passed to the node as parameters.
+//  Nodes with "enabled": false are never created & neither is anything downstream of them.
+//
+
+#ifndef ProcessingGraph_h
+#define ProcessingGraph_h
+
+#include "cinder/Json.h"
+#include "cinder/Log.h"
+
+#include <map>
+
+#define GRAPH_CHECK_INTERVAL 1.0 //seconds between checks of the graph file for changes
+#define GRAPH_DEFAULT_NAME "default"
+
+namespace CRCPMotionAnalysis {
+
+//one node (ugen) in the graph
+struct NodeDescription
+{
+    std::string name;
+    std::string type;
+    std::string input; //name of the upstream node, if any
+    std::string input2; //second input for ugens that take two
+    bool enabled = true;
+    bool osc = true; //whether the entity collects this node's osc messages
+    ci::ColorA color = ci::ColorA(1, 1, 1, 1); //only used by visualizers
+    std::map<std::string, double> params;
+    std::map<std::string, std::string> strings; //non-numeric parameters, eg. a filter mode
+
+    double param(const std::string &key, double def) const
+    {
+        std::map<std::string, double>::const_iterator it = params.find(key);
+        return it == params.end() ? def : it->second;
+    };
+
+    std::string text(const std::string &key, const std::string &def) const
+    {
+        std::map<std::string, std::string>::const_iterator it = strings.find(key);
+        return it == strings.end() ? def : it->second;
+    };
+};
+
+//all the nodes for one body part, in the order they are created & updated -- inputs have to come first
+struct GraphDescription
+{
+    std::string part = "hand"; //which body part this graph measures
+    std::vector<NodeDescription> nodes;
+};
+
+//holds the graphs read from the config file & watches it for changes
+class GraphConfig
+{
+protected:
+    ci::fs::path path;
+    std::time_t lastWrite;
+    double lastCheck;
+
+    std::map<std::string, std::string> sensorGraphs; //sensor id -> graph name
+    std::map<std::string, GraphDescription> graphs;
+
+    static bool toBool(const ci::JsonTree &node)
+    {
+        std::string v = node.getValue();
+        return v == "true" || v == "1";
+    };
+
+    static NodeDescription parseNode(const ci::JsonTree &json)
+    {
+        NodeDescription node;
+        for( const ci::JsonTree &child : json.getChildren() )
+        {
+            std::string key = child.getKey();
+            if( key == "name" ) node.name = child.getValue();
+            else if( key == "type" ) node.type = child.getValue();
+            else if( key == "input" ) node.input = child.getValue();
+            else if( key == "input2" ) node.input2 = child.getValue();
+            else if( key == "enabled" ) node.enabled = toBool(child);
+            else if( key == "osc" ) node.osc = toBool(child);
+            else if( key == "color" && child.getNumChildren() >= 3 )
+                node.color = ci::ColorA( child[0].getValue<float>(), child[1].getValue<float>(), child[2].getValue<float>(), 1.0f );
+            else if( child.getValueType() == ci::JsonTree::ValueType::VALUE_STRING )
+                node.strings[key] = child.getValue();
+            else
+                node.params[key] = child.getValue<double>();
+        }
+        if( node.name.empty() ) node.name = node.type;
+        return node;
+    };
+
+public:
+    GraphConfig()
+    {
+        lastWrite = 0;
+        lastCheck = 0;
+        graphs[GRAPH_DEFAULT_NAME] = defaultGraph();
+    };
+
+    //the chain every sensor used to get -- input -> averaging -> 1st & 2nd derivative, with a visualizer on each
+    static GraphDescription defaultGraph()
+    {
+        GraphDescription graph;
+        NodeDescription input, avg, der1, der2, avgViz, der1Viz, der2Viz;
+
+        input.name = "input"; input.type = "InputSignal";
+        avg.name = "avg"; avg.type = "AveragingFilter"; avg.input = "input"; avg.params["window"] = 10;
+        der1.name = "der1"; der1.type = "Derivative"; der1.input = "avg";
+        der2.name = "der2"; der2.type = "Derivative"; der2.input = "der1";
+        avgViz.name = "avgViz"; avgViz.type = "MocapDataVisualizer"; avgViz.input = "avg"; avgViz.color = ci::ColorA(0, 0, 1, 1);
+        der1Viz.name = "der1Viz"; der1Viz.type = "MocapDataVisualizer"; der1Viz.input = "der1"; der1Viz.color = ci::ColorA(1, 0, 0, 1);
+        der2Viz.name = "der2Viz"; der2Viz.type = "MocapDataVisualizer"; der2Viz.input = "der2"; der2Viz.color = ci::ColorA(1, 0, 1, 1);
+
+        graph.nodes = { input, avg, der1, der2, avgViz, der1Viz, der2Viz };
+        return graph;
+    };
+
+    //reads the file. on any error the graphs we already have are kept, so a typo mid-show doesn't take anything down
+    bool load(const ci::fs::path &p)
+    {
+        path = p;
+        if( !ci::fs::exists(path) )
+        {
+            CI_LOG_W( "No graph file at " << path << ", using the default graph" );
+            return false;
+        }
+        lastWrite = ci::fs::last_write_time(path);
+
+        try
+        {
+            ci::JsonTree json( ci::loadFile(path) );
+            std::map<std::string, std::string> newSensors;
+            std::map<std::string, GraphDescription> newGraphs;
+            newGraphs[GRAPH_DEFAULT_NAME] = defaultGraph();
+
+            if( json.hasChild("sensors") )
+            {
+                for( const ci::JsonTree &s : json.getChild("sensors").getChildren() )
+                    newSensors[s.getKey()] = s.getValue();
+            }
+
+            if( json.hasChild("graphs") )
+            {
+                for( const ci::JsonTree &g : json.getChild("graphs").getChildren() )
+                {
+                    GraphDescription graph;
+                    graph.part = g.hasChild("part") ? g.getChild("part").getValue() : g.getKey();
+                    if( g.hasChild("nodes") )
+                    {
+                        for( const ci::JsonTree &n : g.getChild("nodes").getChildren() )
+                            graph.nodes.push_back( parseNode(n) );
+                    }
+                    newGraphs[g.getKey()] = graph;
+                }
+            }
+
+            sensorGraphs = newSensors;
+            graphs = newGraphs;
+            CI_LOG_I( "Loaded processing graph from " << path );
+            return true;
+        }
+        catch( ci::Exception &e )
+        {
+            CI_LOG_E( "Error loading graph file " << path << ": " << e.what() );
+            return false;
+        }
+    };
+
+    //call every frame -- only touches the file system once a second. true if the graphs were reloaded
+    bool checkForChanges(double seconds)
+    {
+        if( path.empty() || seconds - lastCheck < GRAPH_CHECK_INTERVAL ) return false;
+        lastCheck = seconds;
+
+        if( !ci::fs::exists(path) || ci::fs::last_write_time(path) == lastWrite ) return false;
+        return load(path);
+    };
+
+    //which graph a sensor gets -- its own entry, else "default" in the sensors table, else the built in default
+    const GraphDescription &getGraph(const std::string &sensorID)
+    {
+        std::map<std::string, std::string>::iterator it = sensorGraphs.find(sensorID);
+        if( it == sensorGraphs.end() ) it = sensorGraphs.find(GRAPH_DEFAULT_NAME);
+
+        if( it != sensorGraphs.end() && graphs.count(it->second) )
+            return graphs[it->second];
+        return graphs[GRAPH_DEFAULT_NAME];
+    };
+};
+
+//creates the ugen a node describes. returns NULL for types we don't know about
+inline SignalAnalysis *createNode(const NodeDescription &desc, int idz, SensorData *sensor, SignalAnalysis *in1, SignalAnalysis *in2)
+{
+    int bufsize = (int) desc.param("buffer", 48);
+
+    if( desc.type == "InputSignal" )
+    {
+        InputSignal *signal_input = new InputSignal(idz, desc.param("phone", 0) != 0, NULL, bufsize);
+        signal_input->setInput(sensor);
+        return signal_input;
+    }
+    else if( desc.type == "AveragingFilter" )
+        return new AveragingFilter(in1, (int) desc.param("window", 10), bufsize);
+    else if( desc.type == "Resampler" )
+    {
+        Resampler *resampler = new Resampler(in1, desc.param("rate", SR), desc.param("cubic", 0) != 0, bufsize);
+        resampler->setMaxGap( desc.param("maxGap", 0.25) );
+        return resampler;
+    }
+    else if( desc.type == "FilterBank" )
+    {
+        FilterBank::Mode mode = FilterBank::modeFromName( desc.text("mode", "lowpass") );
+        double rate = desc.param("rate", SR);
+        FilterBank *filter = new FilterBank(in1, mode, desc.param("cutoff", 5.0), desc.param("q", 0.7071), rate, bufsize,
+                                            desc.text("address", "/mocap/points").c_str());
+        if( mode == FilterBank::ONE_EURO )
+            filter->setOneEuroParams(desc.param("cutoff", 1.0), desc.param("beta", 0.007), desc.param("dCutoff", 1.0), rate);
+        return filter;
+    }
+    else if( desc.type == "AccelMagnitude" )
+        return new AccelMagnitude(in1, idz, desc.param("rate", SR), bufsize);
+    else if( desc.type == "WindowedEnergy" )
+        return new WindowedEnergy(in1, idz, (int) desc.param("window", 25), (int) desc.param("hop", 0), desc.param("rate", SR), bufsize);
+    else if( desc.type == "Jerk" )
+        return new Jerk(in1, idz, desc.param("rate", SR), bufsize);
+    else if( desc.type == "ZeroCrossingRate" )
+        return new ZeroCrossingRate(in1, idz, (int) desc.param("window", 50), (int) desc.param("hop", 0),
+                                    (int) desc.param("axis", MocapDeviceData::DataIndices::ACCELX), desc.param("rate", SR), bufsize);
+    else if( desc.type == "OnsetDetector" )
+        return new OnsetDetector(in1, idz, desc.param("sensitivity", 3.0), desc.param("refractory", 0.15), desc.param("adapt", 0.02),
+                                 desc.param("rate", SR), bufsize);
+    else if( desc.type == "SpectralAnalysis" )
+        return new SpectralAnalysis(in1, idz, (int) desc.param("size", 256), (int) desc.param("hop", 32), desc.param("rate", SR), bufsize);
+    else if( desc.type == "Derivative" )
+        return new Derivative(in1, bufsize);
+    else if( desc.type == "MocapDataVisualizer" )
+        return new MocapDataVisualizer(in1, (int) desc.param("maxDraw", 25), bufsize);
+
+    CI_LOG_W( "Unknown ugen type in graph: " << desc.type );
+    return NULL;
+};
+
+//does this node type need an upstream node?
+inline bool nodeNeedsInput(const NodeDescription &desc)
+{
+    return desc.type != "InputSignal";
+};
+
+};
+
+#endif /* ProcessingGraph_h */
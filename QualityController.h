@@ -0,0 +1,98 @@
+//
+//  QualityController.h
+//  Motus
+//
+//  Holds the frame rate when the show machine is loaded by trading away analysis quality, instead of letting
+//  update() fall behind -- then the astra backlog grows & the osc goes out in bursts.
+//  Watches how long each frame's work took against the budget -- the main loop's update + draw, or the
+//  slower of the pipeline's workers, whichever is the bottleneck -- and steps through fixed quality levels:
+//  analysis resolution, grid size & whether the square overlay is drawn.
+//  Steps down quickly when over budget, & back up slowly once there's clearly room, so it doesn't oscillate.
+//
+
+#ifndef QualityController_h
+#define QualityController_h
+
+#include <algorithm>
+#include <vector>
+
+#define QUALITY_HIGH_WATER 0.9 //step down when smoothed load is over this fraction of the budget...
+#define QUALITY_LOW_WATER 0.5 //...& up when under this
+#define QUALITY_DOWN_FRAMES 10 //frames in a row over before stepping down
+#define QUALITY_UP_FRAMES 180 //frames in a row under before stepping up -- ~3s at 60fps
+#define QUALITY_SMOOTHING 0.1 //ewma weight of the newest frame
+#define QUALITY_SETTLE_FRAMES 30 //frames after a change before judging the new level -- the load average still has the old one in it
+
+struct QualityLevel
+{
+    const char *name;
+    float analysisScale; //of the window size
+    int gridSize; //squares per side
+    bool drawOverlay; //the square grid over the camera
+};
+
+class QualityController
+{
+protected:
+    std::vector<QualityLevel> levels; //best first
+    int level;
+    bool adaptive;
+    double budget; //seconds a frame
+    double load; //smoothed seconds of the bottleneck
+    int overFrames, underFrames;
+    int settle; //frames left before the next change
+
+public:
+    QualityController(double frameBudget, int fullGrid) : level(0), adaptive(true), budget(frameBudget), load(0), overFrames(0), underFrames(0), settle(0)
+    {
+        QualityLevel table[] = {
+            { "full",     1.0f,  fullGrid,                     true  },
+            { "high",     0.75f, fullGrid,                     true  },
+            { "medium",   0.5f,  fullGrid,                     false },
+            { "low",      0.5f,  std::max(4, fullGrid / 2),    false },
+            { "minimum",  0.25f, std::max(4, fullGrid / 2),    false }
+        };
+        levels.assign( table, table + sizeof(table) / sizeof(table[0]) );
+    };
+
+    //one frame's work -- the main loop's, & the slowest worker stage of the newest analyzed frame. true if the level changed
+    bool update(double mainSeconds, double workerSeconds)
+    {
+        load += QUALITY_SMOOTHING * ( std::max(mainSeconds, workerSeconds) - load );
+        if( !adaptive ) return false;
+        if( settle > 0 ) { settle--; return false; }
+
+        overFrames = load > budget * QUALITY_HIGH_WATER ? overFrames + 1 : 0;
+        underFrames = load < budget * QUALITY_LOW_WATER ? underFrames + 1 : 0;
+
+        int next = level;
+        if( overFrames >= QUALITY_DOWN_FRAMES ) next = std::min<int>(level + 1, levels.size() - 1);
+        else if( underFrames >= QUALITY_UP_FRAMES ) next = std::max(level - 1, 0);
+        if( next == level ) return false;
+
+        setLevel(next);
+        return true;
+    };
+
+    //pins a level, eg. when not adaptive
+    void setLevel(int l)
+    {
+        level = std::max( 0, std::min<int>(l, levels.size() - 1) );
+        overFrames = underFrames = 0; //give the new level time to show its cost
+        settle = QUALITY_SETTLE_FRAMES;
+    };
+
+    void setAdaptive(bool a)
+    {
+        adaptive = a;
+        if( !adaptive ) setLevel(0);
+    };
+
+    inline bool isAdaptive(){ return adaptive; };
+    inline int getLevelIndex(){ return level; };
+    inline const QualityLevel &getLevel(){ return levels[level]; };
+    inline double getLoad(){ return load; }; //smoothed seconds
+    inline double getBudget(){ return budget; };
+};
+
+#endif /* QualityController_h */
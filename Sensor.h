@@ -25,6 +25,14 @@ public:
 //        setDancerLimb(0, 0);
 //        setPareja(0);
         curNumAdded = 0;
+        sampleCount = 0;
+    };
+    
+    //the sensor owns every sample it was handed
+    virtual ~SensorData()
+    {
+        for(int i=0; i<mBuffer.size(); i++) delete mBuffer[i];
+        for(int i=0; i<mSensorData.size(); i++) delete mSensorData[i];
     };
     
     inline int getWhichSensor()
@@ -55,6 +63,9 @@ public:
     
     void addSensorData( MocapDeviceData *data )
     {
+        if( data->getData(MocapDeviceData::DataIndices::INDEX) == NO_DATA )
+            data->setData(MocapDeviceData::DataIndices::INDEX, sampleCount); //running sample number for this sensor
+        sampleCount++;
         mSensorData.push_back(data); //mSensorData gets data from one frame and stores it in a buffer
     };
     
@@ -96,6 +107,12 @@ public:
         return curNumAdded;
     };
     
+    //how many samples this sensor currently owns
+    inline int getBufferedCount()
+    {
+        return mBuffer.size() + mSensorData.size();
+    };
+    
     virtual void resetPlaybackTimer() //TODO
     {
         
@@ -134,6 +151,7 @@ protected:
     std::string mDeviceID;
     int whichSensor;
     int curNumAdded;
+    long sampleCount; //samples received so far
     
     int whichDancer;
     int whichLimb;
@@ -0,0 +1,176 @@
+//
+//  SharedFrameRing.h
+//  Motus
+//
+//  Publishes the binary frame (BinaryFrame.h) into shared memory for consumers on the same machine, eg. visuals
+//  that would otherwise read the osc off loopback. The layout & the reader are MotusRing.h & MotusRing.c, in C so
+//  any consumer can link them. One slot per frame, round a ring of slots: each slot's sequence word is odd while
+//  it's written & even after, & readers check it again after reading -- so the engine never waits on a reader &
+//  a reader can't hold up another. Optionally the difference image goes in the slot too, shrunk to fit.
+//  Turned on by outputs.json:
+//  {
+//    "ring": { "name": "/motus", "slots": 8, "mask": true }
+//  }
+//
+
+#ifndef SharedFrameRing_h
+#define SharedFrameRing_h
+
+#include "cinder/Json.h"
+#include "cinder/Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CinderOpenCV.h"
+#include "BinaryFrame.h"
+#include "MotusRing.h"
+
+static_assert( BINARY_FRAME_MAX <= MOTUS_RING_FRAME_MAX, "binary frames have to fit the ring's slots" );
+static_assert( sizeof(MotusRingHeader) == MOTUS_RING_ALIGN && sizeof(MotusRingSlot) == MOTUS_RING_ALIGN, "the ring's layout is shared w/ C readers" );
+
+namespace CRCPMotionAnalysis {
+
+class SharedFrameRing
+{
+protected:
+    std::string name;
+    int fd;
+    uint8_t *base;
+    size_t size;
+    MotusRingHeader *header;
+    bool mask; //difference images go in the slots
+    uint64_t published;
+
+    inline MotusRingSlot *slotOf(uint64_t frame)
+    {
+        return (MotusRingSlot *) ( base + header->headerSize + ( frame % header->slotCount ) * header->slotSize );
+    };
+
+public:
+    SharedFrameRing() : fd(-1), base(NULL), size(0), header(NULL), mask(false), published(0) {};
+    ~SharedFrameRing(){ close(); };
+
+    //makes the segment, replacing one left by an engine that didn't close it
+    bool open(const std::string &_name, int slots = MOTUS_RING_SLOTS, bool withMask = false)
+    {
+        close();
+        slots = std::max(2, slots);
+        size_t maskMax = withMask ? MOTUS_RING_MASK_MAX_WIDTH * MOTUS_RING_MASK_MAX_HEIGHT : 0;
+        size_t slotSize = sizeof(MotusRingSlot) + MOTUS_RING_FRAME_MAX + maskMax;
+        slotSize = ( slotSize + MOTUS_RING_ALIGN - 1 ) / MOTUS_RING_ALIGN * MOTUS_RING_ALIGN;
+        size_t total = sizeof(MotusRingHeader) + slots * slotSize;
+
+        shm_unlink( _name.c_str() ); //readers still mapping the old one see it closed, or its writer gone
+        fd = shm_open( _name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644 );
+        if( fd < 0 || ftruncate(fd, total) != 0 )
+        {
+            CI_LOG_E( "Could not create the shared memory ring " << _name << ": " << std::strerror(errno) );
+            close();
+            return false;
+        }
+        base = (uint8_t *) mmap( NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if( base == MAP_FAILED )
+        {
+            CI_LOG_E( "Could not map the shared memory ring " << _name << ": " << std::strerror(errno) );
+            base = NULL;
+            close();
+            return false;
+        }
+        name = _name;
+        size = total;
+        mask = withMask;
+        published = 0;
+
+        //a new segment is zeroed, so every slot's sequence starts even & empty
+        header = (MotusRingHeader *) base;
+        header->version = MOTUS_RING_VERSION;
+        header->headerSize = sizeof(MotusRingHeader);
+        header->slotCount = slots;
+        header->slotSize = slotSize;
+        header->frameMax = MOTUS_RING_FRAME_MAX;
+        header->maskMax = maskMax;
+        header->writerPid = getpid();
+        __atomic_store_n( &header->magic, MOTUS_RING_MAGIC, __ATOMIC_RELEASE ); //last -- readers check it
+        CI_LOG_I( "Shared memory ring " << name << " -- " << slots << " slots of " << slotSize << " bytes" );
+        return true;
+    };
+
+    void close()
+    {
+        if( header ) __atomic_store_n( &header->closed, 1, __ATOMIC_RELEASE );
+        if( base ) munmap(base, size);
+        if( fd >= 0 )
+        {
+            ::close(fd);
+            shm_unlink( name.c_str() );
+        }
+        fd = -1;
+        base = NULL;
+        header = NULL;
+    };
+
+    //the "ring" block of outputs.json. false if there isn't one
+    bool load(const ci::fs::path &path)
+    {
+        if( path.empty() || !ci::fs::exists(path) ) return false;
+        try
+        {
+            ci::JsonTree json( ci::loadFile(path) );
+            if( !json.hasChild("ring") ) return false;
+            const ci::JsonTree &r = json.getChild("ring");
+            return open( r.hasChild("name") ? r.getValueForKey("name") : MOTUS_RING_NAME,
+                         r.hasChild("slots") ? r.getValueForKey<int>("slots") : MOTUS_RING_SLOTS,
+                         r.hasChild("mask") && r.getValueForKey<bool>("mask") );
+        }
+        catch( ci::Exception &e )
+        {
+            CI_LOG_E( "Error loading the shared memory ring from " << path << ": " << e.what() );
+            return false;
+        }
+    };
+
+    //one frame into the next slot. diff, if there is one & the ring takes it, is shrunk straight into the slot
+    void publish(const uint8_t *frame, size_t frameSize, const cv::Mat *diff = NULL)
+    {
+        if( !header || frameSize > MOTUS_RING_FRAME_MAX ) return;
+        MotusRingSlot *slot = slotOf(published);
+        uint8_t *data = (uint8_t *) slot + sizeof(MotusRingSlot);
+
+        __atomic_store_n( &slot->seq, 2 * published + 1, __ATOMIC_RELAXED );
+        __atomic_thread_fence(__ATOMIC_RELEASE); //odd before any of the data changes
+
+        std::memcpy( data, frame, frameSize );
+        slot->frameSize = frameSize;
+        slot->maskWidth = slot->maskHeight = 0;
+        slot->maskOffset = MOTUS_RING_FRAME_MAX;
+        if( mask && diff && diff->type() == CV_8UC1 && !diff->empty() )
+        {
+            float scale = std::min( 1.0f, std::min( MOTUS_RING_MASK_MAX_WIDTH / (float) diff->cols, MOTUS_RING_MASK_MAX_HEIGHT / (float) diff->rows ) );
+            cv::Mat dst( std::max( 1, (int) ( diff->rows * scale ) ), std::max( 1, (int) ( diff->cols * scale ) ), CV_8UC1, data + MOTUS_RING_FRAME_MAX );
+            if( dst.size() == diff->size() ) diff->copyTo(dst);
+            else cv::resize( *diff, dst, dst.size(), 0, 0, cv::INTER_AREA );
+            slot->maskWidth = dst.cols;
+            slot->maskHeight = dst.rows;
+        }
+
+        __atomic_store_n( &slot->seq, 2 * published + 2, __ATOMIC_RELEASE );
+        published++;
+        __atomic_store_n( &header->published, published, __ATOMIC_RELEASE );
+    };
+
+    inline bool isOpen(){ return header != NULL; };
+    inline bool wantsMask(){ return header != NULL && mask; };
+    inline uint64_t getPublished(){ return published; };
+};
+
+};
+
+#endif /* SharedFrameRing_h */
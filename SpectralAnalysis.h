@@ -0,0 +1,241 @@
+//
+//  SpectralAnalysis.h
+//  Motus
+//
+//  Looks at motion in the frequency domain -- sliding window FFT of a sensor's |accel| for band energies & the
+//  dominant movement tempo, so sound can be synced to a performer's periodic motion.
+//  Windows overlap: every hop new samples the last N are windowed & transformed. Between hops a sample costs
+//  one ring buffer write. The FFT plan (twiddles, bit reversal, window) is built once per size & shared by every
+//  sensor, and the work buffers belong to the ugen, so nothing is allocated after the first frame.
+//
+
+#ifndef SpectralAnalysis_h
+#define SpectralAnalysis_h
+
+#include <cmath>
+#include <map>
+#include <memory>
+
+#define SPECTRUM_BAND_COUNT 5
+#define TEMPO_MIN_HZ 0.5 //30 bpm
+#define TEMPO_MAX_HZ 4.0 //240 bpm
+
+namespace CRCPMotionAnalysis {
+
+//precomputed tables for an in place radix 2 FFT of size n
+class FFTPlan
+{
+protected:
+    int n;
+    std::vector<float> cosTable, sinTable;
+    std::vector<int> bitReverse;
+    std::vector<float> window; //hann
+
+public:
+    FFTPlan(int size)
+    {
+        n = size;
+        int bits = 0;
+        while( (1 << bits) < n ) bits++;
+
+        cosTable.resize(n/2);
+        sinTable.resize(n/2);
+        for(int i=0; i<n/2; i++)
+        {
+            cosTable[i] = std::cos(2 * M_PI * i / n);
+            sinTable[i] = -std::sin(2 * M_PI * i / n);
+        }
+
+        bitReverse.resize(n);
+        for(int i=0; i<n; i++)
+        {
+            int r = 0;
+            for(int b=0; b<bits; b++) if( i & (1 << b) ) r |= 1 << (bits - 1 - b);
+            bitReverse[i] = r;
+        }
+
+        window.resize(n);
+        for(int i=0; i<n; i++) window[i] = 0.5f * ( 1 - std::cos(2 * M_PI * i / (n - 1)) );
+    };
+
+    //one plan per size, shared by all the ugens
+    static FFTPlan *get(int size)
+    {
+        static std::map<int, std::unique_ptr<FFTPlan> > plans;
+        std::unique_ptr<FFTPlan> &plan = plans[size];
+        if( !plan ) plan.reset( new FFTPlan(size) );
+        return plan.get();
+    };
+
+    inline int size(){ return n; };
+    inline const float *getWindow(){ return &window[0]; };
+
+    //forward transform, in place
+    void forward(float *re, float *im)
+    {
+        for(int i=0; i<n; i++)
+        {
+            int j = bitReverse[i];
+            if( j > i ) { std::swap(re[i], re[j]); std::swap(im[i], im[j]); }
+        }
+
+        for(int len=2; len<=n; len<<=1)
+        {
+            int half = len >> 1;
+            int step = n / len;
+            for(int i=0; i<n; i+=len)
+            {
+                for(int k=0; k<half; k++)
+                {
+                    float wr = cosTable[k*step], wi = sinTable[k*step];
+                    int a = i + k, b = i + k + half;
+                    float tr = re[b]*wr - im[b]*wi;
+                    float ti = re[b]*wi + im[b]*wr;
+                    re[b] = re[a] - tr; im[b] = im[a] - ti;
+                    re[a] += tr; im[a] += ti;
+                }
+            }
+        }
+    };
+};
+
+//sliding window spectrum of |accel|. sends /mocap/bands (id, 5 band energies) & /mocap/tempo (id, bpm, confidence) every hop.
+//writes the dominant frequency in Hz to ACCELX & the bpm to ACCELY
+class SpectralAnalysis : public FeatureSignalAnalysis
+{
+protected:
+    FFTPlan *plan;
+    int n, hop;
+
+    std::vector<float> history; //ring buffer of the last n inputs
+    std::vector<float> re, im, power; //work buffers
+    int pos, filled, sinceHop;
+
+    float bands[SPECTRUM_BAND_COUNT];
+    float bpm, confidence;
+    bool analyzed; //did this frame produce a new analysis?
+
+    //band edges in Hz -- low movement to fast shaking. the last band runs up to nyquist
+    static double bandEdge(int i)
+    {
+        static const double edges[SPECTRUM_BAND_COUNT] = { 0.25, 1.0, 2.0, 4.0, 8.0 };
+        return edges[i];
+    };
+
+    void analyze()
+    {
+        //unroll the ring buffer oldest first, remove the mean (gravity) & window
+        double mean = 0;
+        for(int i=0; i<n; i++) mean += history[i];
+        mean /= n;
+
+        const float *w = plan->getWindow();
+        for(int i=0; i<n; i++)
+        {
+            re[i] = ( history[(pos + i) % n] - mean ) * w[i];
+            im[i] = 0;
+        }
+        plan->forward(&re[0], &im[0]);
+
+        int bins = n / 2;
+        double binHz = rate / n;
+        double total = 0;
+        for(int k=0; k<bins; k++)
+        {
+            power[k] = re[k]*re[k] + im[k]*im[k];
+            total += power[k];
+        }
+
+        for(int b=0; b<SPECTRUM_BAND_COUNT; b++)
+        {
+            double lo = bandEdge(b);
+            double hi = b+1 < SPECTRUM_BAND_COUNT ? bandEdge(b+1) : rate / 2;
+            double sum = 0;
+            for(int k = std::ceil(lo / binHz); k < bins && k * binHz < hi; k++) sum += power[k];
+            bands[b] = sum / n;
+        }
+
+        //dominant tempo -- strongest bin in the tempo range, refined by fitting a parabola through its neighbours
+        int lo = std::max(1, (int) std::ceil(TEMPO_MIN_HZ / binHz));
+        int hi = std::min(bins - 2, (int) std::floor(TEMPO_MAX_HZ / binHz));
+        int best = lo;
+        for(int k=lo; k<=hi; k++) if( power[k] > power[best] ) best = k;
+
+        double offset = 0;
+        double denom = power[best-1] - 2*power[best] + power[best+1];
+        if( denom != 0 ) offset = 0.5 * ( power[best-1] - power[best+1] ) / denom;
+        double hz = ( best + offset ) * binHz;
+
+        bpm = hz * 60;
+        confidence = total > 0 ? power[best] / total : 0; //how much of the motion is at that tempo
+        analyzed = true;
+    };
+
+    virtual void processSample(MocapDeviceData *sample)
+    {
+        history[pos] = magnitude(sample);
+        pos = (pos + 1) % n;
+        if( filled < n ) filled++;
+
+        if( ++sinceHop >= hop && filled == n )
+        {
+            sinceHop = 0;
+            analyze();
+            static const OscAddress tempoAddr("/mocap/tempo", "fff");
+            queueEvent(tempoAddr, bpm, confidence);
+        }
+
+        MocapDeviceData *mdd = new MocapDeviceData();
+        mdd->setData(MocapDeviceData::DataIndices::INDEX, sample->getData(MocapDeviceData::DataIndices::INDEX));
+        mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, sample->getData(MocapDeviceData::DataIndices::TIME_STAMP));
+        mdd->setData(MocapDeviceData::DataIndices::ACCELX, bpm / 60);
+        mdd->setData(MocapDeviceData::DataIndices::ACCELY, bpm);
+        emitSample(mdd);
+    };
+
+public:
+    //size is rounded up to a power of 2. at SR, 256 samples is 5 seconds -- ~0.2Hz bins
+    SpectralAnalysis(SignalAnalysis *s1, int id, int size=256, int _hop=32, double rate=SR, int bufsize=48) : FeatureSignalAnalysis(s1, id, rate, bufsize)
+    {
+        n = 16;
+        while( n < size ) n <<= 1;
+        hop = std::max(1, _hop);
+        plan = FFTPlan::get(n);
+
+        history.assign(n, 0);
+        re.assign(n, 0);
+        im.assign(n, 0);
+        power.assign(n/2, 0);
+        pos = filled = sinceHop = 0;
+
+        for(int i=0; i<SPECTRUM_BAND_COUNT; i++) bands[i] = 0;
+        bpm = confidence = 0;
+        analyzed = false;
+    };
+
+    virtual void update(float seconds = 0)
+    {
+        analyzed = false;
+        FeatureSignalAnalysis::update(seconds);
+    };
+
+    virtual void appendOSC(OscPacketWriter &packet)
+    {
+        FeatureSignalAnalysis::appendOSC(packet);
+        if( !analyzed ) return;
+
+        static const OscAddress bandAddr("/mocap/bands", "ffffff");
+        float args[SPECTRUM_BAND_COUNT + 1];
+        args[0] = sensorID;
+        for(int i=0; i<SPECTRUM_BAND_COUNT; i++) args[i+1] = bands[i];
+        packet.append(bandAddr, args, SPECTRUM_BAND_COUNT + 1);
+    };
+
+    inline float getBPM(){ return bpm; };
+    inline float getConfidence(){ return confidence; };
+    inline const float *getBands(){ return bands; };
+};
+
+};
+
+#endif /* SpectralAnalysis_h */
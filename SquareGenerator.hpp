@@ -11,39 +11,37 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/video/tracking.hpp>
 
-#include "cinder/app/App.h"
-#include "cinder/app/RendererGl.h"
-#include "cinder/gl/gl.h"
-#include "cinder/Capture.h" //includes capture object
 #include "cinder/Log.h" //logs exceptions if something is wrong with capture object
 
 
 #include "CinderOpenCV.h"
+#include "AnalysisMask.h"
 
 #include <iostream>
 #include <vector>
 #include <random>
 
 using namespace ci;
-using namespace ci::app;
 using namespace std;
 
-#define SCREEN_WIDTH 640
-#define SCREEN_HEIGHT 480
+//square motion & positions are fixed point fractions of the whole -- MOTION_FIXED_ONE is 1.0 -- so they mean the same
+//thing for any grid, sensor or window size, & the per-square work stays integer
+#define MOTION_FIXED_BITS 16
+#define MOTION_FIXED_ONE (1 << MOTION_FIXED_BITS)
 
-#define SQUARE_WIDTH 64
-#define SQUARE_HEIGHT 48
+inline float motionFixedToFloat(int32_t v) { return (float) v / MOTION_FIXED_ONE; }
 
 /*********************************************/
 
 /**
  * Square class
  * Creates a square object that stores square attributes (number of features, x, y, width, height)
+ * & its motion -- the features as a fixed point fraction of what the square could hold
 **/
 
 class Square {
 protected:
-    int xPos{}, yPos{}, squareWidth{}, squareHeight{}, numFeatures{};
+    int xPos{}, yPos{}, squareWidth{}, squareHeight{}, numFeatures{}, motion{};
     
 public:
     Square() {}
@@ -53,30 +51,34 @@ public:
     void setWidth(int width);
     void setHeight(int height);
     void setFeatureCount(int num);
+    void setMotion(int m);
     int getXPos();
     int getYPos();
     int getWidth();
     int getHeight();
     int getFeatureCount();
+    int getMotion();
 };
 
-Square::Square(int x, int y, int width, int height) {
+inline Square::Square(int x, int y, int width, int height) {
     xPos = x;
     yPos = y;
     squareWidth = width;
     squareHeight = height;
 }
 
-void Square::setXPos(int x) { xPos = x; }
-void Square::setYPos(int y) { yPos = y; }
-void Square::setWidth(int width) { squareWidth = width; }
-void Square::setHeight(int height) { squareHeight = height; }
-void Square::setFeatureCount(int num) { numFeatures = num; }
-int Square::getXPos() { return xPos; }
-int Square::getYPos() { return yPos; }
-int Square::getWidth() { return squareWidth; }
-int Square::getHeight() { return squareHeight; }
-int Square::getFeatureCount() { return numFeatures; }
+inline void Square::setXPos(int x) { xPos = x; }
+inline void Square::setYPos(int y) { yPos = y; }
+inline void Square::setWidth(int width) { squareWidth = width; }
+inline void Square::setHeight(int height) { squareHeight = height; }
+inline void Square::setFeatureCount(int num) { numFeatures = num; }
+inline void Square::setMotion(int m) { motion = m; }
+inline int Square::getXPos() { return xPos; }
+inline int Square::getYPos() { return yPos; }
+inline int Square::getWidth() { return squareWidth; }
+inline int Square::getHeight() { return squareHeight; }
+inline int Square::getFeatureCount() { return numFeatures; }
+inline int Square::getMotion() { return motion; }
 
 /*********************************************/
 
@@ -87,29 +89,40 @@ int Square::getFeatureCount() { return numFeatures; }
 class SquareGenerator {
 protected:
     vector<Square> squares;
+    int gridSize = 0; //squares per side
+    int layoutVersion = 0; //+1 every divideScreen, so a drawing of the squares knows to redo its layout
 public:
     SquareGenerator() {}
-    void divideScreen(int);
+    void divideScreen(int numSquares, int width, int height);
     void squareProperties(); //test function for squares
-    void displaySquares();
+    vector<Square> &getSquares() { return squares; }
+    int getGridSize() { return gridSize; }
+    int getLayoutVersion() { return layoutVersion; }
+    int32_t getCenterX(int i) { return ( (int64_t) ( 2 * ( i / gridSize ) + 1 ) << MOTION_FIXED_BITS ) / ( 2 * gridSize ); } //square i's center, fixed point
+    int32_t getCenterY(int i) { return ( (int64_t) ( 2 * ( i % gridSize ) + 1 ) << MOTION_FIXED_BITS ) / ( 2 * gridSize ); }
 };
 
-void SquareGenerator::divideScreen(int numSquares)
+//numSquares x numSquares squares over a width x height frame, column by column -- the same order for any frame size,
+//so counts from an analysis at one resolution line up with squares at another
+inline void SquareGenerator::divideScreen(int numSquares, int width, int height)
 {
-    int squareWidth = getWindowWidth()/numSquares;
-    int squareHeight = getWindowHeight()/numSquares;
-    for (int i = 0; i < getWindowWidth(); i += squareWidth)
+    squares.clear();
+    gridSize = numSquares;
+    layoutVersion++;
+    int squareWidth = width/numSquares;
+    int squareHeight = height/numSquares;
+    for (int i = 0; i < numSquares; i++)
     {
-        for ( int j = 0; j < getWindowHeight(); j+= squareHeight)
+        for ( int j = 0; j < numSquares; j++)
         {
-            Square square(i, j, squareWidth, squareHeight);
+            Square square(i * squareWidth, j * squareHeight, squareWidth, squareHeight);
             squares.push_back(square);
         }
     }
     //squareProperties();
 }
 
-void SquareGenerator::squareProperties()
+inline void SquareGenerator::squareProperties()
 {
     cout << "Size of square vector: " << squares.size() << endl;
     cout << "**********************" << endl;
@@ -124,25 +137,18 @@ void SquareGenerator::squareProperties()
     }
 }
 
-void SquareGenerator::displaySquares() //displays the squares on-screen with transparency varying based on number of features
-{
-    int norm = 1005555; //normalizing variable for color/transparecy
-    
-    //squareFeatureProperties();
-    for (int i = 0; i < squares.size(); i++)
-    {
-        if (squares[i].getFeatureCount() > 0) //draw the square
-        {
-            gl::color(0, 1, 0,  (float)squares[i].getFeatureCount() / norm ); //set color based on features
-        } else {
-            gl::color(1, 1, 1);
-        }
-        gl::drawSolidRect( Rectf( squares[i].getXPos(), squares[i].getYPos(), squares[i].getXPos() + SQUARE_WIDTH, squares[i].getYPos() + SQUARE_HEIGHT  ) );
-    }
-}
-
 /*********************************************/
 
+/**
+ * The square w/ the most motion, all fixed point fractions -- the square's center in the grid & how much of it changed
+**/
+
+struct MotionPeak
+{
+    int square = -1; //none moved
+    int32_t x = 0, y = 0, motion = 0;
+};
+
 /**
  * Child class inheriting from abstract class SquareGenerator
  * Displays squares based on frame differencing
@@ -151,21 +157,21 @@ void SquareGenerator::displaySquares() //displays the squares on-screen with tra
 class SquareFrameDiff : public SquareGenerator
 {
 public:
-    void countPixels(cv::Mat);
+    void countPixels(cv::Mat, AnalysisMask *mask = NULL);
+    void normalize();
+    MotionPeak getPeak();
     int getGreatestSquareSum();
     Square getSquareWithMaxMotion();
-    int getMotionValue();
-    int getMaxXValue();
-    int getMaxYValue();
 };
 
-void SquareFrameDiff::countPixels(cv::Mat outputImg) //counts the number of pixels in each square area
+inline void SquareFrameDiff::countPixels(cv::Mat outputImg, AnalysisMask *mask) //counts the number of pixels in each square area
 {
     int pixelAddition = 0;
     for (int i = 0; i < squares.size(); i++) //cycle through square vector
     {
         pixelAddition = 0;
         squares[i].setFeatureCount(0);
+        if (mask && !mask->anyLive( cv::Rect(squares[i].getXPos(), squares[i].getYPos(), squares[i].getWidth(), squares[i].getHeight()) )) continue; //all masked out, nothing to count
         for(int a = squares[i].getXPos(); a < squares[i].getXPos() + squares[i].getWidth(); a++)
         {
             for(int b = squares[i].getYPos(); b < squares[i].getYPos() + squares[i].getHeight(); b++)
@@ -177,7 +183,40 @@ void SquareFrameDiff::countPixels(cv::Mat outputImg) //counts the number of pixe
     }
 }
 
-int SquareFrameDiff::getGreatestSquareSum() //sums all the pixels in each square for "total motion"
+//each square's count as a fraction of a square all 255 -- one reciprocal for the grid, then a multiply & shift a square
+inline void SquareFrameDiff::normalize()
+{
+    if (squares.empty()) return;
+    uint64_t full = (uint64_t) squares[0].getWidth() * squares[0].getHeight() * 255; //every square is the same size
+    uint64_t reciprocal = full > 0 ? ( (uint64_t) 1 << 32 ) / full : 0;
+    for (int i = 0; i < squares.size(); i++)
+    {
+        uint64_t count = std::max( 0, squares[i].getFeatureCount() );
+        squares[i].setMotion( (int) std::min<uint64_t>( ( count * reciprocal ) >> ( 32 - MOTION_FIXED_BITS ), MOTION_FIXED_ONE ) );
+    }
+}
+
+//the first square w/ the most motion -- normalize() first
+inline MotionPeak SquareFrameDiff::getPeak()
+{
+    MotionPeak peak;
+    for (int i = 0; i < squares.size(); i++)
+    {
+        if (squares[i].getMotion() > peak.motion)
+        {
+            peak.square = i;
+            peak.motion = squares[i].getMotion();
+        }
+    }
+    if (peak.square >= 0)
+    {
+        peak.x = getCenterX(peak.square);
+        peak.y = getCenterY(peak.square);
+    }
+    return peak;
+}
+
+inline int SquareFrameDiff::getGreatestSquareSum() //sums all the pixels in each square for "total motion"
 {
     int sum = 0;
     for (int i = 0; i < squares.size(); i++)
@@ -187,7 +226,7 @@ int SquareFrameDiff::getGreatestSquareSum() //sums all the pixels in each square
     return sum;
 }
 
-Square SquareFrameDiff::getSquareWithMaxMotion() //figure out which squre has the max motion, returns it so that you can get the feature count, the x pos, and the y pos
+inline Square SquareFrameDiff::getSquareWithMaxMotion() //figure out which squre has the max motion, returns it so that you can get the feature count, the x pos, and the y pos
 {
     Square maxSquare;
     for (int i = 0; i < squares.size(); i++)
@@ -201,27 +240,4 @@ Square SquareFrameDiff::getSquareWithMaxMotion() //figure out which squre has th
     return maxSquare;
 }
 
-int SquareFrameDiff::getMotionValue()
-{
-    int max = getSquareWithMaxMotion().getFeatureCount();
-    //cout << "motionVal: " << max << endl;
-    return max;
-}
-
-int SquareFrameDiff::getMaxXValue()
-{
-    int x = getSquareWithMaxMotion().getXPos();
-    //cout << "maxX: " << x << endl;
-    return x;
-}
-
-int SquareFrameDiff::getMaxYValue()
-{
-    int y = getSquareWithMaxMotion().getYPos();
-    //cout << "maxY: " << y << endl;
-    return y;
-}
-
-
-
 /*********************************************/
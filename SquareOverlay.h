@@ -0,0 +1,89 @@
+//
+//  SquareOverlay.h
+//  Motus
+//
+//  Draws the engine's squares over the window -- the app's side of SquareGenerator, so the engine's headers stay
+//  free of gl. One instanced draw of a unit rect, placed & colored per square: rebuilt when the layout changes,
+//  otherwise only the motion is uploaded. Drawn over the camera, so still squares are left clear.
+//
+
+#ifndef SquareOverlay_h
+#define SquareOverlay_h
+
+#include "cinder/gl/gl.h"
+
+#include <vector>
+
+#include "SquareGenerator.hpp"
+
+class SquareOverlay
+{
+protected:
+    ci::gl::BatchRef batch;
+    ci::gl::VboRef motionVbo;
+    std::vector<float> alphas;
+    int layoutVersion = -1; //of the squares the batch was built for
+
+    void build(SquareGenerator &generator)
+    {
+        static ci::gl::GlslProgRef shader = ci::gl::GlslProg::create( ci::gl::GlslProg::Format()
+            .vertex( CI_GLSL( 150,
+                uniform mat4 ciModelViewProjection;
+                in vec4 ciPosition;
+                in vec4 squareRect; //x, y, width, height
+                in float squareMotion;
+                out vec4 vColor;
+                void main()
+                {
+                    vColor = vec4( 0.0, 1.0, 0.0, squareMotion );
+                    gl_Position = ciModelViewProjection * vec4( squareRect.xy + ciPosition.xy * squareRect.zw, 0.0, 1.0 );
+                } ) )
+            .fragment( CI_GLSL( 150,
+                in vec4 vColor;
+                out vec4 oColor;
+                void main()
+                {
+                    if( vColor.a <= 0.0 ) discard; //still -- the camera shows through
+                    oColor = vColor;
+                } ) ) );
+
+        std::vector<Square> &squares = generator.getSquares();
+        std::vector<ci::vec4> rects( squares.size() );
+        for (int i = 0; i < squares.size(); i++)
+        {
+            rects[i] = ci::vec4( squares[i].getXPos(), squares[i].getYPos(), squares[i].getWidth(), squares[i].getHeight() );
+        }
+        alphas.assign( squares.size(), 0.0f );
+
+        ci::gl::VboRef rectVbo = ci::gl::Vbo::create( GL_ARRAY_BUFFER, rects, GL_STATIC_DRAW );
+        motionVbo = ci::gl::Vbo::create( GL_ARRAY_BUFFER, alphas, GL_DYNAMIC_DRAW );
+        ci::geom::BufferLayout rectLayout, motionLayout;
+        rectLayout.append( ci::geom::Attrib::CUSTOM_0, 4, 0, 0, 1 ); //one per instance
+        motionLayout.append( ci::geom::Attrib::CUSTOM_1, 1, 0, 0, 1 );
+
+        ci::gl::VboMeshRef mesh = ci::gl::VboMesh::create( ci::geom::Rect( ci::Rectf(0, 0, 1, 1) ) );
+        mesh->appendVbo( rectLayout, rectVbo );
+        mesh->appendVbo( motionLayout, motionVbo );
+        batch = ci::gl::Batch::create( mesh, shader, { { ci::geom::Attrib::CUSTOM_0, "squareRect" }, { ci::geom::Attrib::CUSTOM_1, "squareMotion" } } );
+        layoutVersion = generator.getLayoutVersion();
+    };
+
+public:
+    //the squares w/ transparency varying w/ their motion, blended over what's already drawn
+    void draw(SquareGenerator &generator)
+    {
+        std::vector<Square> &squares = generator.getSquares();
+        if (squares.empty()) return;
+        if (generator.getLayoutVersion() != layoutVersion || !batch) build(generator);
+
+        for (int i = 0; i < squares.size(); i++)
+        {
+            alphas[i] = motionFixedToFloat( squares[i].getMotion() ); //green w/ this alpha, clear when still
+        }
+        motionVbo->bufferSubData( 0, alphas.size() * sizeof(float), alphas.data() );
+        ci::gl::ScopedBlendAlpha blend;
+        batch->drawInstanced( (GLsizei) squares.size() ); //every square in one draw
+    };
+};
+
+#endif /* SquareOverlay_h */
@@ -0,0 +1,245 @@
+//
+//  Stats.h
+//  Motus
+//
+//  Timing of every stage -- osc ingest, sensor & ugen updates, the cv stages, osc send & draw -- so frame time
+//  & which stage blew the budget can be seen during a performance w/o attaching a profiler.
+//  Each named timer is a histogram w/ fixed log scale buckets of atomic counters, so any thread records into it
+//  w/o a lock. Only registering a new name takes the registry's lock, & the pointer it returns never moves, so
+//  callers look a timer up once & keep it.
+//    MOTUS_TIME_SCOPE("osc/send"); <-- times the rest of the enclosing scope
+//
+
+#ifndef Stats_h
+#define Stats_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define STATS_BUCKETS_PER_OCTAVE 4 //~19% wide buckets, so percentiles are within that of the real value
+#define STATS_BUCKET_COUNT 112 //1us to ~4min
+
+namespace CRCPMotionAnalysis {
+
+//durations of one stage. recorded from any thread, read from any thread
+class LatencyHistogram
+{
+protected:
+    std::string name;
+    bool frameStage; //does the main loop wait on this? only those can be blamed for a long frame
+    std::atomic<uint32_t> buckets[STATS_BUCKET_COUNT];
+    std::atomic<uint32_t> count;
+    std::atomic<uint64_t> sumMicros, maxMicros;
+    std::atomic<uint32_t> lastMicros;
+    std::atomic<uint32_t> lastFrame; //the registry's frame when it was last recorded
+
+    static inline int bucketOf(double micros)
+    {
+        if( micros < 1 ) return 0;
+        int b = (int) ( std::log2(micros) * STATS_BUCKETS_PER_OCTAVE ) + 1;
+        return std::min(b, STATS_BUCKET_COUNT - 1);
+    };
+
+    //upper edge of a bucket, seconds
+    static inline double bucketTop(int b)
+    {
+        return std::pow( 2.0, double(b) / STATS_BUCKETS_PER_OCTAVE ) * 1e-6;
+    };
+
+public:
+    LatencyHistogram(const std::string &n, bool inFrame) : name(n), frameStage(inFrame)
+    {
+        reset();
+    };
+
+    void record(double seconds, uint32_t frame)
+    {
+        double micros = std::max(0.0, seconds * 1e6);
+        uint64_t m = (uint64_t) micros;
+        buckets[ bucketOf(micros) ].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumMicros.fetch_add(m, std::memory_order_relaxed);
+        lastMicros.store( (uint32_t) std::min<uint64_t>(m, UINT32_MAX), std::memory_order_relaxed );
+        lastFrame.store(frame, std::memory_order_relaxed);
+
+        uint64_t prev = maxMicros.load(std::memory_order_relaxed);
+        while( m > prev && !maxMicros.compare_exchange_weak(prev, m, std::memory_order_relaxed) );
+    };
+
+    //not atomic w/ recording, so a sample recorded during a reset may be half counted. fine for stats
+    void reset()
+    {
+        for(int i=0; i<STATS_BUCKET_COUNT; i++) buckets[i].store(0, std::memory_order_relaxed);
+        count = 0;
+        sumMicros = 0;
+        maxMicros = 0;
+        lastMicros = 0;
+        lastFrame = 0;
+    };
+
+    //seconds that a fraction p of the samples were under, eg. 0.99. to the top of the bucket, capped at the max
+    double percentile(double p)
+    {
+        uint32_t counts[STATS_BUCKET_COUNT];
+        uint64_t total = 0;
+        for(int i=0; i<STATS_BUCKET_COUNT; i++)
+        {
+            counts[i] = buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if( total == 0 ) return 0;
+
+        uint64_t target = std::max<uint64_t>( 1, (uint64_t) std::ceil( p * total ) );
+        uint64_t seen = 0;
+        int b = 0;
+        for( ; b<STATS_BUCKET_COUNT - 1; b++ )
+        {
+            seen += counts[b];
+            if( seen >= target ) break;
+        }
+        return std::min( bucketTop(b), getMax() );
+    };
+
+    inline const std::string &getName(){ return name; };
+    inline bool isFrameStage(){ return frameStage; };
+    inline uint32_t getCount(){ return count.load(std::memory_order_relaxed); };
+    inline double getMean(){ uint32_t c = getCount(); return c ? sumMicros.load(std::memory_order_relaxed) * 1e-6 / c : 0; };
+    inline double getMax(){ return maxMicros.load(std::memory_order_relaxed) * 1e-6; };
+    inline double getLast(){ return lastMicros.load(std::memory_order_relaxed) * 1e-6; };
+    inline uint32_t getLastFrame(){ return lastFrame.load(std::memory_order_relaxed); };
+};
+
+//every timer by name. the app's main loop calls beginFrame() so a long frame can be pinned on a stage
+class StatsRegistry
+{
+protected:
+    std::mutex mutex; //only for adding timers & walking the list
+    std::vector< std::unique_ptr<LatencyHistogram> > timers;
+    std::atomic<uint32_t> frame;
+    std::chrono::steady_clock::time_point clockStart;
+
+    StatsRegistry()
+    {
+        frame = 1; //0 is never recorded
+        clockStart = std::chrono::steady_clock::now();
+    };
+
+public:
+    static StatsRegistry &instance()
+    {
+        static StatsRegistry registry;
+        return registry;
+    };
+
+    //the timer w/ this name, created the first time. inFrame is false for stages off the main loop, eg. the cv workers
+    static LatencyHistogram *get(const std::string &name, bool inFrame=true)
+    {
+        StatsRegistry &r = instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for(int i=0; i<r.timers.size(); i++)
+            if( r.timers[i]->getName() == name ) return r.timers[i].get();
+        r.timers.push_back( std::unique_ptr<LatencyHistogram>( new LatencyHistogram(name, inFrame) ) );
+        return r.timers.back().get();
+    };
+
+    //seconds on a steady clock
+    static inline double now()
+    {
+        return std::chrono::duration<double>( std::chrono::steady_clock::now() - instance().clockStart ).count();
+    };
+
+    static inline void record(LatencyHistogram *timer, double seconds)
+    {
+        timer->record( seconds, instance().frame.load(std::memory_order_relaxed) );
+    };
+
+    static inline void beginFrame(){ instance().frame++; };
+
+    //the frame stage that took the longest this frame, or NULL
+    static LatencyHistogram *slowestThisFrame(const LatencyHistogram *exclude=NULL)
+    {
+        StatsRegistry &r = instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        uint32_t f = r.frame.load(std::memory_order_relaxed);
+        LatencyHistogram *slowest = NULL;
+        for(int i=0; i<r.timers.size(); i++)
+        {
+            LatencyHistogram *t = r.timers[i].get();
+            if( t == exclude || !t->isFrameStage() || t->getLastFrame() != f ) continue;
+            if( slowest == NULL || t->getLast() > slowest->getLast() ) slowest = t;
+        }
+        return slowest;
+    };
+
+    //the timers at this moment -- they keep recording, but the list of them is safe to use
+    static std::vector<LatencyHistogram *> all()
+    {
+        StatsRegistry &r = instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<LatencyHistogram *> list;
+        for(int i=0; i<r.timers.size(); i++) list.push_back( r.timers[i].get() );
+        return list;
+    };
+
+    static void resetAll()
+    {
+        std::vector<LatencyHistogram *> list = all();
+        for(int i=0; i<list.size(); i++) list[i]->reset();
+    };
+
+    //one row per timer, times in ms
+    static void writeCSV(std::ostream &out)
+    {
+        std::vector<LatencyHistogram *> list = all();
+        out << "timer,count,mean_ms,p50_ms,p90_ms,p99_ms,max_ms" << std::endl;
+        for(int i=0; i<list.size(); i++)
+        {
+            LatencyHistogram *t = list[i];
+            out << t->getName() << "," << t->getCount() << "," << t->getMean() * 1000 << ","
+                << t->percentile(0.5) * 1000 << "," << t->percentile(0.9) * 1000 << ","
+                << t->percentile(0.99) * 1000 << "," << t->getMax() * 1000 << std::endl;
+        }
+    };
+};
+
+//records the time from construction to the end of the scope. a NULL timer records nothing
+class ScopedTimer
+{
+protected:
+    LatencyHistogram *timer;
+    std::chrono::steady_clock::time_point started;
+
+public:
+    ScopedTimer(LatencyHistogram *t) : timer(t)
+    {
+        if( timer ) started = std::chrono::steady_clock::now();
+    };
+
+    ~ScopedTimer()
+    {
+        if( timer ) StatsRegistry::record( timer, std::chrono::duration<double>( std::chrono::steady_clock::now() - started ).count() );
+    };
+};
+
+#define MOTUS_STATS_CONCAT2(a, b) a##b
+#define MOTUS_STATS_CONCAT(a, b) MOTUS_STATS_CONCAT2(a, b)
+//times the rest of the scope into the named timer -- looked up once per call site
+#define MOTUS_TIME_SCOPE(name) \
+    static CRCPMotionAnalysis::LatencyHistogram *MOTUS_STATS_CONCAT(motusTimer, __LINE__) = CRCPMotionAnalysis::StatsRegistry::get(name); \
+    CRCPMotionAnalysis::ScopedTimer MOTUS_STATS_CONCAT(motusScope, __LINE__)( MOTUS_STATS_CONCAT(motusTimer, __LINE__) )
+//same, for stages the main loop doesn't wait on
+#define MOTUS_TIME_SCOPE_OFF_FRAME(name) \
+    static CRCPMotionAnalysis::LatencyHistogram *MOTUS_STATS_CONCAT(motusTimer, __LINE__) = CRCPMotionAnalysis::StatsRegistry::get(name, false); \
+    CRCPMotionAnalysis::ScopedTimer MOTUS_STATS_CONCAT(motusScope, __LINE__)( MOTUS_STATS_CONCAT(motusTimer, __LINE__) )
+
+};
+
+#endif /* Stats_h */
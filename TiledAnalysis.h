@@ -0,0 +1,198 @@
+//
+//  TiledAnalysis.h
+//  Motus
+//
+//  The frame differencing stage split across cores. The frame is cut into horizontal bands, each band is a task
+//  for opencv's thread pool (the same one BackgroundModel uses, capped by cv::setNumThreads), and each task does
+//  blur -> diff -> threshold -> square sums for its own rows. The blurs read their halo rows from the neighbouring
+//  bands, so the passes that write a frame the next pass blurs are separate parallel loops.
+//  Every band sums its pixels into its own partial square counts, and the partials are added up at the end --
+//  no two tasks ever write the same memory.
+//
+
+#ifndef TiledAnalysis_h
+#define TiledAnalysis_h
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "SquareGenerator.hpp"
+#include "AnalysisMask.h"
+
+#include <vector>
+
+#define ANALYSIS_BANDS 16 //twice the show machine's cores, so a slow band doesn't leave the others idle
+#define DIFF_THRESHOLD 50
+
+class TiledFrameDiff
+{
+protected:
+    int bandCount;
+    std::vector< std::vector<int> > partials; //per band, per square pixel sums
+
+    //square lookup -- built from the square layout & rebuilt if it or the frame size changes
+    int frameWidth, frameHeight;
+    int cellWidth, cellHeight, cellsX, cellsY;
+    std::vector<int> squareOf; //cell (cx * cellsY + cy) -> index in the squares, -1 if none
+    size_t squareCount;
+
+    std::vector< std::vector<cv::Rect> > bandRects; //scratch -- the live rects of each band
+
+    //rows [start, end) of a band. bands start on mask tile boundaries so a mask rect is never split
+    cv::Range bandRows(int band, int rows)
+    {
+        int tiles = ( rows + MASK_TILE_SIZE - 1 ) / MASK_TILE_SIZE;
+        int start = std::min(rows, tiles * band / bandCount * MASK_TILE_SIZE);
+        int end = std::min(rows, tiles * (band+1) / bandCount * MASK_TILE_SIZE);
+        return cv::Range(start, end);
+    };
+
+    void buildCells(SquareFrameDiff &squares, int width, int height)
+    {
+        vector<Square> &sq = squares.getSquares();
+        if( width == frameWidth && height == frameHeight && sq.size() == squareCount ) return;
+
+        frameWidth = width;
+        frameHeight = height;
+        squareCount = sq.size();
+        cellWidth = sq.empty() ? width : std::max(1, sq[0].getWidth());
+        cellHeight = sq.empty() ? height : std::max(1, sq[0].getHeight());
+        cellsX = ( width + cellWidth - 1 ) / cellWidth;
+        cellsY = ( height + cellHeight - 1 ) / cellHeight;
+
+        squareOf.assign(cellsX * cellsY, -1);
+        for(int i=0; i<sq.size(); i++)
+        {
+            int cx = sq[i].getXPos() / cellWidth, cy = sq[i].getYPos() / cellHeight;
+            if( cx < cellsX && cy < cellsY ) squareOf[cx * cellsY + cy] = i;
+        }
+
+        for(int b=0; b<bandCount; b++) partials[b].assign(squareCount, 0);
+    };
+
+    //the rects of this frame to work on, sorted into bands -- the mask's live tiles, or every band whole
+    void splitRects(const std::vector<cv::Rect> *liveRects, int rows, int cols)
+    {
+        for(int b=0; b<bandCount; b++)
+        {
+            bandRects[b].clear();
+            cv::Range r = bandRows(b, rows);
+            if( liveRects == NULL && r.end > r.start ) bandRects[b].push_back( cv::Rect(0, r.start, cols, r.end - r.start) );
+        }
+        if( liveRects == NULL ) return;
+
+        for(int i=0; i<liveRects->size(); i++)
+        {
+            const cv::Rect &rect = (*liveRects)[i];
+            for(int b=0; b<bandCount; b++)
+            {
+                cv::Range r = bandRows(b, rows);
+                if( rect.y >= r.start && rect.y < r.end ) { bandRects[b].push_back(rect); break; }
+            }
+        }
+    };
+
+    //adds the pixels of rect to this band's partial square sums
+    void sumRect(std::vector<int> &partial, const cv::Mat &diff, const cv::Rect &rect)
+    {
+        for(int y=rect.y; y<rect.y + rect.height; y++)
+        {
+            int cy = y / cellHeight;
+            const uint8_t *row = diff.ptr<uint8_t>(y);
+            int x = rect.x, xEnd = rect.x + rect.width;
+            while( x < xEnd )
+            {
+                int cx = x / cellWidth;
+                int runEnd = std::min(xEnd, (cx + 1) * cellWidth);
+                int sum = 0;
+                for(int i=x; i<runEnd; i++) sum += row[i]; //contiguous, so this vectorizes
+                int sq = squareOf[cx * cellsY + cy];
+                if( sq >= 0 ) partial[sq] += sum;
+                x = runEnd;
+            }
+        }
+    };
+
+public:
+    TiledFrameDiff(int bands=ANALYSIS_BANDS)
+    {
+        bandCount = std::max(1, bands);
+        partials.resize(bandCount);
+        bandRects.resize(bandCount);
+        frameWidth = frameHeight = -1;
+        cellWidth = cellHeight = 1;
+        cellsX = cellsY = 0;
+        squareCount = 0;
+    };
+
+    //box blur, a band per task
+    void blur(const cv::Mat &src, cv::Mat &dst, cv::Size kernel)
+    {
+        cv::parallel_for_( cv::Range(0, bandCount), [&](const cv::Range &range) {
+            for(int b=range.start; b<range.end; b++)
+            {
+                cv::Range rows = bandRows(b, src.rows);
+                if( rows.end <= rows.start ) continue;
+                cv::Mat out = dst.rowRange(rows);
+                cv::blur(src.rowRange(rows), out, kernel); //rowRange is a view, so the kernel reads the rows around it
+            }
+        } );
+    };
+
+    //gaussian blur of curr, differenced with prev & thresholded into diff -- only in liveRects if given.
+    //the square sums are counted in the same pass, while the rows are still in cache
+    void difference(const cv::Mat &curr, const cv::Mat &prev, cv::Mat &blurred, cv::Mat &diff, const std::vector<cv::Rect> *liveRects, SquareFrameDiff &squares)
+    {
+        blurred.create(curr.size(), CV_8UC1);
+        diff.create(curr.size(), CV_8UC1);
+        if( liveRects != NULL ) diff.setTo(0);
+        buildCells(squares, curr.cols, curr.rows);
+        splitRects(liveRects, curr.rows, curr.cols);
+
+        cv::parallel_for_( cv::Range(0, bandCount), [&](const cv::Range &range) {
+            for(int b=range.start; b<range.end; b++)
+            {
+                std::fill(partials[b].begin(), partials[b].end(), 0);
+                for(int i=0; i<bandRects[b].size(); i++)
+                {
+                    const cv::Rect &r = bandRects[b][i];
+                    cv::Mat blurredRect = blurred(r), diffRect = diff(r);
+                    cv::GaussianBlur(curr(r), blurredRect, cv::Size(5, 5), 0);
+                    cv::absdiff(blurredRect, prev(r), diffRect);
+                    cv::threshold(diffRect, diffRect, DIFF_THRESHOLD, 255, cv::THRESH_BINARY);
+                    sumRect(partials[b], diff, r);
+                }
+            }
+        } );
+    };
+
+    //just the square sums of a mask someone else made, eg. the background model's
+    void count(const cv::Mat &diff, const std::vector<cv::Rect> *liveRects, SquareFrameDiff &squares)
+    {
+        buildCells(squares, diff.cols, diff.rows);
+        splitRects(liveRects, diff.rows, diff.cols);
+
+        cv::parallel_for_( cv::Range(0, bandCount), [&](const cv::Range &range) {
+            for(int b=range.start; b<range.end; b++)
+            {
+                std::fill(partials[b].begin(), partials[b].end(), 0);
+                for(int i=0; i<bandRects[b].size(); i++) sumRect(partials[b], diff, bandRects[b][i]);
+            }
+        } );
+    };
+
+    //adds up the bands' partial sums into the squares' feature counts
+    void reduce(SquareFrameDiff &squares)
+    {
+        vector<Square> &sq = squares.getSquares();
+        if( sq.size() != squareCount ) return;
+        for(int i=0; i<sq.size(); i++)
+        {
+            int sum = 0;
+            for(int b=0; b<bandCount; b++) sum += partials[b][i];
+            sq[i].setFeatureCount(sum);
+        }
+    };
+};
+
+#endif /* TiledAnalysis_h */
@@ -0,0 +1,84 @@
+//
+//  TraceBatch.h
+//  Motus
+//
+//  Draws every visualizer's trace in one draw call, instead of a drawLine per point per visualizer per entity.
+//  Visualizers append their segments as normalized line vertices; the batch writes them into one persistent
+//  vbo w/ a sub-buffer write & draws them scaled to the window. The vbo only grows -- when the traces outgrow it,
+//  eg. a performer joins -- so a frame's cost is one upload & one draw however many traces there are.
+//
+
+#ifndef TraceBatch_h
+#define TraceBatch_h
+
+#include "cinder/app/App.h"
+#include "cinder/gl/gl.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#define TRACE_INITIAL_VERTICES 1024 //6 visualizers of 25 points w/ room to spare
+
+namespace CRCPMotionAnalysis {
+
+struct TraceVertex
+{
+    ci::vec2 position; //normalized to the window
+    ci::ColorA color;
+};
+
+class TraceBatch
+{
+protected:
+    std::vector<TraceVertex> vertices; //this frame's, 2 per segment
+    ci::gl::VboRef vbo;
+    ci::gl::BatchRef batch;
+    size_t capacity = 0; //vertices the vbo holds
+
+    //a bigger vbo & the batch over it -- the only time anything is allocated on the gpu
+    void reserve(size_t count)
+    {
+        capacity = std::max<size_t>( TRACE_INITIAL_VERTICES, capacity );
+        while( capacity < count ) capacity *= 2;
+
+        vbo = ci::gl::Vbo::create( GL_ARRAY_BUFFER, capacity * sizeof(TraceVertex), NULL, GL_DYNAMIC_DRAW );
+        ci::geom::BufferLayout layout;
+        layout.append( ci::geom::Attrib::POSITION, 2, sizeof(TraceVertex), offsetof(TraceVertex, position) );
+        layout.append( ci::geom::Attrib::COLOR, 4, sizeof(TraceVertex), offsetof(TraceVertex, color) );
+        ci::gl::VboMeshRef mesh = ci::gl::VboMesh::create( (uint32_t) capacity, GL_LINES, { { layout, vbo } } );
+        batch = ci::gl::Batch::create( mesh, ci::gl::getStockShader( ci::gl::ShaderDef().color() ) );
+    };
+
+public:
+    //start a frame's traces
+    inline void clear(){ vertices.clear(); };
+
+    //one line strip's segments, points normalized to the window
+    void appendStrip(const std::vector<ci::vec2> &points, const ci::ColorA &color)
+    {
+        for(int i=1; i<points.size(); i++)
+        {
+            vertices.push_back( { points[i-1], color } );
+            vertices.push_back( { points[i], color } );
+        }
+    };
+
+    inline size_t getVertexCount(){ return vertices.size(); };
+
+    //uploads & draws everything appended since clear()
+    void draw()
+    {
+        if( vertices.empty() ) return;
+        if( vertices.size() > capacity || !batch ) reserve( vertices.size() );
+        vbo->bufferSubData( 0, vertices.size() * sizeof(TraceVertex), vertices.data() );
+
+        ci::gl::ScopedModelMatrix model;
+        ci::gl::scale( ci::vec2( ci::app::getWindowSize() ) );
+        batch->draw( 0, (GLsizei) vertices.size() );
+    };
+};
+
+};
+
+#endif /* TraceBatch_h */
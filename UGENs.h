@@ -11,23 +11,84 @@
 #define UGENs_h
 
 using namespace ci;
-using namespace gl;
 
 #include <iostream>
 using namespace std;
 
+#include "Stats.h"
+
 namespace CRCPMotionAnalysis {
     
-    static const double SR = 51.2; // Sample rate -- this may vary for sensors...
+    static const double SR = 51.2; // Sample rate -- this may vary for sensors... it's the default rate the Resampler puts them on
+    static const double TIE_SPACING = 0.001; //seconds the Resampler puts between samples that arrived w/ the same time stamp
     
     
     //abstract class of all ugens
     class UGEN
     {
+    protected:
+        unsigned long generation; //bumped every time this ugen computes new output
+        bool fresh; //whether the last process() call actually updated
+        LatencyHistogram *timer; //times update() in process(), if set
+        
     public:
-        UGEN(){};
+        UGEN(){ generation = 0; fresh = false; timer = NULL; };
+        virtual ~UGEN(){}; //graphs get torn down & rebuilt on a reload, so ugens are deleted through this
         virtual std::vector<ci::osc::Message> getOSC()=0;//<-- create/collect OSC messages that you may want to send to another program or computer
         virtual void update(float seconds=0)= 0; //<-- do the meat of the signal processing / feature extraction here
+        
+        //the allocation free way to send -- append our messages straight into the packet.
+        //the default encodes whatever getOSC() makes; ugens that send a lot override this to skip the Message vector
+        virtual void appendOSC(OscPacketWriter &packet)
+        {
+            std::vector<ci::osc::Message> msgs = getOSC();
+            for(int i=0; i<msgs.size(); i++)
+                appendMessage(packet, msgs[i]);
+        };
+        
+        //encodes a ci::osc::Message w/ float & int args into the packet. other arg types aren't supported here
+        static void appendMessage(OscPacketWriter &packet, const ci::osc::Message &msg)
+        {
+            char tags[OSC_HEADER_MAX];
+            int count = std::min<int>(msg.getNumArgs(), OSC_HEADER_MAX - 1);
+            for(int i=0; i<count; i++)
+            {
+                ci::osc::ArgType type = msg.getArgType(i);
+                if( type == ci::osc::ArgType::FLOAT ) tags[i] = 'f';
+                else if( type == ci::osc::ArgType::INTEGER_32 ) tags[i] = 'i';
+                else return;
+            }
+            tags[count] = 0;
+            
+            OscAddress addr(msg.getAddress().c_str(), tags);
+            if( !packet.begin(addr) ) return;
+            for(int i=0; i<count; i++)
+            {
+                if( tags[i] == 'f' ) packet.writeFloat( msg.getArgFloat(i) );
+                else packet.writeInt( msg.getArgInt32(i) );
+            }
+            packet.end();
+        };
+        
+        //dirty tracking -- does anything upstream have new samples since we last computed?
+        virtual bool needsUpdate(){ return true; };
+        virtual void markUpdated(){ generation++; };
+        
+        inline unsigned long getGeneration(){ return generation; };
+        inline bool isFresh(){ return fresh; };
+        inline void setTimer(LatencyHistogram *t){ timer = t; };
+        
+        //call this instead of update() -- only recomputes when an input produced new samples this frame
+        void process(float seconds=0)
+        {
+            fresh = needsUpdate();
+            if( !fresh ) return;
+            {
+                ScopedTimer scope(timer);
+                update(seconds);
+            }
+            markUpdated();
+        };
     };
     
     class SignalAnalysis : public UGEN //any data that will analyze a signal
@@ -46,6 +107,8 @@ namespace CRCPMotionAnalysis {
         bool useGry;
         bool useQuart;
         
+        unsigned long seenGeneration[2]; //the input generations we last computed from
+        
         //find the average over a window given an input & start & index of a buffer
         virtual double findAvg(std::vector<double> input, int start, int end)
         {
@@ -68,6 +131,7 @@ namespace CRCPMotionAnalysis {
             
             ugen = s1;
             ugen2 = s2;
+            seenGeneration[0] = seenGeneration[1] = 0;
             
             setBufferSize(bufsize);
             
@@ -97,6 +161,21 @@ namespace CRCPMotionAnalysis {
             else return 0;
         }
         
+        //dirty if either input has computed since we last did
+        virtual bool needsUpdate()
+        {
+            if( ugen == NULL && ugen2 == NULL ) return true;
+            return ( ugen != NULL && ugen->getGeneration() != seenGeneration[0] ) ||
+                   ( ugen2 != NULL && ugen2->getGeneration() != seenGeneration[1] );
+        };
+        
+        virtual void markUpdated()
+        {
+            if( ugen != NULL ) seenGeneration[0] = ugen->getGeneration();
+            if( ugen2 != NULL ) seenGeneration[1] = ugen2->getGeneration();
+            UGEN::markUpdated();
+        };
+        
         //which signals are we dealing with or using?
         inline void processAccel(bool a)
         {
@@ -126,6 +205,11 @@ namespace CRCPMotionAnalysis {
             return data2;
         };
         
+        //the last sample of getBuffer(), w/o copying it. NULL if there's none
+        virtual inline MocapDeviceData *getNewest(){
+            return data1.empty() ? NULL : data1.back();
+        };
+        
         int getBufferSize(){return buffersize;};
         
         virtual void update(float seconds=0)
@@ -197,6 +281,7 @@ public:
     {
         ID1= idz;
         isPhone = phone;
+        sensor = NULL;
     };
     
     //not sending any OSC currently
@@ -207,6 +292,8 @@ public:
         return msgs;
     };
     
+    virtual void appendOSC(OscPacketWriter &packet){};
+    
     void setInput( SensorData *s1 )
     {
         sensor = s1;
@@ -217,6 +304,12 @@ public:
         return sensor->getNewSampleCount();
     };
     
+    //the source of the graph -- dirty whenever the sensor got samples this frame
+    virtual bool needsUpdate()
+    {
+        return sensor != NULL && sensor->getNewSampleCount() > 0;
+    };
+    
     //puts valid mocap data in buffers for other ugens.
     //work with one buffer at a time in each frame
     virtual void update(float seconds=0)
@@ -262,6 +355,11 @@ public:
             
         }
         
+        virtual ~OutputSignalAnalysis()
+        {
+            eraseData();
+        };
+        
         //puts in accel data slots -- all other data left alone -- ALSO only
         void toOutputVector( std::vector<float> inputX, std::vector<float> inputY, std::vector<float> inputZ )
         {
@@ -285,6 +383,10 @@ public:
         virtual std::vector<MocapDeviceData *> getBuffer(){
             return outdata1;
         };
+        
+        virtual MocapDeviceData *getNewest(){
+            return outdata1.empty() ? NULL : outdata1.back();
+        };
     
     };
     
@@ -372,6 +474,14 @@ public:
             }
             return msgs;
         };
+        
+        //same messages as getOSC(), written straight into the packet
+        virtual void appendOSC(OscPacketWriter &packet)
+        {
+            static const OscAddress addr( "/mocap/points", "ff" );
+            for (int i = 0; i < outdata1.size(); i++)
+                packet.append( addr, (float)outdata1[i]->getData(2), (float)outdata1[i]->getData(3) );
+        };
     };
     
     class Derivative : public OutputSignalAnalysis
@@ -389,10 +499,9 @@ public:
         {
 
             OutputSignalAnalysis::update(seconds);
-            if( data1.size() < buffersize) return ;
+            if( data1.size() < 2 ) return ; //a derivative's output is one shorter than its input, so chained ones can't wait for a full buffer
             
-            derivative.clear();
-            outdata1.clear();
+            derivative.clear(); //outdata1 was already freed & cleared by eraseData()
             
             for (int i = 1; i < data1.size(); i++)
             {
@@ -411,11 +520,13 @@ public:
                 
             }
             
-            for( int i=2; i < derivative.size(); i++ )
+            //derivative holds x,y pairs -- one output per input sample, stamped with that sample's index & time
+            for( int i=1; i < derivative.size(); i+=2 )
             {
                 MocapDeviceData *mdd= new MocapDeviceData();
-                mdd->setData(MocapDeviceData::DataIndices::INDEX, derivative[i - 1]);
-                mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, derivative[i - 1]);
+                int sample = (i + 1) / 2;
+                mdd->setData(MocapDeviceData::DataIndices::INDEX, data1[sample]->getData(MocapDeviceData::DataIndices::INDEX));
+                mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, data1[sample]->getData(MocapDeviceData::DataIndices::TIME_STAMP));
 
                 if( useAccel )
                 {
@@ -456,7 +567,195 @@ public:
             }
             return msgs;
         };
+        
+        virtual void appendOSC(OscPacketWriter &packet)
+        {
+            static const OscAddress addr( "/mocap/derivative/", "ff" );
+            for (int i = 0; i < outdata1.size(); i++)
+                packet.append( addr, (float)outdata1[i]->getData(2), (float)outdata1[i]->getData(3) );
+        };
+    
+    };
+    
+    //base for stateful ugens (resampling, iir filters, ...) that have to see each input sample exactly once.
+    //processSample() is called only for input samples newer than the last one we saw -- by INDEX, the sensor's running
+    //sample number, so samples sharing a time stamp (eg. several in one packet) all get through. the outputs persist
+    //across frames in a rolling window of the last bufsize samples -- so downstream buffer-based filters work unchanged.
+    class StreamingSignalAnalysis : public OutputSignalAnalysis
+    {
+    protected:
+        double lastInputIndex;
+        bool emitted; //did the last update produce new samples?
+        
+        virtual void processSample(MocapDeviceData *sample) = 0;
+        
+        void emitSample(MocapDeviceData *out)
+        {
+            outdata1.push_back(out);
+            emitted = true;
+        };
+        
+        //drop the oldest outputs so we hold at most buffersize
+        void trimWindow()
+        {
+            if( outdata1.size() <= buffersize ) return;
+            int numErase = outdata1.size() - buffersize;
+            for(int i=0; i<numErase; i++) delete outdata1[i];
+            outdata1.erase( outdata1.begin(), outdata1.begin() + numErase );
+        };
+        
+    public:
+        StreamingSignalAnalysis(SignalAnalysis *s1, int bufsize=48, SignalAnalysis *s2 = NULL) : OutputSignalAnalysis(s1, bufsize, s2)
+        {
+            lastInputIndex = -1;
+            emitted = false;
+        };
+        
+        virtual void update(float seconds = 0)
+        {
+            SignalAnalysis::update(seconds); //not OutputSignalAnalysis::update() -- our outputs persist across frames
+            emitted = false;
+            
+            for(int i=0; i<data1.size(); i++)
+            {
+                double index = data1[i]->getData(MocapDeviceData::DataIndices::INDEX);
+                if( index <= lastInputIndex ) continue; //already used it
+                lastInputIndex = index;
+                processSample(data1[i]);
+            }
+            trimWindow();
+        };
+        
+        //downstream only recomputes if we actually produced new samples
+        virtual void markUpdated()
+        {
+            unsigned long g = generation;
+            SignalAnalysis::markUpdated();
+            if( !emitted ) generation = g;
+        };
+        
+        virtual std::vector<ci::osc::Message> getOSC()
+        {
+            std::vector<ci::osc::Message> msgs;
+            return msgs;
+        };
+        
+        virtual void appendOSC(OscPacketWriter &packet){};
+    };
     
+    //resamples an irregular sensor stream onto a uniform grid using the samples' real arrival times.
+    //the grid is global -- tick k is at k/rate seconds for every sensor -- so all resampled streams line up sample for sample
+    //and anything downstream can assume a fixed time step of 1/rate. INDEX of each output is its tick.
+    class Resampler : public StreamingSignalAnalysis
+    {
+    protected:
+        static const int CHANNEL_COUNT = 6;
+        
+        struct Knot
+        {
+            double t;
+            double v[CHANNEL_COUNT];
+        };
+        
+        double rate;
+        bool cubic; //catmull-rom, else linear
+        double maxGap; //don't interpolate across dropouts longer than this, in seconds
+        
+        Knot knots[4]; //the last 4 input samples, oldest first
+        int knotCount;
+        long nextTick; //next grid tick to output
+        
+        int channelIndex(int c)
+        {
+            static const int indices[CHANNEL_COUNT] = { MocapDeviceData::DataIndices::ACCELX, MocapDeviceData::DataIndices::ACCELY, MocapDeviceData::DataIndices::ACCELZ,
+                MocapDeviceData::DataIndices::GYROX, MocapDeviceData::DataIndices::GYROY, MocapDeviceData::DataIndices::GYROZ };
+            return indices[c];
+        };
+        
+        void pushKnot(MocapDeviceData *sample, double t)
+        {
+            if( knotCount == 4 )
+            {
+                for(int i=0; i<3; i++) knots[i] = knots[i+1];
+                knotCount = 3;
+            }
+            knots[knotCount].t = t;
+            for(int c=0; c<CHANNEL_COUNT; c++) knots[knotCount].v[c] = sample->getData( channelIndex(c) );
+            knotCount++;
+        };
+        
+        //value at u in [0,1] between p1 & p2
+        static double catmullRom(double p0, double p1, double p2, double p3, double u)
+        {
+            return 0.5 * ( 2*p1 + (-p0 + p2)*u + (2*p0 - 5*p1 + 4*p2 - p3)*u*u + (-p0 + 3*p1 - 3*p2 + p3)*u*u*u );
+        };
+        
+        void emit(long tick, const Knot &a, const Knot &b, const Knot *before, const Knot *after)
+        {
+            double t = tick / rate;
+            double u = ( t - a.t ) / ( b.t - a.t );
+            
+            MocapDeviceData *mdd = new MocapDeviceData();
+            mdd->setData(MocapDeviceData::DataIndices::INDEX, tick);
+            mdd->setData(MocapDeviceData::DataIndices::TIME_STAMP, t);
+            for(int c=0; c<CHANNEL_COUNT; c++)
+            {
+                if( a.v[c] == NO_DATA || b.v[c] == NO_DATA ) continue; //eg. no gyro on a wiimote
+                double v;
+                if( cubic && before != NULL && after != NULL && before->v[c] != NO_DATA && after->v[c] != NO_DATA )
+                    v = catmullRom(before->v[c], a.v[c], b.v[c], after->v[c], u);
+                else
+                    v = a.v[c] + ( b.v[c] - a.v[c] ) * u;
+                mdd->setData(channelIndex(c), v);
+            }
+            emitSample(mdd);
+        };
+        
+        //outputs every tick in the segment a -> b
+        void emitSegment(const Knot &a, const Knot &b, const Knot *before, const Knot *after)
+        {
+            if( nextTick < std::ceil(a.t * rate) ) nextTick = std::ceil(a.t * rate); //first segment after a reset
+            while( nextTick / rate <= b.t )
+            {
+                emit(nextTick, a, b, before, after);
+                nextTick++;
+            }
+        };
+        
+        //a sample stamped no later than the one before it, eg. the rest of a packet's samples, goes TIE_SPACING after it --
+        //so each is a knot of its own, rather than dividing by a zero length segment
+        virtual void processSample(MocapDeviceData *sample)
+        {
+            double t = sample->getData(MocapDeviceData::DataIndices::TIME_STAMP);
+            if( knotCount > 0 && t <= knots[knotCount-1].t ) t = knots[knotCount-1].t + TIE_SPACING;
+            pushKnot(sample, t);
+            if( knotCount < 2 ) return;
+            
+            if( knots[knotCount-1].t - knots[knotCount-2].t > maxGap ) //dropout -- start over from this sample
+            {
+                knots[0] = knots[knotCount-1];
+                knotCount = 1;
+                return;
+            }
+            
+            if( !cubic )
+                emitSegment(knots[knotCount-2], knots[knotCount-1], NULL, NULL);
+            else if( knotCount >= 3 ) //the segment before the newest, now that we know the sample after it
+                emitSegment(knots[knotCount-3], knots[knotCount-2], knotCount == 4 ? &knots[0] : &knots[knotCount-3], &knots[knotCount-1]);
+        };
+        
+    public:
+        Resampler(SignalAnalysis *s1, double _rate=SR, bool _cubic=false, int bufsize=48) : StreamingSignalAnalysis(s1, bufsize)
+        {
+            rate = _rate;
+            cubic = _cubic;
+            maxGap = 0.25;
+            knotCount = 0;
+            nextTick = 0;
+        };
+        
+        inline void setMaxGap(double seconds){ maxGap = seconds; };
+        inline double getRate(){ return rate; };
     };
     
     //this class visualizes incoming motion data
@@ -469,12 +768,12 @@ public:
         std::vector<float>  alpha;
         
     public:
-        MocapDataVisualizer(OutputSignalAnalysis *s1 = NULL, int _maxDraw=25,int bufsize=48, SignalAnalysis *s2 = NULL) : SignalAnalysis(s1, bufsize, s2)
+        MocapDataVisualizer(SignalAnalysis *s1 = NULL, int _maxDraw=25,int bufsize=48, SignalAnalysis *s2 = NULL) : SignalAnalysis(s1, bufsize, s2)
         {
             maxDraw = _maxDraw;
         };
         
-        //add data as screen positions and color alphas.
+        //add data as normalized positions and color alphas -- scaled to the window when drawn, so this runs w/o one
         void update(float seconds = 0)
         {
             std::vector<MocapDeviceData *> buffer = ugen->getBuffer();
@@ -488,7 +787,7 @@ public:
             
             for(int i=buffer.size()-maxDraw; i<buffer.size(); i++)
             {
-                points.push_back(ci::vec2(buffer[i]->getData(MocapDeviceData::DataIndices::ACCELX)*ci::app::getWindowWidth(), buffer[i]->getData(MocapDeviceData::DataIndices::ACCELY)*ci::app::getWindowHeight()));
+                points.push_back(ci::vec2(buffer[i]->getData(MocapDeviceData::DataIndices::ACCELX), buffer[i]->getData(MocapDeviceData::DataIndices::ACCELY)));
                 //cout << buffer[i]->getData(MocapDeviceData::DataIndices::ACCELZ ) << endl;
                 alpha.push_back(buffer[i]->getData(MocapDeviceData::DataIndices::ACCELZ));
             }
@@ -498,18 +797,9 @@ public:
         };
         
         
-        //visualize the data
-        void draw()
-        {
-            //float circleSize = 2;
-                for(int i=1; i<points.size(); i++)
-                {
-                    drawLine(points[i-1], points[i]);
-                    //drawSolidCircle(points[i], circleSize);
-                }
-            
-            points.clear();
-        };
+        //the trace to draw, normalized -- the app batches every visualizer's into one draw.
+        //points are kept until the next update, so frames with no new samples still draw the last trace
+        inline const std::vector<ci::vec2> &getPoints(){ return points; };
         
         //if you wanted to send something somewhere... prob. not
         std::vector<ci::osc::Message> getOSC()
@@ -526,6 +816,8 @@ public:
 //            }
             return msgs;
         };
+        
+        virtual void appendOSC(OscPacketWriter &packet){};
 
 
 };
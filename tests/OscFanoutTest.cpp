@@ -0,0 +1,283 @@
+//
+//  OscFanoutTest.cpp
+//  Motus
+//
+//  Frames through the fan-out over loopback, the way the engine sends them -- bundles from an OscPacketWriter:
+//    subscribers that take everything & binary ones share one copy, & every datagram arrives
+//    a subscriber w/ patterns only gets the messages that match
+//    a subscriber w/ a small bundle size gets datagrams no bigger than it, except a message too big for it, alone
+//    a subscriber w/ a rate skips the frames in between
+//
+
+#include "OscFanout.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace CRCPMotionAnalysis;
+
+#define TEST_PORT 9790
+#define TEST_BUNDLES 60 //a frame's worth of bundles
+#define TEST_SUBSCRIBERS 3
+#define TEST_FPS 60
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if( !ok ) { std::printf("FAIL: %s\n", what); failures++; }
+}
+
+static int bindReceiver(int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    std::memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int buffer = 1 << 20;
+    setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer) );
+    if( bind( fd, (sockaddr *) &addr, sizeof(addr) ) != 0 ) { close(fd); return -1; }
+    return fd;
+}
+
+//datagrams waiting on fd, & whether each starts w/ prefix
+static int drain(int fd, const char *prefix, bool &allMatch)
+{
+    uint8_t buffer[OSC_PACKET_MAX * 4];
+    int count = 0;
+    ssize_t n;
+    while( ( n = recv( fd, buffer, sizeof(buffer), MSG_DONTWAIT ) ) > 0 )
+    {
+        count++;
+        if( std::memcmp( buffer, prefix, std::strlen(prefix) ) != 0 ) allMatch = false;
+    }
+    return count;
+}
+
+//one received bundle -- its size & the addresses of its messages
+struct Datagram
+{
+    size_t size;
+    std::vector<std::string> addresses;
+};
+
+static std::vector<Datagram> receiveBundles(int fd)
+{
+    std::vector<Datagram> got;
+    uint8_t buffer[OSC_PACKET_MAX * 4];
+    ssize_t n;
+    while( ( n = recv( fd, buffer, sizeof(buffer), MSG_DONTWAIT ) ) > 0 )
+    {
+        Datagram d;
+        d.size = n;
+        check( n > OSC_BUNDLE_HEADER_SIZE && std::memcmp( buffer, "#bundle", 8 ) == 0, "subscribers get bundles" );
+        for(size_t at = OSC_BUNDLE_HEADER_SIZE; at + 4 <= (size_t) n; )
+        {
+            uint32_t len = ( (uint32_t) buffer[at] << 24 ) | ( (uint32_t) buffer[at+1] << 16 ) | ( (uint32_t) buffer[at+2] << 8 ) | buffer[at+3];
+            check( at + 4 + len <= (size_t) n, "bundle elements fit their bundle" );
+            if( at + 4 + len > (size_t) n ) break;
+            d.addresses.push_back( std::string( (const char *) buffer + at + 4 ) );
+            at += 4 + len;
+        }
+        got.push_back(d);
+    }
+    return got;
+}
+
+//pass-all & binary subscribers, several of each -- one shared copy queued for all of them can't overflow the send arrays
+static void testShared()
+{
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    int osc[TEST_SUBSCRIBERS], binary[TEST_SUBSCRIBERS];
+    OscFanout fanout;
+    fanout.setSocket(sender);
+    for(int i=0; i<TEST_SUBSCRIBERS; i++)
+    {
+        osc[i] = bindReceiver( TEST_PORT + i );
+        binary[i] = bindReceiver( TEST_PORT + TEST_SUBSCRIBERS + i );
+        check( osc[i] >= 0 && binary[i] >= 0, "bind the receivers" );
+        fanout.subscribe( "127.0.0.1", TEST_PORT + i, std::vector<std::string>() );
+        fanout.subscribe( "127.0.0.1", TEST_PORT + TEST_SUBSCRIBERS + i, std::vector<std::string>(), 0, OSC_PACKET_MAX, true );
+    }
+
+    //one message a bundle -- "/a" w/ no args
+    uint8_t bundle[OSC_BUNDLE_HEADER_SIZE + 12];
+    std::memcpy( bundle, "#bundle\0\0\0\0\0\0\0\0\1", OSC_BUNDLE_HEADER_SIZE );
+    uint8_t message[12] = { 0, 0, 0, 8, '/', 'a', 0, 0, ',', 0, 0, 0 };
+    std::memcpy( bundle + OSC_BUNDLE_HEADER_SIZE, message, sizeof(message) );
+    uint8_t frame[64] = { 'M', 'O', 'T', 'S' };
+
+    fanout.beginFrame(0);
+    for(int i=0; i<TEST_BUNDLES; i++)
+    {
+        fanout.add( bundle, sizeof(bundle) );
+        fanout.addBinary( frame, sizeof(frame) );
+    }
+    fanout.send();
+    usleep(50000);
+
+    for(int i=0; i<TEST_SUBSCRIBERS; i++)
+    {
+        bool oscOnly = true, binaryOnly = true;
+        check( drain( osc[i], "#bundle", oscOnly ) == TEST_BUNDLES, "every bundle to every subscriber that takes everything" );
+        check( drain( binary[i], "MOTS", binaryOnly ) == TEST_BUNDLES, "every binary frame to every binary subscriber" );
+        check( oscOnly && binaryOnly, "osc & binary subscribers only get their own format" );
+    }
+    check( fanout.getSendErrors() == 0, "no send errors" );
+
+    for(int i=0; i<TEST_SUBSCRIBERS; i++) { close(osc[i]); close(binary[i]); }
+    close(sender);
+}
+
+//a subscriber w/ patterns gets what matches & nothing else, next to one that gets it all
+static void testPatterns()
+{
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    int all = bindReceiver( TEST_PORT + 10 ), some = bindReceiver( TEST_PORT + 11 );
+    check( all >= 0 && some >= 0, "bind the receivers" );
+    OscFanout fanout;
+    fanout.setSocket(sender);
+    fanout.subscribe( "127.0.0.1", TEST_PORT + 10, std::vector<std::string>() );
+    std::vector<std::string> patterns = { "/mocap/square", "/mocap/*/hand*" };
+    fanout.subscribe( "127.0.0.1", TEST_PORT + 11, patterns );
+
+    OscPacketWriter packet;
+    packet.setSink( [&]( const uint8_t *data, size_t size ){ fanout.add(data, size); } );
+    static const OscAddress square( "/mocap/square", "ff" );
+    static const OscAddress squares( "/mocap/squares", "ff" ); //only a prefix of a pattern
+    static const OscAddress hand( "/mocap/derivative/hand1", "ff" ); //'*' takes the slash
+    static const OscAddress points( "/mocap/points", "ff" );
+    static const OscAddress depth( "/depth/voxels", "ff" );
+
+    fanout.beginFrame(0);
+    for(int i=0; i<TEST_BUNDLES; i++)
+    {
+        packet.append( square, 1, 2 );
+        packet.append( squares, 1, 2 );
+        packet.append( hand, 1, 2 );
+        packet.append( points, 1, 2 );
+        packet.append( depth, 1, 2 );
+    }
+    packet.flush();
+    fanout.send();
+    usleep(50000);
+
+    int allCount = 0, squareCount = 0, handCount = 0, otherCount = 0;
+    std::vector<Datagram> got = receiveBundles(all);
+    for(int i=0; i<got.size(); i++) allCount += got[i].addresses.size();
+    got = receiveBundles(some);
+    for(int i=0; i<got.size(); i++)
+    {
+        for(int m=0; m<got[i].addresses.size(); m++)
+        {
+            const std::string &a = got[i].addresses[m];
+            if( a == "/mocap/square" ) squareCount++;
+            else if( a == "/mocap/derivative/hand1" ) handCount++;
+            else otherCount++;
+        }
+    }
+    check( allCount == 5 * TEST_BUNDLES, "the subscriber w/o patterns gets every message" );
+    check( squareCount == TEST_BUNDLES && handCount == TEST_BUNDLES, "the filtered subscriber gets every message that matches" );
+    check( otherCount == 0, "the filtered subscriber gets nothing that doesn't match" );
+
+    close(all); close(some);
+    close(sender);
+}
+
+//a subscriber's bundle size splits its messages over datagrams -- & a message bigger than that goes alone
+static void testBundleSize()
+{
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    int small = bindReceiver( TEST_PORT + 12 );
+    check( small >= 0, "bind the receiver" );
+    OscFanout fanout;
+    fanout.setSocket(sender);
+    std::vector<std::string> patterns = { "*" };
+    fanout.subscribe( "127.0.0.1", TEST_PORT + 12, patterns, 0, FANOUT_MIN_BUNDLE );
+
+    OscPacketWriter packet;
+    packet.setSink( [&]( const uint8_t *data, size_t size ){ fanout.add(data, size); } );
+    static const OscAddress point( "/s", "ff" ); //20 bytes in a bundle -- 2 to a datagram
+    static const OscAddress big( "/big", "ffffffffffffffffffffffffffffff" ); //164 bytes, more than the bundle size
+    float args[30] = {};
+
+    fanout.beginFrame(0);
+    for(int i=0; i<5; i++) packet.append( point, 1, 2 );
+    packet.append( big, args, 30 );
+    for(int i=0; i<5; i++) packet.append( point, 1, 2 );
+    packet.flush();
+    fanout.send();
+    usleep(50000);
+
+    std::vector<Datagram> got = receiveBundles(small);
+    int messages = 0, bigAlone = 0;
+    bool sized = true;
+    for(int i=0; i<got.size(); i++)
+    {
+        messages += got[i].addresses.size();
+        bool isBig = std::find( got[i].addresses.begin(), got[i].addresses.end(), "/big" ) != got[i].addresses.end();
+        if( isBig && got[i].addresses.size() == 1 ) bigAlone++;
+        if( !isBig && got[i].size > FANOUT_MIN_BUNDLE ) sized = false;
+    }
+    check( got.size() > 2, "a small bundle size splits the frame over several datagrams" );
+    check( sized, "each datagram is within the subscriber's bundle size" );
+    check( bigAlone == 1, "a message bigger than the bundle size goes in a datagram of its own" );
+    check( messages == 11, "no message is lost to the splitting" );
+
+    close(small);
+    close(sender);
+}
+
+//a subscriber w/ a rate only gets the frames on its ticks -- a second of frames at TEST_FPS
+static void testRate()
+{
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    int every = bindReceiver( TEST_PORT + 13 ), rated = bindReceiver( TEST_PORT + 14 );
+    check( every >= 0 && rated >= 0, "bind the receivers" );
+    OscFanout fanout;
+    fanout.setSocket(sender);
+    fanout.subscribe( "127.0.0.1", TEST_PORT + 13, std::vector<std::string>() );
+    fanout.subscribe( "127.0.0.1", TEST_PORT + 14, std::vector<std::string>(), 10 );
+
+    OscPacketWriter packet;
+    packet.setSink( [&]( const uint8_t *data, size_t size ){ fanout.add(data, size); } );
+    static const OscAddress frameAddr( "/frame", "f" );
+
+    std::vector<int> ratedFrames;
+    for(int f=0; f<TEST_FPS; f++)
+    {
+        fanout.beginFrame( f / (double) TEST_FPS );
+        float n = f;
+        packet.append( frameAddr, &n, 1 );
+        packet.flush();
+        fanout.send();
+        usleep(1000);
+
+        bool any = true;
+        if( drain( rated, "#bundle", any ) > 0 ) ratedFrames.push_back(f);
+    }
+    usleep(50000);
+
+    bool any = true;
+    check( drain( every, "#bundle", any ) == TEST_FPS, "the subscriber w/o a rate gets every frame" );
+    check( ratedFrames.size() == 10, "the subscriber at 10 a second gets 10 of a second's frames" );
+    bool spaced = !ratedFrames.empty() && ratedFrames[0] == 0;
+    for(int i=1; i<ratedFrames.size(); i++) spaced = spaced && ratedFrames[i] - ratedFrames[i-1] == TEST_FPS / 10;
+    check( spaced, "the rated subscriber skips the frames between its ticks" );
+
+    close(every); close(rated);
+    close(sender);
+}
+
+int main()
+{
+    testShared();
+    testPatterns();
+    testBundleSize();
+    testRate();
+    if( failures == 0 ) std::printf("OscFanoutTest passed\n");
+    return failures == 0 ? 0 : 1;
+}